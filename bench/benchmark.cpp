@@ -0,0 +1,295 @@
+// standard scenes for judging performance changes, reports for every scene the acceleration structure
+// build time and memory, rays per second by kind and the time per frame
+// usage: benchmark [scene files] [--threads n] [--frames n] [--json path] [--baseline path] [--tolerance t] [--<setting> values]
+// run from the repository root, with no scene files the standard set is rendered
+// --json writes the results, --baseline compares them to results written earlier and fails if any
+// scene got more than tolerance (default 0.15) slower or bigger
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include "../src/scene.h"
+#include "../src/meshcache.h"
+#include "../src/framebuffer.h"
+#include "../src/imagewriter.h"
+#include "../src/threadpool.h"
+#include "../src/renderer.h"
+#include "../src/scenefile.h"
+#include "../src/stats.h"
+
+
+// counts heap allocations in RT_STATS builds, the tile allocations are part of the statistics
+STATS_ALLOCATION_HOOK
+
+
+const char* STANDARD_SCENES[] = {
+    "scenes/bench/cornell_bunny.scene",
+    "scenes/bench/cow.scene",
+    "scenes/bench/glass.scene",
+    "scenes/bench/instances.scene"
+};
+
+struct SceneResult{
+    std::string name;
+    std::string file;
+    int width;
+    int height;
+    int spp;
+    uint64_t triangles = 0;
+    double buildMs = 0;
+    size_t structureBytes = 0;
+    size_t geometryBytes = 0;
+    // median over the frames
+    double frameMs = 0;
+    // rays of one frame
+    RayCounts rays;
+
+    double perSecond(uint64_t count) const{
+        return frameMs > 0 ? count / (frameMs / 1000) : 0;
+    }
+};
+
+
+double milliseconds(std::chrono::steady_clock::duration duration){
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// loads, builds and renders one scene frames times, false if it could not be loaded or written
+bool benchmarkScene(const std::string& path, const std::vector<std::string>& overrides, int frames, ThreadPool& pool, ImageEncoder& encoder, SceneResult& result){
+    using clock = std::chrono::steady_clock;
+    // a library per scene, so each one pays for its own meshes
+    MeshLibrary library(&pool);
+    SceneLoader loader(library);
+    RenderJob job;
+    if (!loader.load(path, overrides, job)){
+        return false;
+    }
+    std::string stem = path.substr(path.find_last_of("/\\") + 1);
+    result.name = stem.substr(0, stem.find_last_of('.'));
+    result.file = path;
+    result.width = job.settings.width;
+    result.height = job.settings.height;
+    result.spp = job.settings.spp;
+
+    // meshes coming from the cache skip their build, so every one is built again here
+    auto start = clock::now();
+    for (const auto& mesh: library.loaded()){
+        if (!mesh->tree.empty()){
+            mesh->recalcOctree(mesh->tree.depth, &pool);
+        }
+        else{
+            mesh->recalcBVH(true, &pool);
+        }
+    }
+    RenderScene compiled(job.scene);
+    result.buildMs = milliseconds(clock::now() - start);
+    result.structureBytes = compiled.structureMemory();
+    for (const auto& mesh: library.loaded()){
+        result.triangles += mesh->triangleCount();
+        result.structureBytes += mesh->structureMemory();
+        result.geometryBytes += mesh->geometryMemory();
+    }
+
+    Renderer renderer(compiled, job.settings, pool);
+    Framebuffer image(job.settings.width, job.settings.height);
+    std::vector<double> times;
+    for (int frame = 0; frame < frames; frame++){
+        encoder.open(job.output, job.settings.width, job.settings.height);
+        auto begin = clock::now();
+        renderer.render(image, encoder);
+        times.push_back(milliseconds(clock::now() - begin));
+        // the encoder runs behind the render, waiting here keeps it out of the next frame
+        if (!encoder.finish()){
+            std::cerr << "Could not write " << job.output << std::endl;
+            return false;
+        }
+    }
+    std::sort(times.begin(), times.end());
+    result.frameMs = times[times.size() / 2];
+    result.rays = renderer.rays();
+    return true;
+}
+
+
+// one scene per line, so the baseline can be read back a line at a time
+bool writeJson(const std::string& path, const std::vector<SceneResult>& results, unsigned threads, int frames){
+    std::ofstream file(path);
+    if (!file) return false;
+    file << std::fixed << std::setprecision(3);
+    file << "{\n  \"threads\": " << threads << ",\n  \"frames\": " << frames << ",\n  \"scenes\": [\n";
+    for (size_t i = 0; i < results.size(); i++){
+        const SceneResult& r = results[i];
+        file << "    {\"name\": \"" << r.name << "\", \"file\": \"" << r.file << "\""
+             << ", \"width\": " << r.width << ", \"height\": " << r.height << ", \"spp\": " << r.spp
+             << ", \"triangles\": " << r.triangles
+             << ", \"build_ms\": " << r.buildMs
+             << ", \"structure_bytes\": " << r.structureBytes
+             << ", \"geometry_bytes\": " << r.geometryBytes
+             << ", \"frame_ms\": " << r.frameMs
+             << ", \"primary_rays\": " << r.rays.primary
+             << ", \"shadow_rays\": " << r.rays.shadow
+             << ", \"secondary_rays\": " << r.rays.secondary
+             << ", \"primary_rays_per_s\": " << r.perSecond(r.rays.primary)
+             << ", \"shadow_rays_per_s\": " << r.perSecond(r.rays.shadow)
+             << ", \"secondary_rays_per_s\": " << r.perSecond(r.rays.secondary)
+             << ", \"rays_per_s\": " << r.perSecond(r.rays.total())
+             << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    return file.good();
+}
+
+// value of "key": in a line written by writeJson
+bool jsonField(const std::string& line, const std::string& key, std::string& value){
+    std::string pattern = "\"" + key + "\": ";
+    size_t start = line.find(pattern);
+    if (start == std::string::npos) return false;
+    start += pattern.size();
+    if (line[start] == '"'){
+        size_t end = line.find('"', start + 1);
+        value = line.substr(start + 1, end - start - 1);
+    }
+    else{
+        value = line.substr(start, line.find_first_of(",}", start) - start);
+    }
+    return true;
+}
+
+// the build_ms, structure_bytes and frame_ms of every scene in a baseline, by name
+bool readBaseline(const std::string& path, std::map<std::string, std::map<std::string, double>>& baseline){
+    std::ifstream file(path);
+    if (!file) return false;
+    std::string line;
+    while (std::getline(file, line)){
+        std::string name;
+        if (!jsonField(line, "name", name)) continue;
+        for (const char* key: {"build_ms", "structure_bytes", "frame_ms"}){
+            std::string value;
+            if (jsonField(line, key, value)){
+                baseline[name][key] = std::stod(value);
+            }
+        }
+    }
+    return true;
+}
+
+// prints how every scene compares with the baseline, returns the number of regressions
+int compare(const std::vector<SceneResult>& results, const std::map<std::string, std::map<std::string, double>>& baseline, double tolerance){
+    int regressions = 0;
+    for (const SceneResult& r: results){
+        auto found = baseline.find(r.name);
+        if (found == baseline.end()){
+            std::cout << r.name << ": not in the baseline" << std::endl;
+            continue;
+        }
+        // times get a millisecond on top of the tolerance, short builds are mostly timer noise
+        const std::pair<const char*, double> values[] = {{"build_ms", r.buildMs}, {"structure_bytes", (double) r.structureBytes}, {"frame_ms", r.frameMs}};
+        for (const auto& value: values){
+            auto old = found->second.find(value.first);
+            if (old == found->second.end() || old->second <= 0) continue;
+            bool bytes = value.first == std::string("structure_bytes");
+            double slack = bytes ? 0 : 1;
+            double change = value.second / old->second - 1;
+            bool regressed = value.second > old->second * (1 + tolerance) + slack;
+            regressions += regressed;
+            std::cout << std::fixed << std::setprecision(bytes ? 0 : 1) << r.name << " " << value.first << ": " << old->second << " -> " << value.second
+                      << std::setprecision(1) << " (" << std::showpos << change * 100 << "%" << std::noshowpos << ")"
+                      << (regressed ? "  REGRESSION" : "") << std::endl;
+            std::cout << std::defaultfloat << std::setprecision(6);
+        }
+    }
+    return regressions;
+}
+
+
+int main(int argc, char** argv){
+    unsigned threads = 0;
+    int frames = 3;
+    double tolerance = 0.15;
+    std::string json;
+    std::string baselinePath;
+    std::vector<std::string> scenes;
+    std::vector<std::string> overrides;
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0){
+            scenes.push_back(arg);
+            continue;
+        }
+        std::string keyword = arg.substr(2);
+        bool hasValue = i + 1 < argc;
+        if (keyword == "threads" && hasValue) threads = std::stoi(argv[++i]);
+        else if (keyword == "frames" && hasValue) frames = std::max(std::stoi(argv[++i]), 1);
+        else if (keyword == "json" && hasValue) json = argv[++i];
+        else if (keyword == "baseline" && hasValue) baselinePath = argv[++i];
+        else if (keyword == "tolerance" && hasValue) tolerance = std::stod(argv[++i]);
+        else{
+            int count = SceneLoader::settingArguments(keyword);
+            if (count < 0 || i + count >= argc){
+                std::cerr << "Unknown option or missing values: " << arg << std::endl;
+                return 1;
+            }
+            std::string line = keyword;
+            for (int j = 0; j < count; j++){
+                line += " " + std::string(argv[++i]);
+            }
+            overrides.push_back(line);
+        }
+    }
+    if (scenes.empty()){
+        scenes.assign(std::begin(STANDARD_SCENES), std::end(STANDARD_SCENES));
+    }
+    std::map<std::string, std::map<std::string, double>> baseline;
+    if (!baselinePath.empty() && !readBaseline(baselinePath, baseline)){
+        std::cerr << "Could not read baseline " << baselinePath << std::endl;
+        return 1;
+    }
+
+    ThreadPool pool(threads);
+    ImageEncoder encoder(2, pool.size());
+    std::vector<SceneResult> results;
+    for (const std::string& path: scenes){
+        SceneResult result;
+        std::cout << "Benchmarking " << path << std::endl;
+        if (!benchmarkScene(path, overrides, frames, pool, encoder, result)){
+            std::cerr << "Benchmark of " << path << " failed" << std::endl;
+            return 1;
+        }
+        results.push_back(result);
+    }
+
+    std::cout << std::endl << pool.size() << " threads, median of " << frames << " frames" << std::endl;
+    std::cout << std::left << std::setw(16) << "scene" << std::right << std::setw(10) << "triangles" << std::setw(10) << "build ms"
+              << std::setw(10) << "accel MB" << std::setw(10) << "frame ms" << std::setw(12) << "primary/s" << std::setw(12) << "shadow/s"
+              << std::setw(12) << "secondary/s" << std::endl;
+    std::cout << std::fixed;
+    for (const SceneResult& r: results){
+        std::cout << std::left << std::setw(16) << r.name << std::right << std::setw(10) << r.triangles
+                  << std::setprecision(1) << std::setw(10) << r.buildMs << std::setprecision(2) << std::setw(10) << r.structureBytes / 1048576.0
+                  << std::setprecision(1) << std::setw(10) << r.frameMs
+                  << std::setprecision(2) << std::setw(11) << r.perSecond(r.rays.primary) / 1e6 << "M"
+                  << std::setw(11) << r.perSecond(r.rays.shadow) / 1e6 << "M"
+                  << std::setw(11) << r.perSecond(r.rays.secondary) / 1e6 << "M" << std::endl;
+    }
+    std::cout << std::defaultfloat << std::setprecision(6);
+    stats::report(std::cout);
+
+    if (!json.empty() && !writeJson(json, results, pool.size(), frames)){
+        std::cerr << "Could not write " << json << std::endl;
+        return 1;
+    }
+    if (!baseline.empty()){
+        std::cout << std::endl;
+        int regressions = compare(results, baseline, tolerance);
+        if (regressions > 0){
+            std::cout << regressions << " regressions beyond " << tolerance * 100 << "%" << std::endl;
+            return 1;
+        }
+        std::cout << "No regressions beyond " << tolerance * 100 << "%" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+// microbenchmark for the packet triangle intersection kernels
+// reports triangle tests per second for every kernel the CPU supports
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include "../src/trianglepacket.h"
+
+
+int main(){
+    const int PACKETS = 4096;
+    const int RAYS = 2048;
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> size(-0.2f, 0.2f);
+
+    // small triangles scattered in a unit cube so a fair share of the tests hit
+    std::vector<TrianglePacket> packets(PACKETS);
+    for (int i = 0; i < PACKETS; i++){
+        for (int lane = 0; lane < PACKET_WIDTH; lane++){
+            Vec3 v0 = Vec3(position(rng), position(rng), position(rng));
+            Vec3 v1 = v0 + Vec3(size(rng), size(rng), size(rng));
+            Vec3 v2 = v0 + Vec3(size(rng), size(rng), size(rng));
+            packets[i].set(lane, i * PACKET_WIDTH + lane, v0, v1, v2);
+        }
+    }
+    std::vector<Ray> rays;
+    for (int i = 0; i < RAYS; i++){
+        Vec3 origin = Vec3(position(rng), position(rng), 3);
+        Vec3 target = Vec3(position(rng), position(rng), 0);
+        rays.push_back(Ray(origin, (target - origin).normalise()));
+    }
+
+    PacketKernel kernels[3];
+    int count = availablePacketKernels(kernels);
+    uint64_t reference = 0;
+    for (int k = 0; k < count; k++){
+        uint64_t checksum = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const Ray& ray: rays){
+            TriangleHit hit;
+            for (const TrianglePacket& packet: packets){
+                kernels[k](ray, packet, hit);
+            }
+            checksum = checksum * 31 + hit.face;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration<double>(end - start).count();
+        double tests = (double) RAYS * PACKETS * PACKET_WIDTH;
+        if (k == 0){
+            reference = checksum;
+        }
+        std::cout << packetKernelName(kernels[k]) << ": " << tests / seconds / 1e6 << " M triangle tests/s"
+                  << (checksum == reference ? "" : " (closest hits differ from scalar)") << std::endl;
+    }
+}
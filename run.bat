@@ -1,4 +1,4 @@
 @echo off
-g++ -o main.exe src/main.cpp
-IF EXIST main.exe main.exe
-py compression/comp.py images/result.qoi
+cmake -S . -B build -G "MinGW Makefiles" -DCMAKE_BUILD_TYPE=Release
+cmake --build build
+IF EXIST build\renderer.exe build\renderer.exe scenes/cornell.scene
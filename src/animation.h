@@ -0,0 +1,174 @@
+#pragma once
+
+#include "instance.h"
+#include "trianglemesh.h"
+#include "threadpool.h"
+#include "matrix.h"
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <cmath>
+
+
+// an instance whose pose changes by a fixed step every frame
+struct InstanceMotion{
+    std::shared_ptr<Instance> instance;
+    // the instance turns about pivot, in the object's space
+    Vec3 pivot = Vec3(0);
+    // pose at frame 0, rotation as pitch, roll and yaw in radians
+    Vec3 rotation = Vec3(0);
+    Vec3 translation = Vec3(0);
+    float scale = 1;
+    // added every frame
+    Vec3 spin = Vec3(0);
+    Vec3 move = Vec3(0);
+
+    Mat4 at(int frame) const{
+        return Mat4::translation(translation + move * frame + pivot) * Mat4::rotation(rotation + spin * frame)
+            * Mat4::scaling(Vec3(scale)) * Mat4::translation(-pivot);
+    }
+};
+
+
+/*
+   a mesh whose vertices ripple along their normals, a wave running from its bottom to its top
+   every period frames, the mesh's BVH is refit to the moved vertices every frame
+*/
+class MeshWobble{
+    public:
+        MeshWobble(std::shared_ptr<TriangleMesh> mesh_, float amplitude_, float period_){
+            mesh = mesh_;
+            amplitude = amplitude_;
+            period = period_;
+            rest = mesh->vertices;
+            restNormals = mesh->normals;
+            Vec3 min, max;
+            mesh->bounds(min, max);
+            bottom = min.y;
+            height = std::max(max.y - min.y, 1e-6f);
+        }
+
+        // moves the vertices to their place in frame, returns true if the BVH had to be built again
+        bool apply(int frame, ThreadPool* pool, float refitLimit) const{
+            std::vector<Vec3>& vertices = mesh->vertices;
+            uint32_t count = rest.size();
+            uint32_t chunks = (count + CHUNK - 1) / CHUNK;
+            float phase = frame / period;
+            auto moveChunk = [&](uint32_t chunk, unsigned){
+                uint32_t last = std::min((chunk + 1) * CHUNK, count);
+                for (uint32_t i = chunk * CHUNK; i < last; i++){
+                    float wave = std::sin(2 * (float) M_PI * (phase - (rest[i].y - bottom) / height));
+                    vertices[i] = rest[i] + restNormals[i] * (amplitude * wave);
+                }
+            };
+            if (pool && pool->size() > 1 && chunks > 1){
+                pool->parallelFor(chunks, moveChunk);
+            }
+            else{
+                for (uint32_t chunk = 0; chunk < chunks; chunk++){
+                    moveChunk(chunk, 0);
+                }
+            }
+            mesh->recalcNormals();
+            return mesh->refit(pool, refitLimit);
+        }
+
+    private:
+        static constexpr uint32_t CHUNK = 16384;
+
+        std::shared_ptr<TriangleMesh> mesh;
+        std::vector<Vec3> rest;
+        std::vector<Vec3> restNormals;
+        float amplitude;
+        float period;
+        float bottom;
+        float height;
+};
+
+
+// where the camera is at one frame of an animation, fov in radians as in RenderSettings
+struct CameraKey{
+    int frame;
+    Vec3 position;
+    Vec3 target;
+    float fov;
+};
+
+
+/*
+   what changes from frame to frame of an animated scene
+   objects that move as a whole are instances whose matrix is set per frame, their geometry and its
+   BVH are never touched, deforming meshes have their vertices moved and their BVH refit
+   every instance of a scene is listed, so instances of a deforming mesh pick up its new bounds
+   the camera follows a Catmull-Rom spline through its keys, sorted by frame, and holds still before
+   the first key and after the last
+*/
+struct Animation{
+    int frames = 1;
+    // how much worse than a fresh build a refit BVH may get before it is built again
+    float refitLimit = TriangleMesh::REFIT_LIMIT;
+    std::vector<InstanceMotion> motions;
+    std::vector<MeshWobble> wobbles;
+    std::vector<CameraKey> cameraKeys;
+
+    bool animated() const{
+        return frames > 1;
+    }
+
+    // poses every object for frame, returns the number of acceleration structures built again
+    int setFrame(int frame, ThreadPool* pool) const{
+        int rebuilt = 0;
+        for (const MeshWobble& wobble: wobbles){
+            rebuilt += wobble.apply(frame, pool, refitLimit);
+        }
+        for (const InstanceMotion& motion: motions){
+            motion.instance->setTransform(motion.at(frame));
+        }
+        return rebuilt;
+    }
+
+    // camera of frame, false if the camera has no keys and stays where the scene put it
+    bool camera(int frame, CameraKey& at) const{
+        if (cameraKeys.empty()) return false;
+        size_t next = 0;
+        while (next < cameraKeys.size() && cameraKeys[next].frame <= frame){
+            next++;
+        }
+        if (next == 0 || next == cameraKeys.size()){
+            at = cameraKeys[next == 0 ? 0 : next - 1];
+            at.frame = frame;
+            return true;
+        }
+        // p1 to p2 is the span frame is in, p0 and p3 shape the curve and repeat the ends at the ends
+        const CameraKey& p0 = cameraKeys[next > 1 ? next - 2 : next - 1];
+        const CameraKey& p1 = cameraKeys[next - 1];
+        const CameraKey& p2 = cameraKeys[next];
+        const CameraKey& p3 = cameraKeys[next + 1 < cameraKeys.size() ? next + 1 : next];
+        float t = (frame - p1.frame) / (float) (p2.frame - p1.frame);
+        at.frame = frame;
+        at.position = catmullRom(p0.position, p1.position, p2.position, p3.position, t);
+        at.target = catmullRom(p0.target, p1.target, p2.target, p3.target, t);
+        at.fov = p1.fov + (p2.fov - p1.fov) * t;
+        return true;
+    }
+
+    static Vec3 catmullRom(const Vec3& p0, const Vec3& p1, const Vec3& p2, const Vec3& p3, float t){
+        float t2 = t * t;
+        float t3 = t2 * t;
+        return (p1 * 2 + (p2 - p0) * t + (p0 * 2 - p1 * 5 + p2 * 4 - p3) * t2 + (p1 * 3 - p0 - p2 * 3 + p3) * t3) * 0.5f;
+    }
+};
+
+
+// output of one frame of an animation, images/name.png becomes images/name_0007.png
+inline std::string frameOutput(const std::string& output, int frame){
+    char number[16];
+    std::snprintf(number, sizeof(number), "_%04d", frame);
+    size_t dot = output.find_last_of('.');
+    size_t slash = output.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)){
+        return output + number;
+    }
+    return output.substr(0, dot) + number + output.substr(dot);
+}
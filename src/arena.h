@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+
+/*
+   bump allocator for scratch memory that lives no longer than a round of work, like a tile
+   allocations are carved from large blocks and never freed one by one, reset frees them all at once
+   a reset after a round that needed several blocks swaps them for one block as big as all of them,
+   so once the largest round has been seen the arena hands out memory without calling malloc again
+   every thread has an arena of its own (local), so no allocation takes a lock, reserve lets a thread
+   take on a round as large as one another thread has seen
+*/
+class Arena{
+    public:
+        static constexpr size_t BLOCK_SIZE = 64 << 10;
+
+        Arena(){
+        }
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        // count uninitialised objects, only for types without destructors, they are never run
+        template<typename T>
+        T* allocate(size_t count){
+            static_assert(std::is_trivially_destructible<T>::value, "arena memory is released without running destructors");
+            size_t bytes = count * sizeof(T);
+            size_t offset = (used + alignof(T) - 1) & ~(alignof(T) - 1);
+            if (blocks.empty() || offset + bytes > blocks.back().size){
+                addBlock(bytes + alignof(T));
+                offset = (used + alignof(T) - 1) & ~(alignof(T) - 1);
+            }
+            used = offset + bytes;
+            return reinterpret_cast<T*>(blocks.back().data.get() + offset);
+        }
+
+        // releases everything allocated since the last reset
+        void reset(){
+            if (blocks.size() > 1){
+                size_t total = 0;
+                for (const Block& block: blocks){
+                    total += block.size;
+                }
+                blocks.clear();
+                addBlock(total);
+            }
+            used = 0;
+        }
+
+        // releases everything like reset and makes sure one block holds at least bytes
+        void reserve(size_t bytes){
+            reset();
+            if (capacity() < bytes){
+                blocks.clear();
+                addBlock(bytes);
+            }
+        }
+
+        // bytes held in blocks
+        size_t capacity() const{
+            size_t total = 0;
+            for (const Block& block: blocks){
+                total += block.size;
+            }
+            return total;
+        }
+
+        // the arena of the calling thread
+        static Arena& local(){
+            thread_local Arena arena;
+            return arena;
+        }
+
+    private:
+        struct Block{
+            std::unique_ptr<uint8_t[]> data;
+            size_t size;
+        };
+
+        void addBlock(size_t bytes){
+            size_t size = std::max(bytes, BLOCK_SIZE);
+            blocks.push_back(Block{std::unique_ptr<uint8_t[]>(new uint8_t[size]), size});
+            used = 0;
+        }
+
+        std::vector<Block> blocks;
+        // bytes taken from the last block
+        size_t used = 0;
+};
+
+
+/*
+   growable array in an arena, for scratch whose size is only known once it is filled
+   growing copies the elements into a block twice the size and leaves the old one to the next reset
+*/
+template<typename T>
+class ScratchArray{
+    static_assert(std::is_trivially_copyable<T>::value, "elements are moved with memcpy");
+
+    public:
+        ScratchArray(){
+        }
+
+        // starts empty in arena, whatever was held before belongs to the arena's last round
+        void start(Arena& arena_){
+            arena = &arena_;
+            items = nullptr;
+            count = 0;
+            capacity = 0;
+        }
+
+        void push_back(const T& item){
+            if (count == capacity){
+                size_t grown = std::max(capacity * 2, (size_t) 256);
+                T* larger = arena->allocate<T>(grown);
+                if (count > 0){
+                    std::memcpy(larger, items, count * sizeof(T));
+                }
+                items = larger;
+                capacity = grown;
+            }
+            items[count++] = item;
+        }
+
+        size_t size() const{
+            return count;
+        }
+
+        const T* begin() const{
+            return items;
+        }
+
+        const T* end() const{
+            return items + count;
+        }
+
+    private:
+        Arena* arena = nullptr;
+        T* items = nullptr;
+        size_t count = 0;
+        size_t capacity = 0;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+/*
+   output file with one large buffer in front of it
+   bytes are collected in memory and handed to the OS in big blocks,
+   the stdio buffer is switched off so every flush is a single write call
+*/
+class BufferedWriter{
+    public:
+        static constexpr size_t BUFFER_SIZE = 4 << 20;
+
+        BufferedWriter(){
+        }
+
+        ~BufferedWriter(){
+            close();
+        }
+
+        bool open(const std::string& filename){
+            close();
+            file = std::fopen(filename.c_str(), "wb");
+            if (!file) return false;
+            std::setvbuf(file, nullptr, _IONBF, 0);
+            buffer.resize(BUFFER_SIZE);
+            used = 0;
+            failed = false;
+            return true;
+        }
+
+        bool isOpen() const{
+            return file != nullptr;
+        }
+
+        // false once any write has failed
+        bool good() const{
+            return !failed;
+        }
+
+        void put(uint8_t byte){
+            if (used == buffer.size()) flush();
+            buffer[used++] = byte;
+        }
+
+        void write(const void* data, size_t size){
+            if (used + size > buffer.size()){
+                flush();
+                if (size >= buffer.size()){
+                    writeThrough(data, size);
+                    return;
+                }
+            }
+            memcpy(buffer.data() + used, data, size);
+            used += size;
+        }
+
+        // big endian 32 bit number
+        void write32(uint32_t value){
+            put(value >> 24);
+            put(value >> 16);
+            put(value >> 8);
+            put(value);
+        }
+
+        // continues writing at offset bytes from the start of the file
+        void seek(uint64_t offset){
+            flush();
+            if (file && std::fseek(file, offset, SEEK_SET) != 0){
+                failed = true;
+            }
+        }
+
+        void flush(){
+            writeThrough(buffer.data(), used);
+            used = 0;
+        }
+
+        bool close(){
+            if (!file) return !failed;
+            flush();
+            if (std::fclose(file) != 0){
+                failed = true;
+            }
+            file = nullptr;
+            buffer = std::vector<uint8_t>();
+            return !failed;
+        }
+
+    private:
+        void writeThrough(const void* data, size_t size){
+            if (size == 0 || !file) return;
+            if (std::fwrite(data, 1, size, file) != size){
+                failed = true;
+            }
+        }
+
+    private:
+        FILE* file = nullptr;
+        std::vector<uint8_t> buffer;
+        size_t used = 0;
+        bool failed = false;
+};
@@ -0,0 +1,740 @@
+#pragma once
+
+#include "ray.h"
+#include "observables.h"
+#include "trianglepacket.h"
+#include "raypacket.h"
+#include "stats.h"
+#include "threadpool.h"
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+
+/*
+   nodes are stored depth first in a single array
+   an interior node's left child directly follows it, leftFirst holds the right child
+   a leaf node's leftFirst is the first entry in triIndices, count the number of triangles
+   when the BVH is built with packets every leaf starts on a multiple of PACKET_WIDTH in triIndices,
+   padding slots hold PACKET_EMPTY, and packets[leftFirst / PACKET_WIDTH] is the leaf's first packet
+*/
+struct BVHNode{
+    Vec3 min;
+    uint32_t leftFirst;
+    Vec3 max;
+    uint32_t count;
+
+    bool isLeaf() const{
+        return count > 0;
+    }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode should be 32 bytes");
+
+
+class BVH{
+    public:
+        BVH(){
+        }
+
+        BVH(const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, bool usePackets = true, ThreadPool* pool = nullptr){
+            build(vertices, indices, usePackets, pool);
+        }
+
+        // usePackets stores the leaf triangles in SIMD packets as a vertex and two edges,
+        // costing 40 bytes per triangle slot but testing a whole leaf in one go
+        // with a thread pool the subtrees below the top levels are built in parallel, giving the same tree
+        void build(const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, bool usePackets = true, ThreadPool* pool = nullptr){
+            uint32_t count = indices.size() / 3;
+            triMin.resize(count);
+            triMax.resize(count);
+            for (uint32_t i = 0; i < count; i++){
+                Vec3 v0 = vertices[indices[i * 3]];
+                Vec3 v1 = vertices[indices[i * 3 + 1]];
+                Vec3 v2 = vertices[indices[i * 3 + 2]];
+                triMin[i] = v0.min(v1.min(v2));
+                triMax[i] = v0.max(v1.max(v2));
+            }
+            packetCost = usePackets;
+            subdivideAll(pool);
+
+            packets.clear();
+            if (usePackets){
+                buildPackets(vertices, indices);
+            }
+            builtCost = cost();
+        }
+
+        /*
+           fits the boxes to vertices that moved since the build, the tree keeps its shape and the
+           triangles stay in their leaves, so it is a fraction of the cost of a build but the tree gets
+           worse the further the mesh moves from the pose it was built for
+           leaves and their packets are refit on the pool, then the interior nodes bottom up,
+           returns the SAH cost of the refit tree over the cost it had when built, 1 is as good as then
+        */
+        float refit(const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, ThreadPool* pool = nullptr){
+            if (nodes.empty()) return 1;
+            // a tree read from the mesh cache has not been costed yet
+            packetCost = !packets.empty();
+            if (builtCost <= 0){
+                builtCost = cost();
+            }
+            std::vector<uint32_t> leaves;
+            for (uint32_t i = 0; i < nodes.size(); i++){
+                if (nodes[i].isLeaf()) leaves.push_back(i);
+            }
+            uint32_t chunks = (leaves.size() + REFIT_CHUNK - 1) / REFIT_CHUNK;
+            auto refitLeaves = [&](uint32_t chunk, unsigned){
+                uint32_t last = std::min((chunk + 1) * REFIT_CHUNK, (uint32_t) leaves.size());
+                for (uint32_t k = chunk * REFIT_CHUNK; k < last; k++){
+                    refitLeaf(nodes[leaves[k]], vertices, indices);
+                }
+            };
+            if (pool && pool->size() > 1 && chunks > 1){
+                pool->parallelFor(chunks, refitLeaves);
+            }
+            else{
+                for (uint32_t chunk = 0; chunk < chunks; chunk++){
+                    refitLeaves(chunk, 0);
+                }
+            }
+            // children always come after their parent
+            for (uint32_t i = nodes.size(); i-- > 0;){
+                BVHNode& node = nodes[i];
+                if (node.isLeaf()) continue;
+                const BVHNode& left = nodes[i + 1];
+                const BVHNode& right = nodes[node.leftFirst];
+                node.min = left.min.min(right.min);
+                node.max = left.max.max(right.max);
+            }
+            return builtCost > 0 ? cost() / builtCost : 1;
+        }
+
+        // expected cost of a ray through the tree by the surface area heuristic, in triangle tests
+        float cost() const{
+            if (nodes.empty()) return 0;
+            float total = 0;
+            for (const BVHNode& node: nodes){
+                total += area(node.min, node.max) * (node.isLeaf() ? leafCost(node.count) : TRAVERSAL_COST);
+            }
+            float root = area(nodes[0].min, nodes[0].max);
+            return root > 0 ? total / root : 0;
+        }
+
+        bool hasPackets() const{
+            return !packets.empty();
+        }
+
+        // builds over arbitrary boxes, such as the objects of a scene, triIndices then index the boxes
+        void build(const std::vector<Vec3>& mins, const std::vector<Vec3>& maxs){
+            triMin = mins;
+            triMax = maxs;
+            packetCost = false;
+            subdivideAll();
+            packets.clear();
+        }
+
+        bool empty() const{
+            return nodes.empty();
+        }
+
+        // bytes held by the nodes, the triangle order and the packets
+        size_t memory() const{
+            return nodes.capacity() * sizeof(BVHNode) + triIndices.capacity() * sizeof(uint32_t) + packets.capacity() * sizeof(TrianglePacket);
+        }
+
+        bool intersection(const Ray& ray, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, TriangleHit& hit) const{
+            if (nodes.empty()) return false;
+            return traverse(ray, 0, hit.timestep, [&](const BVHNode& leaf){
+                return intersectLeaf(ray, leaf, vertices, indices, hit);
+            });
+        }
+
+        // closest hits for a packet of rays, returns a bit mask of the rays whose hit was updated
+        uint32_t intersection(const RayPacket& packet, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, TriangleHit* hits) const{
+            if (nodes.empty()) return 0;
+            float tmax[RayPacket::SIZE];
+            for (int i = 0; i < RayPacket::SIZE; i++){
+                tmax[i] = hits[i].timestep;
+            }
+            return traverse(packet, tmax, [&](const Ray& ray, int i, const BVHNode& leaf){
+                bool found = intersectLeaf(ray, leaf, vertices, indices, hits[i]);
+                tmax[i] = hits[i].timestep;
+                return found;
+            });
+        }
+
+        // true as soon as any triangle is hit before tmax
+        bool occluded(const Ray& ray, float tmax, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices) const{
+            if (nodes.empty()) return false;
+            return traverseAny(ray, 0, tmax, [&](const BVHNode& leaf){
+                return occludedLeaf(ray, tmax, leaf, vertices, indices);
+            });
+        }
+
+        // bit mask of the rays hitting any triangle before their tmax, lanes with a negative tmax are skipped
+        uint32_t occluded(const RayPacket& packet, const float* tmax, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices) const{
+            if (nodes.empty()) return 0;
+            return traverseAny(packet, tmax, [&](const Ray& ray, int i, const BVHNode& leaf){
+                return occludedLeaf(ray, tmax[i], leaf, vertices, indices);
+            });
+        }
+
+        // single ray traversal of the subtree below start, front to back
+        // test(leaf) intersects the ray with the leaf's primitives and lowers tmax on a closer hit
+        template <typename LeafTest>
+        bool traverse(const Ray& ray, uint32_t start, float& tmax, LeafTest test) const{
+            if (AABBDistance(nodes[start].min, nodes[start].max, ray, tmax) == finf) return false;
+
+            bool found = false;
+            uint32_t stack[STACK_SIZE];
+            float stackDistance[STACK_SIZE];
+            int top = 0;
+            uint32_t index = start;
+            while (true){
+                const BVHNode& node = nodes[index];
+                STATS_COUNT(NodesVisited);
+                if (node.isLeaf()){
+                    found = test(node) || found;
+                }
+                else{
+                    // visit the nearer child first, the farther one is kept for later
+                    uint32_t closer = index + 1;
+                    uint32_t further = node.leftFirst;
+                    float dcloser = AABBDistance(nodes[closer].min, nodes[closer].max, ray, tmax);
+                    float dfurther = AABBDistance(nodes[further].min, nodes[further].max, ray, tmax);
+                    if (dfurther < dcloser){
+                        std::swap(closer, further);
+                        std::swap(dcloser, dfurther);
+                    }
+                    if (dcloser != finf){
+                        if (dfurther != finf){
+                            stackDistance[top] = dfurther;
+                            stack[top++] = further;
+                        }
+                        index = closer;
+                        continue;
+                    }
+                }
+                // pop until we find a node that is still closer than the current hit
+                bool next = false;
+                while (top > 0){
+                    top--;
+                    if (stackDistance[top] < tmax){
+                        index = stack[top];
+                        next = true;
+                        break;
+                    }
+                }
+                if (!next) break;
+            }
+            return found;
+        }
+
+        // packet traversal, the rays walk the tree together until fewer than PACKET_SPLIT of them
+        // are left in a subtree, those rays then finish the subtree on their own
+        // test(ray, lane, leaf) works as for a single ray and must keep tmax[lane] up to date
+        // returns a bit mask of the rays for which test found a hit
+        template <typename LeafTest>
+        uint32_t traverse(const RayPacket& packet, float* tmax, LeafTest test) const{
+            uint32_t found = 0;
+            uint32_t stack[STACK_SIZE];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0){
+                uint32_t index = stack[--top];
+                const BVHNode& node = nodes[index];
+                uint32_t active = packet.intersectBox(node.min, node.max, tmax);
+                if (active == 0) continue;
+                if (__builtin_popcount(active) < PACKET_SPLIT){
+                    // the single ray traversals count this node themselves
+                    for (uint32_t bits = active; bits; bits &= bits - 1){
+                        int i = __builtin_ctz(bits);
+                        const Ray& ray = packet.rays[i];
+                        if (traverse(ray, index, tmax[i], [&](const BVHNode& leaf){ return test(ray, i, leaf); })){
+                            found |= 1u << i;
+                        }
+                    }
+                    continue;
+                }
+                STATS_ADD(NodesVisited, __builtin_popcount(active));
+                if (node.isLeaf()){
+                    for (uint32_t bits = active; bits; bits &= bits - 1){
+                        int i = __builtin_ctz(bits);
+                        if (test(packet.rays[i], i, node)){
+                            found |= 1u << i;
+                        }
+                    }
+                    continue;
+                }
+                // order the children by the direction of the first active ray
+                const Ray& lead = packet.rays[__builtin_ctz(active)];
+                uint32_t closer = index + 1;
+                uint32_t further = node.leftFirst;
+                Vec3 offset = (nodes[further].min + nodes[further].max) - (nodes[closer].min + nodes[closer].max);
+                if (offset.dot(lead.direction) < 0){
+                    std::swap(closer, further);
+                }
+                stack[top++] = further;
+                stack[top++] = closer;
+            }
+            return found;
+        }
+
+        // any hit traversal of the subtree below start, returns as soon as test(leaf) reports a hit
+        // children are only ordered roughly along the ray, there is no closest hit to narrow the search
+        template <typename LeafTest>
+        bool traverseAny(const Ray& ray, uint32_t start, float tmax, LeafTest test) const{
+            uint32_t stack[STACK_SIZE];
+            int top = 0;
+            stack[top++] = start;
+            while (top > 0){
+                uint32_t index = stack[--top];
+                const BVHNode& node = nodes[index];
+                if (AABBDistance(node.min, node.max, ray, tmax) == finf) continue;
+                STATS_COUNT(NodesVisited);
+                if (node.isLeaf()){
+                    if (test(node)) return true;
+                    continue;
+                }
+                uint32_t closer = index + 1;
+                uint32_t further = node.leftFirst;
+                Vec3 offset = (nodes[further].min + nodes[further].max) - (nodes[closer].min + nodes[closer].max);
+                if (offset.dot(ray.direction) < 0){
+                    std::swap(closer, further);
+                }
+                stack[top++] = further;
+                stack[top++] = closer;
+            }
+            return false;
+        }
+
+        // any hit packet traversal, rays leave the packet as soon as they are occluded
+        // returns a bit mask of the rays for which test(ray, lane, leaf) reported a hit
+        template <typename LeafTest>
+        uint32_t traverseAny(const RayPacket& packet, const float* tmax, LeafTest test) const{
+            // occluded lanes get a negative tmax so no box test lets them through again
+            float limit[RayPacket::SIZE];
+            for (int i = 0; i < RayPacket::SIZE; i++){
+                limit[i] = tmax[i];
+            }
+            uint32_t found = 0;
+            uint32_t stack[STACK_SIZE];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0){
+                uint32_t index = stack[--top];
+                const BVHNode& node = nodes[index];
+                uint32_t active = packet.intersectBox(node.min, node.max, limit);
+                if (active == 0) continue;
+                if (node.isLeaf()){
+                    STATS_ADD(NodesVisited, __builtin_popcount(active));
+                }
+                if (node.isLeaf() || __builtin_popcount(active) < PACKET_SPLIT){
+                    for (uint32_t bits = active; bits; bits &= bits - 1){
+                        int i = __builtin_ctz(bits);
+                        const Ray& ray = packet.rays[i];
+                        bool hit = node.isLeaf() ? test(ray, i, node) :
+                            traverseAny(ray, index, limit[i], [&](const BVHNode& leaf){ return test(ray, i, leaf); });
+                        if (hit){
+                            found |= 1u << i;
+                            limit[i] = -finf;
+                        }
+                    }
+                    continue;
+                }
+                STATS_ADD(NodesVisited, __builtin_popcount(active));
+                stack[top++] = node.leftFirst;
+                stack[top++] = index + 1;
+            }
+            return found;
+        }
+
+        // visits every leaf the packet reaches without ever splitting it up
+        // test(leaf, active) handles the whole packet at once and must keep tmax up to date
+        template <typename LeafTest>
+        void traverseLeaves(const RayPacket& packet, float* tmax, LeafTest test) const{
+            uint32_t stack[STACK_SIZE];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0){
+                uint32_t index = stack[--top];
+                const BVHNode& node = nodes[index];
+                uint32_t active = packet.intersectBox(node.min, node.max, tmax);
+                if (active == 0) continue;
+                STATS_ADD(NodesVisited, __builtin_popcount(active));
+                if (node.isLeaf()){
+                    test(node, active);
+                    continue;
+                }
+                const Ray& lead = packet.rays[__builtin_ctz(active)];
+                uint32_t closer = index + 1;
+                uint32_t further = node.leftFirst;
+                Vec3 offset = (nodes[further].min + nodes[further].max) - (nodes[closer].min + nodes[closer].max);
+                if (offset.dot(lead.direction) < 0){
+                    std::swap(closer, further);
+                }
+                stack[top++] = further;
+                stack[top++] = closer;
+            }
+        }
+
+    private:
+        bool intersectLeaf(const Ray& ray, const BVHNode& leaf, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, TriangleHit& hit) const{
+            bool found = false;
+            if (!packets.empty()){
+                PacketKernel kernel = packetKernel();
+                uint32_t first = leaf.leftFirst / PACKET_WIDTH;
+                uint32_t last = (leaf.leftFirst + leaf.count + PACKET_WIDTH - 1) / PACKET_WIDTH;
+                STATS_ADD(TrianglesTested, (last - first) * PACKET_WIDTH);
+                for (uint32_t i = first; i < last; i++){
+                    found = kernel(ray, packets[i], hit) || found;
+                }
+                return found;
+            }
+            STATS_ADD(TrianglesTested, leaf.count);
+            for (uint32_t i = leaf.leftFirst; i < leaf.leftFirst + leaf.count; i++){
+                const uint32_t* tri = &indices[triIndices[i] * 3];
+                float t, u, v;
+                bool backface;
+                if (rayTriangleIntersection(ray, vertices[tri[0]], vertices[tri[1]], vertices[tri[2]], t, u, v, backface)){
+                    if (t > EPSILLON && t < hit.timestep){
+                        hit.timestep = t;
+                        hit.u = u;
+                        hit.v = v;
+                        hit.face = triIndices[i];
+                        hit.backface = backface;
+                        found = true;
+                    }
+                }
+            }
+            return found;
+        }
+
+        bool occludedLeaf(const Ray& ray, float tmax, const BVHNode& leaf, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices) const{
+            if (!packets.empty()){
+                PacketKernel kernel = packetKernel();
+                uint32_t first = leaf.leftFirst / PACKET_WIDTH;
+                uint32_t last = (leaf.leftFirst + leaf.count + PACKET_WIDTH - 1) / PACKET_WIDTH;
+                for (uint32_t i = first; i < last; i++){
+                    TriangleHit hit;
+                    hit.timestep = tmax;
+                    STATS_ADD(TrianglesTested, PACKET_WIDTH);
+                    if (kernel(ray, packets[i], hit)) return true;
+                }
+                return false;
+            }
+            for (uint32_t i = leaf.leftFirst; i < leaf.leftFirst + leaf.count; i++){
+                const uint32_t* tri = &indices[triIndices[i] * 3];
+                float t, u, v;
+                bool backface;
+                STATS_COUNT(TrianglesTested);
+                if (rayTriangleIntersection(ray, vertices[tri[0]], vertices[tri[1]], vertices[tri[2]], t, u, v, backface)){
+                    if (t > EPSILLON && t < tmax) return true;
+                }
+            }
+            return false;
+        }
+
+        // fits a leaf's box to its triangles and rewrites its packets
+        void refitLeaf(BVHNode& leaf, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices){
+            Vec3 bmin = Vec3(finf);
+            Vec3 bmax = Vec3(-finf);
+            uint32_t slots = packets.empty() ? leaf.count : (leaf.count + PACKET_WIDTH - 1) / PACKET_WIDTH * PACKET_WIDTH;
+            for (uint32_t k = leaf.leftFirst; k < leaf.leftFirst + slots; k++){
+                uint32_t face = triIndices[k];
+                if (face == PACKET_EMPTY) continue;
+                const uint32_t* tri = &indices[face * 3];
+                const Vec3& v0 = vertices[tri[0]];
+                const Vec3& v1 = vertices[tri[1]];
+                const Vec3& v2 = vertices[tri[2]];
+                bmin = bmin.min(v0.min(v1.min(v2)));
+                bmax = bmax.max(v0.max(v1.max(v2)));
+                if (!packets.empty()){
+                    packets[k / PACKET_WIDTH].set(k % PACKET_WIDTH, face, v0, v1, v2);
+                }
+            }
+            leaf.min = bmin;
+            leaf.max = bmax;
+        }
+
+        void subdivideAll(ThreadPool* pool = nullptr){
+            uint32_t count = triMin.size();
+            nodes.clear();
+            triIndices.resize(count);
+            centroids.resize(count);
+            for (uint32_t i = 0; i < count; i++){
+                triIndices[i] = i;
+                centroids[i] = (triMin[i] + triMax[i]) * 0.5f;
+            }
+            if (count > 0 && pool && pool->size() > 1 && count >= PARALLEL_BUILD){
+                subdivideParallel(count, *pool);
+            }
+            else if (count > 0){
+                nodes.reserve(count * 2);
+                subdivide(nodes, 0, count, 0);
+            }
+            // only needed during the build
+            centroids = std::vector<Vec3>();
+            triMin = std::vector<Vec3>();
+            triMax = std::vector<Vec3>();
+        }
+
+        // cost of a traversal step relative to a triangle test
+        static constexpr float TRAVERSAL_COST = 1.0f;
+        static constexpr float INTERSECTION_COST = 1.0f;
+        static constexpr int BINS = 16;
+        static constexpr uint32_t MAX_LEAF_SIZE = 8;
+        static constexpr int STACK_SIZE = 128;
+        // below this depth every split halves its triangles, a full stack can then hold the
+        // deepest path of any tree of up to 2^32 triangles
+        static constexpr int MAX_DEPTH = 64;
+        static_assert(MAX_DEPTH + 32 < STACK_SIZE, "traversal stacks must hold the deepest tree a build can make");
+        // a ray packet splits into single rays once fewer than this many are active
+        static constexpr int PACKET_SPLIT = 4;
+        // fewer triangles are built on one thread
+        static constexpr uint32_t PARALLEL_BUILD = 16384;
+        // leaves per work item of refit
+        static constexpr uint32_t REFIT_CHUNK = 1024;
+
+        // a range of triangles built on its own by the pool, node is its stand in among the top nodes
+        struct Task{
+            uint32_t node;
+            uint32_t first;
+            uint32_t count;
+            int depth;
+            std::vector<BVHNode> nodes;
+        };
+
+        struct Bin{
+            Vec3 min = Vec3(finf);
+            Vec3 max = Vec3(-finf);
+            uint32_t count = 0;
+        };
+
+        float leafCost(uint32_t count) const{
+            // a packet costs the same to test however many of its lanes are used
+            if (packetCost){
+                return ((count + PACKET_WIDTH - 1) / PACKET_WIDTH) * INTERSECTION_COST * 2;
+            }
+            return count * INTERSECTION_COST;
+        }
+
+        void buildPackets(const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices){
+            // move every leaf to a packet aligned range of slots, padding the last packet
+            std::vector<uint32_t> slots;
+            slots.reserve(triIndices.size() + triIndices.size() / 2);
+            for (BVHNode& node: nodes){
+                if (!node.isLeaf()) continue;
+                uint32_t first = slots.size();
+                slots.insert(slots.end(), triIndices.begin() + node.leftFirst, triIndices.begin() + node.leftFirst + node.count);
+                while (slots.size() % PACKET_WIDTH != 0){
+                    slots.push_back(PACKET_EMPTY);
+                }
+                node.leftFirst = first;
+            }
+            triIndices = std::move(slots);
+            packets.resize(triIndices.size() / PACKET_WIDTH);
+            for (uint32_t i = 0; i < triIndices.size(); i++){
+                uint32_t face = triIndices[i];
+                if (face == PACKET_EMPTY) continue;
+                const uint32_t* tri = &indices[face * 3];
+                packets[i / PACKET_WIDTH].set(i % PACKET_WIDTH, face, vertices[tri[0]], vertices[tri[1]], vertices[tri[2]]);
+            }
+        }
+
+        static float area(const Vec3& min, const Vec3& max){
+            Vec3 e = max - min;
+            return e.x * e.y + e.y * e.z + e.z * e.x;
+        }
+
+        /*
+           the top of the tree is split on the calling thread, ranges of at most count / (threads * 8)
+           triangles are left as tasks and built by the pool into node arrays of their own,
+           then the pieces are copied into nodes depth first, which is the layout a serial build gives
+        */
+        void subdivideParallel(uint32_t count, ThreadPool& pool){
+            std::vector<BVHNode> top;
+            std::vector<Task> tasks;
+            uint32_t taskSize = std::max(count / (pool.size() * 8), (uint32_t) MAX_LEAF_SIZE);
+            subdivide(top, 0, count, 0, taskSize, &tasks);
+            pool.parallelFor(tasks.size(), [&](uint32_t i, unsigned){
+                tasks[i].nodes.reserve(tasks[i].count * 2);
+                subdivide(tasks[i].nodes, tasks[i].first, tasks[i].count, tasks[i].depth);
+            });
+            size_t total = top.size();
+            for (const Task& task: tasks){
+                total += task.nodes.size();
+            }
+            nodes.reserve(total);
+            std::vector<int> taskAt(top.size(), -1);
+            for (uint32_t i = 0; i < tasks.size(); i++){
+                taskAt[tasks[i].node] = i;
+            }
+            stitch(top, 0, tasks, taskAt);
+        }
+
+        // copies the subtree of top below index into nodes, returns where it starts
+        uint32_t stitch(const std::vector<BVHNode>& top, uint32_t index, std::vector<Task>& tasks, const std::vector<int>& taskAt){
+            uint32_t at = nodes.size();
+            if (taskAt[index] >= 0){
+                Task& task = tasks[taskAt[index]];
+                for (BVHNode node: task.nodes){
+                    if (!node.isLeaf()){
+                        node.leftFirst += at;
+                    }
+                    nodes.push_back(node);
+                }
+                task.nodes = std::vector<BVHNode>();
+                return at;
+            }
+            nodes.push_back(top[index]);
+            if (!top[index].isLeaf()){
+                stitch(top, index + 1, tasks, taskAt);
+                nodes[at].leftFirst = stitch(top, top[index].leftFirst, tasks, taskAt);
+            }
+            return at;
+        }
+
+        // builds the subtree over triIndices[first, first + count) at depth into out, returns its root
+        // with tasks set, ranges of at most taskSize triangles are not built but added to tasks
+        uint32_t subdivide(std::vector<BVHNode>& out, uint32_t first, uint32_t count, int depth, uint32_t taskSize = 0, std::vector<Task>* tasks = nullptr){
+            uint32_t index = out.size();
+            if (tasks && count <= taskSize){
+                // stands in for the task's subtree until it is stitched in
+                out.push_back(BVHNode());
+                tasks->push_back(Task{index, first, count, depth, {}});
+                return index;
+            }
+            out.push_back(BVHNode());
+            Vec3 bmin = Vec3(finf);
+            Vec3 bmax = Vec3(-finf);
+            Vec3 cmin = Vec3(finf);
+            Vec3 cmax = Vec3(-finf);
+            for (uint32_t i = first; i < first + count; i++){
+                uint32_t tri = triIndices[i];
+                bmin = bmin.min(triMin[tri]);
+                bmax = bmax.max(triMax[tri]);
+                cmin = cmin.min(centroids[tri]);
+                cmax = cmax.max(centroids[tri]);
+            }
+            out[index].min = bmin;
+            out[index].max = bmax;
+
+            // find the cheapest binned split along any axis
+            int bestAxis = -1;
+            int bestSplit = 0;
+            float bestCost = leafCost(count);
+            float parentArea = area(bmin, bmax);
+            for (int axis = 0; axis < 3 && count > 1 && depth < MAX_DEPTH; axis++){
+                float lo = axis == 0 ? cmin.x : axis == 1 ? cmin.y : cmin.z;
+                float hi = axis == 0 ? cmax.x : axis == 1 ? cmax.y : cmax.z;
+                if (hi <= lo) continue;
+                Bin bins[BINS];
+                float scale = BINS / (hi - lo);
+                for (uint32_t i = first; i < first + count; i++){
+                    uint32_t tri = triIndices[i];
+                    int b = binIndex(centroids[tri], axis, lo, scale);
+                    bins[b].count++;
+                    bins[b].min = bins[b].min.min(triMin[tri]);
+                    bins[b].max = bins[b].max.max(triMax[tri]);
+                }
+                // sweep from the right to get the cost of every split plane
+                float rightArea[BINS - 1];
+                uint32_t rightCount[BINS - 1];
+                Vec3 rmin = Vec3(finf);
+                Vec3 rmax = Vec3(-finf);
+                uint32_t rcount = 0;
+                for (int b = BINS - 1; b > 0; b--){
+                    rmin = rmin.min(bins[b].min);
+                    rmax = rmax.max(bins[b].max);
+                    rcount += bins[b].count;
+                    rightArea[b - 1] = rcount > 0 ? area(rmin, rmax) : 0;
+                    rightCount[b - 1] = rcount;
+                }
+                Vec3 lmin = Vec3(finf);
+                Vec3 lmax = Vec3(-finf);
+                uint32_t lcount = 0;
+                for (int b = 0; b < BINS - 1; b++){
+                    lmin = lmin.min(bins[b].min);
+                    lmax = lmax.max(bins[b].max);
+                    lcount += bins[b].count;
+                    if (lcount == 0 || rightCount[b] == 0) continue;
+                    float cost = TRAVERSAL_COST + (area(lmin, lmax) * leafCost(lcount) + rightArea[b] * leafCost(rightCount[b])) / parentArea;
+                    if (cost < bestCost){
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = b;
+                    }
+                }
+            }
+
+            uint32_t leftCount;
+            if (bestAxis == -1){
+                // SAH would rather keep a large leaf, or the tree got too deep for its splits
+                if (count <= MAX_LEAF_SIZE || !splitMedian(first, count, cmin, cmax)){
+                    out[index].leftFirst = first;
+                    out[index].count = count;
+                    return index;
+                }
+                leftCount = count / 2;
+            }
+            else{
+                // partition the triangle references around the chosen plane
+                float lo = bestAxis == 0 ? cmin.x : bestAxis == 1 ? cmin.y : cmin.z;
+                float hi = bestAxis == 0 ? cmax.x : bestAxis == 1 ? cmax.y : cmax.z;
+                float scale = BINS / (hi - lo);
+                uint32_t i = first;
+                uint32_t j = first + count;
+                while (i < j){
+                    if (binIndex(centroids[triIndices[i]], bestAxis, lo, scale) <= bestSplit){
+                        i++;
+                    }
+                    else{
+                        std::swap(triIndices[i], triIndices[--j]);
+                    }
+                }
+                leftCount = i - first;
+            }
+
+            out[index].count = 0;
+            subdivide(out, first, leftCount, depth + 1, taskSize, tasks);
+            out[index].leftFirst = subdivide(out, first + leftCount, count - leftCount, depth + 1, taskSize, tasks);
+            return index;
+        }
+
+        // puts the half of the range with the smaller centroids along the widest axis first,
+        // false if every centroid is the same and there is nothing to split along
+        bool splitMedian(uint32_t first, uint32_t count, const Vec3& cmin, const Vec3& cmax){
+            Vec3 e = cmax - cmin;
+            int axis = (e.x >= e.y && e.x >= e.z) ? 0 : (e.y >= e.z ? 1 : 2);
+            float width = axis == 0 ? e.x : axis == 1 ? e.y : e.z;
+            if (!(width > 0)) return false;
+            auto begin = triIndices.begin() + first;
+            std::nth_element(begin, begin + count / 2, begin + count, [&](uint32_t a, uint32_t b){
+                const Vec3& ca = centroids[a];
+                const Vec3& cb = centroids[b];
+                return axis == 0 ? ca.x < cb.x : axis == 1 ? ca.y < cb.y : ca.z < cb.z;
+            });
+            return true;
+        }
+
+        static int binIndex(const Vec3& centroid, int axis, float lo, float scale){
+            float c = axis == 0 ? centroid.x : axis == 1 ? centroid.y : centroid.z;
+            int b = (int)((c - lo) * scale);
+            return b < 0 ? 0 : (b >= BINS ? BINS - 1 : b);
+        }
+
+    public:
+        std::vector<BVHNode> nodes;
+        std::vector<uint32_t> triIndices;
+        std::vector<TrianglePacket> packets;
+
+    private:
+        bool packetCost = false;
+        // cost right after the last build, what refit compares with
+        float builtCost = 0;
+        std::vector<Vec3> centroids;
+        std::vector<Vec3> triMin;
+        std::vector<Vec3> triMax;
+};
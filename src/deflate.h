@@ -0,0 +1,447 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+
+/*
+   small deflate (RFC 1951) compressor with the zlib checksum and the CRC used by PNG
+   data is compressed in independent segments so separate threads can each take a segment,
+   every segment ends on a byte boundary and the segments are joined by plain concatenation
+   greedy LZ77 matching over hash chains, one dynamic Huffman block per 64k symbols
+*/
+namespace deflate{
+    const uint32_t ADLER_BASE = 65521;
+
+    inline uint32_t adler32(const uint8_t* data, size_t size, uint32_t adler = 1){
+        uint32_t a = adler & 0xffff;
+        uint32_t b = adler >> 16;
+        while (size > 0){
+            // 5552 bytes is the most that can be summed before b overflows
+            size_t n = std::min(size, (size_t) 5552);
+            size -= n;
+            for (size_t i = 0; i < n; i++){
+                a += data[i];
+                b += a;
+            }
+            data += n;
+            a %= ADLER_BASE;
+            b %= ADLER_BASE;
+        }
+        return a | (b << 16);
+    }
+
+    // checksum of two joined pieces of data from the checksums of each and the length of the second
+    inline uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, uint64_t size2){
+        uint32_t rem = size2 % ADLER_BASE;
+        uint32_t sum1 = adler1 & 0xffff;
+        uint32_t sum2 = (uint64_t) rem * sum1 % ADLER_BASE;
+        sum1 += (adler2 & 0xffff) + ADLER_BASE - 1;
+        sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+        if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+        if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+        if (sum2 >= ADLER_BASE * 2) sum2 -= ADLER_BASE * 2;
+        if (sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+        return sum1 | (sum2 << 16);
+    }
+
+    inline uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0){
+        static const struct Table{
+            uint32_t entries[256];
+            Table(){
+                for (uint32_t i = 0; i < 256; i++){
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; k++){
+                        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    }
+                    entries[i] = c;
+                }
+            }
+        } table;
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++){
+            crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+
+    // bits are packed starting at the least significant bit as deflate requires
+    class BitWriter{
+        public:
+            BitWriter(std::vector<uint8_t>& out_): out(out_){
+            }
+
+            void put(uint32_t bits, int count){
+                buffer |= (uint64_t) bits << used;
+                used += count;
+                while (used >= 8){
+                    out.push_back(buffer & 0xff);
+                    buffer >>= 8;
+                    used -= 8;
+                }
+            }
+
+            void align(){
+                if (used > 0){
+                    out.push_back(buffer & 0xff);
+                }
+                buffer = 0;
+                used = 0;
+            }
+
+        private:
+            std::vector<uint8_t>& out;
+            uint64_t buffer = 0;
+            int used = 0;
+    };
+
+
+    // length and distance code tables from RFC 1951 section 3.2.5
+    const uint16_t LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    const uint16_t DISTANCE_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    const uint8_t DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    // order the code length code lengths are stored in
+    const uint8_t CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    const int WINDOW_SIZE = 32768;
+    const int MIN_MATCH = 3;
+    const int MAX_MATCH = 258;
+    const int HASH_BITS = 15;
+    const int MAX_CHAIN = 32;
+    // a match this long is good enough to stop searching the chain
+    const int NICE_MATCH = 128;
+    const size_t BLOCK_SYMBOLS = 65536;
+
+
+    // an LZ77 symbol, distance 0 marks a literal stored in length
+    struct Symbol{
+        uint16_t length;
+        uint16_t distance;
+    };
+
+    inline int lengthCode(int length){
+        static const struct Table{
+            uint8_t codes[MAX_MATCH + 1];
+            Table(){
+                for (int length = MIN_MATCH, code = 0; length <= MAX_MATCH; length++){
+                    while (code < 28 && LENGTH_BASE[code + 1] <= length) code++;
+                    codes[length] = code;
+                }
+            }
+        } table;
+        return table.codes[length];
+    }
+
+    inline int distanceCode(int distance){
+        // distances up to 256 directly, larger ones by their distance divided by 128
+        static const struct Table{
+            uint8_t small[257];
+            uint8_t large[257];
+            Table(){
+                for (int d = 1, code = 0; d <= 256; d++){
+                    while (code < 29 && DISTANCE_BASE[code + 1] <= d) code++;
+                    small[d] = code;
+                }
+                for (int k = 2, code = 0; k <= 256; k++){
+                    int d = (k - 1) * 128 + 1;
+                    while (code < 29 && DISTANCE_BASE[code + 1] <= d) code++;
+                    large[k] = code;
+                }
+            }
+        } table;
+        return distance <= 256 ? table.small[distance] : table.large[(distance - 1) / 128 + 1];
+    }
+
+
+    // Huffman code lengths limited to maxLength bits, unused symbols get length 0
+    inline void codeLengths(const uint32_t* frequency, int count, int maxLength, uint8_t* lengths){
+        struct Node{
+            uint32_t weight;
+            int left, right;
+        };
+        std::vector<Node> nodes;
+        std::vector<int> heap;
+        auto heavier = [&](int a, int b){ return nodes[a].weight > nodes[b].weight; };
+        for (int i = 0; i < count; i++){
+            lengths[i] = 0;
+            if (frequency[i] > 0){
+                nodes.push_back({frequency[i], -1, i});
+                heap.push_back(nodes.size() - 1);
+            }
+        }
+        if (heap.empty()) return;
+        if (heap.size() == 1){
+            lengths[nodes[heap[0]].right] = 1;
+            return;
+        }
+        std::make_heap(heap.begin(), heap.end(), heavier);
+        while (heap.size() > 1){
+            std::pop_heap(heap.begin(), heap.end(), heavier);
+            int a = heap.back();
+            heap.pop_back();
+            std::pop_heap(heap.begin(), heap.end(), heavier);
+            int b = heap.back();
+            heap.pop_back();
+            nodes.push_back({nodes[a].weight + nodes[b].weight, a, b});
+            heap.push_back(nodes.size() - 1);
+            std::push_heap(heap.begin(), heap.end(), heavier);
+        }
+        // depth of every leaf, leaves keep the symbol in right and have no left child
+        std::vector<std::pair<int, int>> stack = {{heap[0], 0}};
+        while (!stack.empty()){
+            auto [node, depth] = stack.back();
+            stack.pop_back();
+            if (nodes[node].left < 0){
+                lengths[nodes[node].right] = std::min(depth, maxLength);
+                continue;
+            }
+            stack.push_back({nodes[node].left, depth + 1});
+            stack.push_back({nodes[node].right, depth + 1});
+        }
+        // clamping may have broken the prefix property, lengthen the rarest of the longest codes below the limit until it holds
+        uint64_t capacity = 1ull << maxLength;
+        uint64_t kraft = 0;
+        for (int i = 0; i < count; i++){
+            if (lengths[i] > 0) kraft += 1ull << (maxLength - lengths[i]);
+        }
+        while (kraft > capacity){
+            int best = -1;
+            for (int i = 0; i < count; i++){
+                if (lengths[i] == 0 || lengths[i] >= maxLength) continue;
+                if (best < 0 || lengths[i] > lengths[best] || (lengths[i] == lengths[best] && frequency[i] < frequency[best])){
+                    best = i;
+                }
+            }
+            kraft -= 1ull << (maxLength - lengths[best] - 1);
+            lengths[best]++;
+        }
+        // decoders reject incomplete codes, so shorten the most frequent of the longest codes to fill the gaps
+        while (kraft < capacity){
+            int best = -1;
+            for (int i = 0; i < count; i++){
+                if (lengths[i] <= 1 || kraft + (1ull << (maxLength - lengths[i])) > capacity) continue;
+                if (best < 0 || lengths[i] > lengths[best] || (lengths[i] == lengths[best] && frequency[i] > frequency[best])){
+                    best = i;
+                }
+            }
+            kraft += 1ull << (maxLength - lengths[best]);
+            lengths[best]--;
+        }
+    }
+
+    // canonical codes for the given lengths, bit reversed so they can be written least significant bit first
+    inline void canonicalCodes(const uint8_t* lengths, int count, uint16_t* codes){
+        int lengthCount[16] = {};
+        for (int i = 0; i < count; i++){
+            lengthCount[lengths[i]]++;
+        }
+        lengthCount[0] = 0;
+        int next[16] = {};
+        int code = 0;
+        for (int bits = 1; bits < 16; bits++){
+            code = (code + lengthCount[bits - 1]) << 1;
+            next[bits] = code;
+        }
+        for (int i = 0; i < count; i++){
+            int length = lengths[i];
+            if (length == 0) continue;
+            int value = next[length]++;
+            int reversed = 0;
+            for (int k = 0; k < length; k++){
+                reversed |= ((value >> k) & 1) << (length - 1 - k);
+            }
+            codes[i] = reversed;
+        }
+    }
+
+
+    inline void writeBlock(BitWriter& bits, const Symbol* symbols, size_t count, bool last){
+        uint32_t litFrequency[286] = {};
+        uint32_t distFrequency[30] = {};
+        for (size_t i = 0; i < count; i++){
+            if (symbols[i].distance == 0){
+                litFrequency[symbols[i].length]++;
+            }
+            else{
+                litFrequency[257 + lengthCode(symbols[i].length)]++;
+                distFrequency[distanceCode(symbols[i].distance)]++;
+            }
+        }
+        litFrequency[256] = 1;
+        // some decoders reject a block without any distance code
+        bool anyDistance = false;
+        for (uint32_t f: distFrequency) anyDistance = anyDistance || f > 0;
+        if (!anyDistance) distFrequency[0] = 1;
+
+        uint8_t lengths[286 + 30];
+        uint8_t* litLengths = lengths;
+        uint8_t* distLengths = lengths + 286;
+        codeLengths(litFrequency, 286, 15, litLengths);
+        codeLengths(distFrequency, 30, 15, distLengths);
+        int litCount = 286;
+        while (litCount > 257 && litLengths[litCount - 1] == 0) litCount--;
+        int distCount = 30;
+        while (distCount > 1 && distLengths[distCount - 1] == 0) distCount--;
+
+        // run length encode both code length tables as one sequence with codes 16, 17 and 18
+        uint8_t all[286 + 30];
+        memcpy(all, litLengths, litCount);
+        memcpy(all + litCount, distLengths, distCount);
+        int total = litCount + distCount;
+        std::vector<std::pair<uint8_t, uint8_t>> runs;
+        uint32_t clFrequency[19] = {};
+        for (int i = 0; i < total;){
+            int value = all[i];
+            int run = 1;
+            while (i + run < total && all[i + run] == value) run++;
+            int left = run;
+            if (value == 0){
+                while (left >= 11){
+                    int n = std::min(left, 138);
+                    runs.push_back({18, n - 11});
+                    left -= n;
+                }
+                if (left >= 3){
+                    runs.push_back({17, left - 3});
+                    left = 0;
+                }
+            }
+            else if (left >= 4){
+                runs.push_back({(uint8_t) value, 0});
+                left--;
+                while (left >= 3){
+                    int n = std::min(left, 6);
+                    runs.push_back({16, n - 3});
+                    left -= n;
+                }
+            }
+            while (left-- > 0){
+                runs.push_back({(uint8_t) value, 0});
+            }
+            i += run;
+        }
+        for (const auto& r: runs) clFrequency[r.first]++;
+        uint8_t clLengths[19];
+        uint16_t clCodes[19] = {};
+        codeLengths(clFrequency, 19, 7, clLengths);
+        canonicalCodes(clLengths, 19, clCodes);
+        int clCount = 19;
+        while (clCount > 4 && clLengths[CODE_LENGTH_ORDER[clCount - 1]] == 0) clCount--;
+
+        uint16_t litCodes[286] = {};
+        uint16_t distCodes[30] = {};
+        canonicalCodes(litLengths, 286, litCodes);
+        canonicalCodes(distLengths, 30, distCodes);
+
+        // block header, dynamic Huffman
+        bits.put(last ? 1 : 0, 1);
+        bits.put(2, 2);
+        bits.put(litCount - 257, 5);
+        bits.put(distCount - 1, 5);
+        bits.put(clCount - 4, 4);
+        for (int i = 0; i < clCount; i++){
+            bits.put(clLengths[CODE_LENGTH_ORDER[i]], 3);
+        }
+        for (const auto& r: runs){
+            bits.put(clCodes[r.first], clLengths[r.first]);
+            if (r.first == 16) bits.put(r.second, 2);
+            else if (r.first == 17) bits.put(r.second, 3);
+            else if (r.first == 18) bits.put(r.second, 7);
+        }
+
+        for (size_t i = 0; i < count; i++){
+            const Symbol& s = symbols[i];
+            if (s.distance == 0){
+                bits.put(litCodes[s.length], litLengths[s.length]);
+                continue;
+            }
+            int lc = lengthCode(s.length);
+            bits.put(litCodes[257 + lc], litLengths[257 + lc]);
+            bits.put(s.length - LENGTH_BASE[lc], LENGTH_EXTRA[lc]);
+            int dc = distanceCode(s.distance);
+            bits.put(distCodes[dc], distLengths[dc]);
+            bits.put(s.distance - DISTANCE_BASE[dc], DISTANCE_EXTRA[dc]);
+        }
+        bits.put(litCodes[256], litLengths[256]);
+    }
+
+
+    // compresses one segment and appends it to out, a segment that is not the last one
+    // ends in an empty stored block so the next segment starts on a byte boundary
+    inline void compressSegment(const uint8_t* data, size_t size, bool last, std::vector<uint8_t>& out){
+        std::vector<Symbol> symbols;
+        symbols.reserve(size / 2 + 16);
+        std::vector<int32_t> head(1 << HASH_BITS, -1);
+        std::vector<int32_t> previous(WINDOW_SIZE, -1);
+        auto hash = [&](size_t i){
+            uint32_t v = data[i] | data[i + 1] << 8 | data[i + 2] << 16;
+            return (v * 2654435761u) >> (32 - HASH_BITS);
+        };
+        auto insert = [&](size_t i){
+            uint32_t h = hash(i);
+            previous[i % WINDOW_SIZE] = head[h];
+            head[h] = i;
+        };
+
+        size_t i = 0;
+        while (i < size){
+            int bestLength = 0;
+            int bestDistance = 0;
+            if (i + MIN_MATCH <= size){
+                int32_t candidate = head[hash(i)];
+                int maxLength = std::min((size_t) MAX_MATCH, size - i);
+                for (int chain = 0; chain < MAX_CHAIN && candidate >= 0 && i - candidate <= (size_t) WINDOW_SIZE; chain++){
+                    const uint8_t* a = data + candidate;
+                    const uint8_t* b = data + i;
+                    if (a[bestLength] == b[bestLength]){
+                        int length = 0;
+                        while (length < maxLength && a[length] == b[length]) length++;
+                        if (length > bestLength){
+                            bestLength = length;
+                            bestDistance = i - candidate;
+                            if (length >= NICE_MATCH || length == maxLength) break;
+                        }
+                    }
+                    int32_t next = previous[candidate % WINDOW_SIZE];
+                    // the slot may already hold a newer position that wrapped around the window
+                    if (next >= candidate) break;
+                    candidate = next;
+                }
+            }
+            if (bestLength >= MIN_MATCH){
+                symbols.push_back({(uint16_t) bestLength, (uint16_t) bestDistance});
+                for (int k = 0; k < bestLength; k++, i++){
+                    if (i + MIN_MATCH <= size) insert(i);
+                }
+            }
+            else{
+                symbols.push_back({data[i], 0});
+                if (i + MIN_MATCH <= size) insert(i);
+                i++;
+            }
+        }
+
+        BitWriter bits(out);
+        size_t start = 0;
+        do{
+            size_t count = std::min(BLOCK_SYMBOLS, symbols.size() - start);
+            bool final = last && start + count == symbols.size();
+            writeBlock(bits, symbols.data() + start, count, final);
+            start += count;
+        } while (start < symbols.size());
+        if (!last){
+            // empty stored block, leaves the stream byte aligned
+            bits.put(0, 3);
+            bits.align();
+            out.push_back(0x00);
+            out.push_back(0x00);
+            out.push_back(0xff);
+            out.push_back(0xff);
+        }
+        bits.align();
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "rowencoder.h"
+#include <string>
+#include <vector>
+#include <cstring>
+
+
+// float to IEEE half precision, rounding to nearest
+inline uint16_t toHalf(float value){
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int exponent = ((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (((bits >> 23) & 0xff) == 0xff){
+        // infinity stays infinity, NaN stays NaN
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    }
+    if (exponent >= 31){
+        return sign | 0x7c00;
+    }
+    if (exponent <= 0){
+        if (exponent < -10) return sign;
+        // denormal, shift in the implicit one
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1) half++;
+        return sign | half;
+    }
+    uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+    // a carry out of the mantissa correctly moves on to the next exponent
+    if (mantissa & 0x1000) half++;
+    return half;
+}
+
+
+/*
+   uncompressed scanline OpenEXR with linear half float B, G and R channels, colours scaled to 0-1
+   every row is its own chunk, so the offset table is known before the first row arrives
+*/
+class EXREncoder: public RowEncoder{
+    public:
+        void begin(BufferedWriter& out, int width_, int height_){
+            width = width_;
+            std::string header;
+            auto bytes = [&](const void* data, size_t size){ header.append((const char*) data, size); };
+            auto int32 = [&](int32_t value){ bytes(&value, 4); };
+            auto attribute = [&](const char* name, const char* type, int32_t size){
+                header.append(name, strlen(name) + 1);
+                header.append(type, strlen(type) + 1);
+                int32(size);
+            };
+            const uint8_t magic[8] = {0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0};
+            bytes(magic, 8);
+
+            attribute("channels", "chlist", 3 * 18 + 1);
+            for (const char* name: {"B", "G", "R"}){
+                header.append(name, 2);
+                // half, not linear, reserved, x and y sampling
+                int32(1);
+                int32(0);
+                int32(1);
+                int32(1);
+            }
+            header.push_back(0);
+            attribute("compression", "compression", 1);
+            header.push_back(0);
+            int32_t window[4] = {0, 0, width_ - 1, height_ - 1};
+            attribute("dataWindow", "box2i", 16);
+            bytes(window, 16);
+            attribute("displayWindow", "box2i", 16);
+            bytes(window, 16);
+            attribute("lineOrder", "lineOrder", 1);
+            header.push_back(0);
+            float one = 1, zero[2] = {0, 0};
+            attribute("pixelAspectRatio", "float", 4);
+            bytes(&one, 4);
+            attribute("screenWindowCenter", "v2f", 8);
+            bytes(zero, 8);
+            attribute("screenWindowWidth", "float", 4);
+            bytes(&one, 4);
+            header.push_back(0);
+            out.write(header.data(), header.size());
+
+            // offset table, one entry per row
+            uint64_t lineSize = 8 + (uint64_t) width * 3 * 2;
+            uint64_t offset = header.size() + (uint64_t) height_ * 8;
+            for (int y = 0; y < height_; y++){
+                out.write(&offset, 8);
+                offset += lineSize;
+            }
+            line.resize((size_t) width * 3);
+        }
+
+        void rows(BufferedWriter& out, int y, const Vec3* pixels, size_t size){
+            for (size_t row = 0; row < size / width; row++){
+                const Vec3* p = pixels + row * width;
+                for (int x = 0; x < width; x++){
+                    line[x] = toHalf(p[x].z / 255.0f);
+                    line[width + x] = toHalf(p[x].y / 255.0f);
+                    line[2 * width + x] = toHalf(p[x].x / 255.0f);
+                }
+                int32_t chunk[2] = {(int32_t)(y + row), (int32_t)(line.size() * 2)};
+                out.write(chunk, 8);
+                out.write(line.data(), line.size() * 2);
+            }
+        }
+
+        void end(BufferedWriter&){
+        }
+
+    private:
+        int width = 0;
+        std::vector<uint16_t> line;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "vector.h"
+#include <vector>
+#include <algorithm>
+
+
+// image being rendered, one colour per pixel in the 0-255 range
+class Framebuffer{
+    public:
+        Framebuffer(){
+            width = 0;
+            height = 0;
+        }
+
+        Framebuffer(int width_, int height_){
+            width = width_;
+            height = height_;
+            pixels.resize((size_t)width * height);
+        }
+
+        Vec3& at(int x, int y){
+            return pixels[(size_t)y * width + x];
+        }
+
+        const Vec3& at(int x, int y) const{
+            return pixels[(size_t)y * width + x];
+        }
+
+    public:
+        int width;
+        int height;
+        std::vector<Vec3> pixels;
+};
+
+
+/*
+   filtered samples summed up at the output resolution, each pixel keeps the weighted sum of the
+   samples that reached it and the sum of their weights, so any number of samples per pixel
+   costs the same memory
+*/
+class Accumulator{
+    public:
+        Accumulator(){
+            width = 0;
+            height = 0;
+        }
+
+        Accumulator(int width_, int height_){
+            width = width_;
+            height = height_;
+            sums.resize((size_t)width * height);
+            weights.resize((size_t)width * height);
+        }
+
+        void add(int x, int y, const Vec3& colour, float weight){
+            size_t i = (size_t)y * width + x;
+            sums[i] += colour * weight;
+            weights[i] += weight;
+        }
+
+        // adds the pixels [x0, x1) x [y0, y1) of another accumulator whose first pixel sits at left, top
+        void merge(const Accumulator& other, int left, int top, int x0, int y0, int x1, int y1){
+            for (int y = y0; y < y1; y++){
+                size_t from = (size_t)(y - top) * other.width + (x0 - left);
+                size_t to = (size_t)y * width + x0;
+                for (int x = x0; x < x1; x++, from++, to++){
+                    sums[to] += other.sums[from];
+                    weights[to] += other.weights[from];
+                }
+            }
+        }
+
+        void clear(){
+            std::fill(sums.begin(), sums.end(), Vec3(0));
+            std::fill(weights.begin(), weights.end(), 0.0f);
+        }
+
+        // filtered colour of a pixel, black before any sample reached it
+        Vec3 resolve(int x, int y) const{
+            size_t i = (size_t)y * width + x;
+            if (weights[i] <= 0) return Vec3(0);
+            return (sums[i] / weights[i]).clamp(0, 255);
+        }
+
+    public:
+        int width;
+        int height;
+        std::vector<Vec3> sums;
+        std::vector<float> weights;
+};
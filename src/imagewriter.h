@@ -0,0 +1,217 @@
+#pragma once
+
+#include "framebuffer.h"
+#include "bufferedwriter.h"
+#include "qoi.h"
+#include "ppm.h"
+#include "png.h"
+#include "exr.h"
+#include "stats.h"
+#include "threadpool.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+#include <cstdio>
+
+
+enum class ImageFormat{
+    QOI,
+    PPM,
+    PFM,
+    PNG,
+    EXR
+};
+
+// format picked from the file extension, QOI when it is not known
+inline ImageFormat imageFormat(const std::string& filename){
+    std::string extension = filename.substr(filename.find_last_of('.') + 1);
+    if (extension == "ppm") return ImageFormat::PPM;
+    if (extension == "pfm") return ImageFormat::PFM;
+    if (extension == "png") return ImageFormat::PNG;
+    if (extension == "exr") return ImageFormat::EXR;
+    return ImageFormat::QOI;
+}
+
+// pool, if given, is used by the formats that compress in parallel
+inline std::unique_ptr<RowEncoder> makeEncoder(ImageFormat format, ThreadPool* pool = nullptr){
+    switch (format){
+        case ImageFormat::PPM: return std::make_unique<PPMEncoder>();
+        case ImageFormat::PFM: return std::make_unique<PFMEncoder>();
+        case ImageFormat::PNG: return std::make_unique<PNGEncoder>(pool);
+        case ImageFormat::EXR: return std::make_unique<EXREncoder>();
+        default: return std::make_unique<QOIEncoder>();
+    }
+}
+
+// writes a finished image on the calling thread, helped by the threads of pool if one is given
+inline bool writeImage(const std::string& filename, const Framebuffer& image, ThreadPool* pool = nullptr){
+    BufferedWriter out;
+    if (!out.open(filename)) return false;
+    std::unique_ptr<RowEncoder> encoder = makeEncoder(imageFormat(filename), pool);
+    encoder->begin(out, image.width, image.height);
+    encoder->rows(out, 0, image.pixels.data(), image.pixels.size());
+    encoder->end(out);
+    return out.close();
+}
+
+
+/*
+   output pipeline running on its own thread so rendering never waits on the disk
+   render threads hand over finished bands of rows in any order and the encoder thread
+   writes them out in row order as soon as they line up
+   bands are not copied, the pixels must stay untouched until the image is written,
+   so the queue holds at most one entry per band of the images in flight
+   images are written one after the other in the order they are opened, open blocks
+   while maxImages earlier images are still being written
+   formats that compress in parallel use a pool of their own with threads threads, the encoder thread
+   being one of them, the render pool is busy with the next image while they run
+*/
+class ImageEncoder{
+    public:
+        ImageEncoder(size_t maxImages_ = 2, unsigned threads = 1): compressors(std::max(threads, 1u)){
+            maxImages = maxImages_;
+            worker = std::thread(&ImageEncoder::run, this);
+        }
+
+        ~ImageEncoder(){
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            changed.notify_all();
+            worker.join();
+        }
+
+        // starts a new image, all of its rows must be pushed before the next one is opened
+        void open(const std::string& filename, int width, int height){
+            std::unique_lock<std::mutex> lock(mutex);
+            space.wait(lock, [&]{ return jobs.size() < maxImages; });
+            Job job;
+            job.filename = filename;
+            job.width = width;
+            job.height = height;
+            job.bands.resize(height);
+            jobs.push_back(std::move(job));
+            changed.notify_all();
+        }
+
+        // hands over rows [y, y + count) of the newest image, never blocks or allocates
+        void push(int y, int count, const Vec3* pixels){
+            std::lock_guard<std::mutex> lock(mutex);
+            Job& job = jobs.back();
+            job.bands[y] = Band{count, pixels};
+            changed.notify_all();
+        }
+
+        // most images waiting to be written, open blocks beyond that
+        size_t capacity() const{
+            return maxImages;
+        }
+
+        // blocks until every opened image is written, returns false if any write failed
+        bool finish(){
+            std::unique_lock<std::mutex> lock(mutex);
+            space.wait(lock, [&]{ return jobs.empty(); });
+            bool result = !failed;
+            failed = false;
+            return result;
+        }
+
+    private:
+        struct Band{
+            int rows = 0;
+            const Vec3* pixels = nullptr;
+        };
+
+        struct Job{
+            std::string filename;
+            int width;
+            int height;
+            // first row not yet written
+            int next = 0;
+            // bands pushed so far, by their first row, rows is 0 where no band starts
+            std::vector<Band> bands;
+        };
+
+        void run(){
+            BufferedWriter out;
+            std::unique_ptr<RowEncoder> encoder;
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true){
+                changed.wait(lock, [&]{ return stopping || ready(); });
+                if (!ready()) return;
+                Job& job = jobs.front();
+                if (!encoder){
+                    encoder = makeEncoder(imageFormat(job.filename), &compressors);
+                    lock.unlock();
+                    if (!out.open(partial(job.filename))){
+                        std::cerr << "Could not write image " << job.filename << std::endl;
+                    }
+                    encoder->begin(out, job.width, job.height);
+                    lock.lock();
+                }
+                // take every band that continues the image, the disk work happens unlocked
+                std::vector<std::pair<int, Band>> bands;
+                while (job.next < job.height && job.bands[job.next].rows > 0){
+                    bands.push_back({job.next, job.bands[job.next]});
+                    job.next += job.bands[job.next].rows;
+                }
+                bool complete = job.next >= job.height;
+                lock.unlock();
+                bool written = true;
+                {
+                    STATS_TIME(Encode);
+                    for (const auto& band: bands){
+                        encoder->rows(out, band.first, band.second.pixels, (size_t) band.second.rows * job.width);
+                    }
+                    if (complete){
+                        encoder->end(out);
+                        written = out.close() && replace(partial(job.filename), job.filename);
+                        encoder.reset();
+                    }
+                }
+                lock.lock();
+                if (complete){
+                    failed = failed || !written;
+                    jobs.pop_front();
+                    space.notify_all();
+                }
+            }
+        }
+
+        // images are written next to their final name and moved there once complete,
+        // so a file being overwritten, like a progressive snapshot, is never seen half written
+        static std::string partial(const std::string& filename){
+            return filename + ".part";
+        }
+
+        static bool replace(const std::string& from, const std::string& to){
+            if (std::rename(from.c_str(), to.c_str()) == 0) return true;
+            // rename does not overwrite on every platform
+            std::remove(to.c_str());
+            return std::rename(from.c_str(), to.c_str()) == 0;
+        }
+
+        // the current image has rows to write, or has not been started yet
+        bool ready() const{
+            if (jobs.empty()) return false;
+            const Job& job = jobs.front();
+            return job.height == 0 || (job.next < job.height && job.bands[job.next].rows > 0);
+        }
+
+    private:
+        ThreadPool compressors;
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::condition_variable space;
+        std::deque<Job> jobs;
+        size_t maxImages;
+        bool stopping = false;
+        bool failed = false;
+};
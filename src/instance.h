@@ -0,0 +1,111 @@
+#pragma once
+
+#include "ray.h"
+#include "observables.h"
+#include "raypacket.h"
+#include "matrix.h"
+#include <memory>
+
+
+/*
+   places a shared object, usually a TriangleMesh with its BVH, in the scene with its own transform
+   rays are moved into the object's space instead of copying and transforming the object,
+   so one loaded mesh can appear any number of times for the cost of two matrices each
+   the object space ray direction is not normalised, keeping hit distances the same in both spaces
+*/
+class Instance: public Observable{
+    public:
+        // material_ = nullptr keeps the material of the object
+        Instance(std::shared_ptr<const Observable> object_, const Mat4& transform_, std::shared_ptr<Material> material_ = nullptr){
+            object = object_;
+            material = material_ ? material_ : object->material;
+            setTransform(transform_);
+        }
+
+        // hits take this colour instead of the object's
+        void setColour(const Vec3& colour_){
+            colour = colour_;
+            ownColour = true;
+        }
+
+        void setTransform(const Mat4& transform_){
+            transform = transform_;
+            inverse = transform.inverse();
+            // world bounds from the eight transformed corners of the object bounds
+            Vec3 corners[2];
+            bounded = object->bounds(corners[0], corners[1]);
+            worldMin = Vec3(finf);
+            worldMax = Vec3(-finf);
+            if (!bounded || corners[0].x > corners[1].x) return;
+            for (int i = 0; i < 8; i++){
+                Vec3 corner(corners[i & 1].x, corners[(i >> 1) & 1].y, corners[(i >> 2) & 1].z);
+                Vec3 p = transform.transformPoint(corner);
+                worldMin = worldMin.min(p);
+                worldMax = worldMax.max(p);
+            }
+        }
+
+        bool intersection(const Ray& ray, Intersection& inter) const{
+            Ray local(inverse.transformPoint(ray.origin), inverse.transformVector(ray.direction));
+            if (!object->intersection(local, inter)){
+                return false;
+            }
+            toWorld(ray, inter);
+            return true;
+        }
+
+        uint32_t intersection(const RayPacket& packet, Intersection* inter) const{
+            uint32_t found = object->intersection(toLocal(packet), inter);
+            for (uint32_t bits = found; bits; bits &= bits - 1){
+                int i = __builtin_ctz(bits);
+                toWorld(packet.rays[i], inter[i]);
+            }
+            return found;
+        }
+
+        bool occluded(const Ray& ray, float tmax) const{
+            return object->occluded(Ray(inverse.transformPoint(ray.origin), inverse.transformVector(ray.direction)), tmax);
+        }
+
+        uint32_t occluded(const RayPacket& packet, const float* tmax) const{
+            return object->occluded(toLocal(packet), tmax);
+        }
+
+        bool bounds(Vec3& min, Vec3& max) const{
+            min = worldMin;
+            max = worldMax;
+            return bounded;
+        }
+
+    private:
+        RayPacket toLocal(const RayPacket& packet) const{
+            RayPacket local;
+            for (uint32_t bits = packet.valid; bits; bits &= bits - 1){
+                int i = __builtin_ctz(bits);
+                const Ray& ray = packet.rays[i];
+                local.set(i, Ray(inverse.transformPoint(ray.origin), inverse.transformVector(ray.direction)));
+            }
+            return local;
+        }
+
+        void toWorld(const Ray& ray, Intersection& inter) const{
+            // normals go through the inverse transpose, which keeps the side of the surface the ray is on
+            inter.point = ray.attime(inter.timestep);
+            inter.normal = inverse.transformTransposed(inter.normal).normalise();
+            if (ownColour){
+                inter.colour = colour;
+            }
+        }
+
+    public:
+        std::shared_ptr<const Observable> object;
+        Mat4 transform;
+        Mat4 inverse;
+
+    private:
+        bool ownColour = false;
+        Vec3 colour;
+        bool bounded;
+        Vec3 worldMin;
+        Vec3 worldMax;
+};
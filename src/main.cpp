@@ -1,170 +1,192 @@
 #include <iostream>
 #include <vector>
 #include <memory>
-#include "plane.h"
-#include "trianglemesh.h"
 #include "scene.h"
-#include "material.h"
-#include "sphere.h"
+#include "meshcache.h"
+#include "framebuffer.h"
+#include "imagewriter.h"
+#include "threadpool.h"
+#include "renderer.h"
+#include "scenefile.h"
+#include "stats.h"
 #include <chrono>
+#include <string>
 
 
-const int WIDTH = 2560 * 3;
-const int HEIGHT = 1440 * 3;
-const float fov = M_PI / 3;
+// counts heap allocations in RT_STATS builds, the tile allocations are part of the statistics
+STATS_ALLOCATION_HOOK
 
-// byte headers for QOI file
-const int QOI_OP_RUN   = 0xc0;
-const int QOI_OP_INDEX = 0x00;
-const int QOI_OP_DIFF  = 0x40;
-const int QOI_OP_LUMA  = 0x80;
-const int QOI_OP_RGB   = 0xfe;
-const int QOI_OP_RGBA  = 0xff;
 
-
-Vec3 trace(Ray &ray, Scene world, int depth){
-    if (depth <= 0) return Vec3(0, 0, 0);
-
-    Intersection inter;
-    if (world.intersection(ray, inter)){
-        Vec3 l = (world.light - inter.point);
-        float rs = l.lengthsquared();
-        l.normalise();
-        float t = sqrt(rs);
-
-        Ray shadowRay(inter.point + l * 0.0001f, l);
-        Intersection shadowInter;
-        shadowInter.timestep = t;
-        if (world.intersection(shadowRay, shadowInter)){
-            return Vec3(0, 0, 0);
+// renders one scene, returns false if its images could not be written
+bool renderJob(const RenderJob& job, ThreadPool& pool, ImageEncoder& encoder){
+    const RenderSettings& settings = job.settings;
+    RenderScene compiled(job.scene);
+    auto start = std::chrono::high_resolution_clock::now();
+    Renderer renderer(compiled, settings, pool);
+    // the encoder reads these until finish
+    Framebuffer image;
+    Framebuffer heatmap;
+    uint64_t samples;
+    if (settings.progressive){
+        samples = renderer.renderProgressive(job.output, encoder);
+    }
+    else{
+        image = Framebuffer(settings.width, settings.height);
+        encoder.open(job.output, settings.width, settings.height);
+        if (!job.heatmap.empty()){
+            heatmap = Framebuffer(settings.width, settings.height);
         }
-        Ray transmitted;
-        Vec3 col;
-        // deal with transmission (refraction, reflection)
-        if (inter.material->transmit(ray, inter, col, transmitted, world)){
-            return trace(transmitted, world, depth - 1);
+        samples = renderer.render(image, encoder, job.heatmap.empty() ? nullptr : &heatmap);
+        if (!job.heatmap.empty()){
+            encoder.open(job.heatmap, settings.width, settings.height);
+            encoder.push(0, settings.height, heatmap.pixels.data());
         }
-        return col;
     }
-    return Vec3(0);
-}
-
-// key for colour in QOI file
-int getKey(Vec3 colour){
-    return ((int)(colour.x * 3 + colour.y * 5 + colour.z * 7) % 64);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Render time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms (" << pool.size() << " threads, " << (settings.packets ? "packets" : "single rays") << ")" << std::endl;
+    std::cout << "Samples: " << samples << " (" << samples / (double) ((size_t) settings.width * settings.height) << " per pixel" << (settings.progressive ? ", progressive" : settings.adaptive ? ", adaptive" : "") << ")" << std::endl;
+    RayCounts rays = renderer.rays();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << "Rays: " << rays.primary << " primary, " << rays.shadow << " shadow, " << rays.secondary << " secondary (" << rays.total() / seconds / 1e6 << " Mrays/s)" << std::endl;
+    bool written = encoder.finish();
+    if (!written){
+        std::cerr << "Could not write " << job.output << std::endl;
+    }
+    auto encoded = std::chrono::high_resolution_clock::now();
+    // only the encoding left after the last band counts, the rest overlaps the render
+    std::cout << "Encode wait: " << std::chrono::duration_cast<std::chrono::milliseconds>(encoded - end).count() << "ms" << std::endl;
+    return written;
 }
 
-// write 32 bit number to file
-void write32(std::ofstream& file, long value){
-    file << (unsigned char) ((value & 0xff000000) >> 24);
-    file << (unsigned char) ((value & 0x00ff0000) >> 16);
-    file << (unsigned char) ((value & 0x0000ff00) >> 8);
-    file << (unsigned char) ((value & 0x000000ff));
-}
 
-void render(Scene world){
-    float invWidth = 1/(WIDTH + 0.0);
-    float invHeight = 1/(HEIGHT + 0.0);
-    float ratio = WIDTH/(HEIGHT + 0.0);
-    float angle = tan(fov);
-    Vec3 colour;
-    std::ofstream qoi("images/result.qoi", std::ios::out|std::ios::binary);
-    // write file headers
-    write32(qoi, 0x716f6966);
-    write32(qoi, WIDTH);
-    write32(qoi, HEIGHT);
-    qoi << (unsigned char) 3;
-    qoi << (unsigned char) 1;
-    Vec3 lookup[64] = {};
-    int run_length = 0;
-    Vec3 previous = Vec3(0,0,0);
-    for (int y = 0; y < HEIGHT; y++){
-        for (int x = 0; x < WIDTH; x++){
-            // calculate ray colour
-            float xd = (2 * ((x+0.5) * invWidth) - 1) * angle * ratio;
-            float yd = (1 - 2 * ((y + 0.5) * invHeight)) * angle;
-            Ray ray = Ray(world.camera, Vec3(xd, yd, -1).normalise());
-            colour = trace(ray, world, 20).clamp(0, 255);
-            colour.toFloor();
-            // write to qoi
-            if (colour == previous){
-                // run length encoding
-                run_length += 1;
-                if (run_length == 62){
-                    qoi << (unsigned char) (QOI_OP_RUN | (run_length - 1));
-                    run_length = 0;
-                }
-            }
-            else{
-                // write previous run length encoding
-                if (run_length > 0){
-                    qoi << (unsigned char) (QOI_OP_RUN | (run_length - 1));
-                    run_length = 0;
-                }
-                // check if we've already seen pixel
-                int key = getKey(colour);
-                if (colour == lookup[key]){
-                    qoi << (unsigned char) (QOI_OP_INDEX | key);
-                }
-                else{
-                    // get difference of colour
-                    lookup[key] = colour;
-                    Vec3 diff = colour - previous;
-                    int dr_dg = diff.x - diff.y;
-                    int db_dg = diff.z - diff.y;
-                    // small difference of -2 to 1 in each colour channel
-                    if ((-2 <= diff.x && diff.x <= 1) && (-2 <= diff.y && diff.y <= 1) && (-2 <= diff.z && diff.z <= 1)){
-                        qoi << (unsigned char) (QOI_OP_DIFF | (((int)diff.x + 2)) << 4 | (((int)diff.y + 2) << 2) | ((int)diff.z + 2));
-                    }
-                    // larger differeence of -32 to 31 in green channel and -8 to 7 in red and blue channels
-                    else if (-32 <= diff.y && diff.y <= 31 && -8 <= dr_dg && dr_dg <= 7 && -8 <= db_dg && db_dg <= 7){
-                        qoi << (unsigned char) (QOI_OP_LUMA | ((int)diff.y + 32));
-                        qoi << (unsigned char) (((dr_dg + 8) << 4) | (db_dg + 8));
-                    }
-                    else{
-                        // no encoding possible so write RGB header and RGB values
-                        qoi << (unsigned char) QOI_OP_RGB;
-                        qoi << (unsigned char) (int)colour.x;
-                        qoi << (unsigned char) (int)colour.y;
-                        qoi << (unsigned char) (int)colour.z;
-                    }
-                }
-            previous = colour;
-            }
-        }
-        // update user on render progress
-        if (y % (HEIGHT / 10) == 0){
-            std::cout << "Rendering: " << (y * 100) / HEIGHT << "%" << std::endl;
+// renders every frame of an animated scene to its own numbered image, returns false if any could not be written
+bool renderAnimation(const RenderJob& job, ThreadPool& pool, ImageEncoder& encoder){
+    using clock = std::chrono::high_resolution_clock;
+    const RenderSettings& settings = job.settings;
+    const Animation& animation = job.animation;
+    // the encoder holds at most capacity images, so a ring of that many is never rendered into while written
+    std::vector<Framebuffer> images(encoder.capacity(), Framebuffer(settings.width, settings.height));
+    auto start = clock::now();
+    double updateMs = 0;
+    int rebuilt = 0;
+    uint64_t samples = 0;
+    RayCounts rays;
+    for (int frame = 0; frame < animation.frames; frame++){
+        auto frameStart = clock::now();
+        rebuilt += animation.setFrame(frame, &pool);
+        // only the top level is built again, over the boxes of the objects where they are now
+        RenderScene compiled(job.scene);
+        auto updated = clock::now();
+        double update = std::chrono::duration<double, std::milli>(updated - frameStart).count();
+        updateMs += update;
+        RenderSettings frameSettings = settings;
+        CameraKey at;
+        if (animation.camera(frame, at)){
+            compiled.camera = at.position;
+            compiled.cameraDirection = at.target - at.position;
+            frameSettings.fov = at.fov;
         }
+        Renderer renderer(compiled, frameSettings, pool);
+        Framebuffer& image = images[frame % images.size()];
+        encoder.open(frameOutput(job.output, frame), settings.width, settings.height);
+        samples += renderer.render(image, encoder);
+        rays += renderer.rays();
+        std::cout << "Frame " << frame + 1 << "/" << animation.frames << ": update " << update << "ms, render "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - updated).count() << "ms" << std::endl;
+    }
+    bool written = encoder.finish();
+    if (!written){
+        std::cerr << "Could not write the frames of " << job.output << std::endl;
     }
-    std::cout << "Rendered: 100%" << std::endl;
-    qoi.close();
+    auto end = clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << "Animation: " << animation.frames << " frames in " << (int) (seconds * 1000) << "ms (" << pool.size() << " threads), update "
+              << updateMs / animation.frames << "ms per frame, " << rebuilt << " rebuilds, " << animation.frames / seconds * 60 << " frames per minute" << std::endl;
+    std::cout << "Samples: " << samples << ", rays: " << rays.primary << " primary, " << rays.shadow << " shadow, " << rays.secondary
+              << " secondary (" << rays.total() / seconds / 1e6 << " Mrays/s)" << std::endl;
+    return written;
 }
 
 
-int main(){ 
-    Scene world;
-    //create cornell box
-    world.addObject(std::make_shared<Plane>(Vec3(0, 0, 0), Vec3(0, 1, 0), Vec3(255), false, std::make_shared<Lambertian>()));
-    world.addObject(std::make_shared<Plane>(Vec3(0, 0, -10), Vec3(0, 0, 1), Vec3(255), false, std::make_shared<Lambertian>()));
-    world.addObject(std::make_shared<Plane>(Vec3(0, 10, 0), Vec3(0, -1, 0), Vec3(255), false, std::make_shared<Lambertian>()));
-    world.addObject(std::make_shared<Plane>(Vec3(-10, 0, 0), Vec3(1, 0, 0), Vec3(170,0,0), false, std::make_shared<Lambertian>()));
-    world.addObject(std::make_shared<Plane>(Vec3(10, 0, 0), Vec3(-1, 0, 0), Vec3(0,170,0), false, std::make_shared<Lambertian>()));
-
-    world.light = Vec3(0, 9.9, -5);
-
-    std::shared_ptr<TriangleMesh> dragon = std::make_shared<TriangleMesh>("Objects/dragon.obj", Vec3(102,0,0), std::make_shared<Phong>());
-    dragon->rotate(0, M_PI/2, 0);
-    dragon->rescale(0.06);
-    dragon->center();
-    dragon->floor(0);
-    dragon->translate(Vec3(0, 0, -7.5));
-    dragon->recalcOctree();
-    world.addObject(dragon);
+/*
+   usage: main [scene files] [--threads n] [--trace path] [--<setting> values]
+   renders every scene file in turn, scenes/cornell.scene if none are given, meshes loaded by one scene
+   are kept for the ones after it, settings given on the command line override those of every scene,
+   see scenefile.h for both
+   scenes with more than one frame write every frame to a numbered image
+   builds with RT_STATS print their statistics at the end, --trace then also writes every timed stage
+   as a Chrome trace
+*/
+int main(int argc, char** argv){
+    unsigned threads = 0;
+    std::string trace;
+    std::vector<std::string> scenes;
+    std::vector<std::string> overrides;
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0){
+            scenes.push_back(arg);
+            continue;
+        }
+        std::string keyword = arg.substr(2);
+        if (keyword == "threads" && i + 1 < argc){
+            threads = std::stoi(argv[++i]);
+            continue;
+        }
+        if (keyword == "trace" && i + 1 < argc){
+            trace = argv[++i];
+            continue;
+        }
+        int count = SceneLoader::settingArguments(keyword);
+        if (count < 0 || i + count >= argc){
+            std::cerr << "Unknown option or missing values: " << arg << std::endl;
+            return 1;
+        }
+        // an override is a setting line of its own, applied after the scene file
+        std::string line = keyword;
+        for (int j = 0; j < count; j++){
+            line += " " + std::string(argv[++i]);
+        }
+        overrides.push_back(line);
+    }
+    if (scenes.empty()){
+        scenes.push_back("scenes/cornell.scene");
+    }
+    if (!trace.empty()){
+        if (!stats::ENABLED){
+            std::cerr << "--trace needs a build with RT_STATS" << std::endl;
+            return 1;
+        }
+        stats::startTrace();
+    }
 
-    world.camera = Vec3(0,5,0);
     auto start = std::chrono::high_resolution_clock::now();
-    render(world);
-    auto end = std::chrono::high_resolution_clock::now();
-    std::cout << "Render time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+    ThreadPool pool(threads);
+    ImageEncoder encoder(2, pool.size());
+    MeshLibrary library(&pool);
+    SceneLoader loader(library);
+    int failed = 0;
+    for (const std::string& path: scenes){
+        RenderJob job;
+        if (!loader.load(path, overrides, job)){
+            std::cerr << "Skipping " << path << std::endl;
+            failed++;
+            continue;
+        }
+        std::cout << "Rendering " << path << " to " << job.output << std::endl;
+        bool written = job.animation.animated() ? renderAnimation(job, pool, encoder) : renderJob(job, pool, encoder);
+        if (!written){
+            failed++;
+        }
+    }
+    if (scenes.size() > 1){
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Batch: " << scenes.size() - failed << " of " << scenes.size() << " scenes in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms, " << library.size() << " meshes loaded" << std::endl;
+    }
+    stats::report(std::cout);
+    if (!trace.empty() && !stats::writeTrace(trace)){
+        std::cerr << "Could not write " << trace << std::endl;
+        failed++;
+    }
+    return failed > 0 ? 1 : 0;
 }
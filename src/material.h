@@ -17,7 +17,7 @@ float random_float(){
 class Material{
     public:
         Material(){}
-        virtual bool transmit(const Ray& ray, Intersection& inter, Vec3& colour, Ray& transmissionRay, Scene& world) const = 0;
+        virtual bool transmit(const Ray& ray, Intersection& inter, Vec3& colour, Ray& transmissionRay, const RenderScene& world) const = 0;
         std::string name;
 };
 
@@ -27,7 +27,7 @@ class Lambertian: public Material{
         Lambertian(){
         }
 
-        bool inline transmit(const Ray& ray, Intersection& inter, Vec3& colour, Ray& transmissionRay, Scene& world) const{
+        bool inline transmit(const Ray& ray, Intersection& inter, Vec3& colour, Ray& transmissionRay, const RenderScene& world) const{
             colour = inter.colour * 0.5f;
             Vec3 l = (world.light - inter.point);
             float rs = l.lengthsquared();
@@ -48,7 +48,7 @@ class Phong: public Material{
         Phong(){
         }
 
-        bool inline transmit(const Ray& ray, Intersection& inter, Vec3& colour, Ray& transmissionRay, Scene& world) const{
+        bool inline transmit(const Ray& ray, Intersection& inter, Vec3& colour, Ray& transmissionRay, const RenderScene& world) const{
             Vec3 pointToLight = (world.light - inter.point).normalise();
             float dotted = inter.normal.dot(pointToLight);
             Vec3 pixelColour = inter.colour * dotted;
@@ -71,7 +71,7 @@ class Glass: public Material{
             refractionIndexLookup[1] = 1.0f / refractionIndex;
         }
 
-        virtual bool inline transmit(const Ray& ray, Intersection& inter, Vec3& colour, Ray& transmissionRay, Scene& world) const{
+        virtual bool inline transmit(const Ray& ray, Intersection& inter, Vec3& colour, Ray& transmissionRay, const RenderScene& world) const{
             colour = Vec3(255);
             Vec3 direction;
             direction = ray.direction.refract(inter.normal, refractionIndexLookup[inter.inside]);
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "vector.h"
+#include <cmath>
+
+
+// affine 4x4 matrix, row major, the bottom row is always 0 0 0 1
+class Mat4{
+    public:
+        float m[4][4];
+
+        Mat4(){
+            for (int r = 0; r < 4; r++){
+                for (int c = 0; c < 4; c++){
+                    m[r][c] = r == c ? 1.0f : 0.0f;
+                }
+            }
+        }
+
+        static Mat4 translation(const Vec3& t){
+            Mat4 result;
+            result.m[0][3] = t.x;
+            result.m[1][3] = t.y;
+            result.m[2][3] = t.z;
+            return result;
+        }
+
+        static Mat4 scaling(const Vec3& s){
+            Mat4 result;
+            result.m[0][0] = s.x;
+            result.m[1][1] = s.y;
+            result.m[2][2] = s.z;
+            return result;
+        }
+
+        // pitch, roll and yaw in radians, the same rotation as TriangleMesh::rotate
+        static Mat4 rotation(const Vec3& angles){
+            float cosa = cos(angles.z), sina = sin(angles.z);
+            float cosb = cos(angles.x), sinb = sin(angles.x);
+            float cosc = cos(angles.y), sinc = sin(angles.y);
+            Mat4 result;
+            result.m[0][0] = cosa * cosb;
+            result.m[0][1] = sina * cosb;
+            result.m[0][2] = -sinb;
+            result.m[1][0] = cosa * sinb * sinc - sina * cosc;
+            result.m[1][1] = sina * sinb * sinc + cosa * cosc;
+            result.m[1][2] = cosb * sinc;
+            result.m[2][0] = cosa * sinb * cosc + sina * sinc;
+            result.m[2][1] = sina * sinb * cosc - cosa * sinc;
+            result.m[2][2] = cosb * cosc;
+            return result;
+        }
+
+        Mat4 operator*(const Mat4& other) const{
+            Mat4 result;
+            for (int r = 0; r < 4; r++){
+                for (int c = 0; c < 4; c++){
+                    result.m[r][c] = m[r][0] * other.m[0][c] + m[r][1] * other.m[1][c] + m[r][2] * other.m[2][c] + m[r][3] * other.m[3][c];
+                }
+            }
+            return result;
+        }
+
+        Vec3 transformPoint(const Vec3& p) const{
+            return Vec3(
+                m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]
+            );
+        }
+
+        Vec3 transformVector(const Vec3& v) const{
+            return Vec3(
+                m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z
+            );
+        }
+
+        // multiplies by the transpose of the upper 3x3, called on the inverse this transforms normals
+        Vec3 transformTransposed(const Vec3& v) const{
+            return Vec3(
+                m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z,
+                m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+                m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z
+            );
+        }
+
+        // inverse of an affine matrix, the upper 3x3 must not be singular
+        Mat4 inverse() const{
+            float a = m[0][0], b = m[0][1], c = m[0][2];
+            float d = m[1][0], e = m[1][1], f = m[1][2];
+            float g = m[2][0], h = m[2][1], i = m[2][2];
+            float A = e * i - f * h, B = f * g - d * i, C = d * h - e * g;
+            float invdet = 1.0f / (a * A + b * B + c * C);
+            Mat4 result;
+            result.m[0][0] = A * invdet;
+            result.m[0][1] = (c * h - b * i) * invdet;
+            result.m[0][2] = (b * f - c * e) * invdet;
+            result.m[1][0] = B * invdet;
+            result.m[1][1] = (a * i - c * g) * invdet;
+            result.m[1][2] = (c * d - a * f) * invdet;
+            result.m[2][0] = C * invdet;
+            result.m[2][1] = (b * g - a * h) * invdet;
+            result.m[2][2] = (a * e - b * d) * invdet;
+            Vec3 t = result.transformVector(Vec3(m[0][3], m[1][3], m[2][3]));
+            result.m[0][3] = -t.x;
+            result.m[1][3] = -t.y;
+            result.m[2][3] = -t.z;
+            return result;
+        }
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+#include "trianglemesh.h"
+#include "objloader.h"
+#include "stats.h"
+#include "threadpool.h"
+#include <fstream>
+#include <string>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+
+/*
+   binary cache of a loaded, transformed mesh and its BVH, written next to the OBJ as <file>.cache
+   layout: header, vertices, normals, texcoords, indices, BVH nodes, BVH triangle indices, BVH packets
+   the cache is only used when the version, the hash of the OBJ contents and the hash of the
+   transform all match, otherwise the OBJ is parsed again and the cache rewritten
+   meshes loaded for an octree are cached without a BVH, the first load wanting one builds it and
+   rewrites the cache
+*/
+const uint32_t MESH_CACHE_VERSION = 4;
+
+struct MeshCacheHeader{
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint64_t transformHash;
+    uint64_t vertexCount;
+    uint64_t normalCount;
+    uint64_t texcoordCount;
+    uint64_t indexCount;
+    uint64_t nodeCount;
+    uint64_t triIndexCount;
+    uint64_t packetCount;
+    Vec3 boundingBox[2];
+};
+
+
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0x9e3779b97f4a7c15ull){
+    // 64 bit hash taking 8 bytes per step, fast enough that hashing is cheap next to parsing
+    const unsigned char* p = (const unsigned char*) data;
+    uint64_t h = seed ^ (size * 0xff51afd7ed558ccdull);
+    while (size >= 8){
+        uint64_t word;
+        memcpy(&word, p, 8);
+        word *= 0x87c37b91114253d5ull;
+        word = (word << 31) | (word >> 33);
+        h ^= word * 0x4cf5ad432745937full;
+        h = ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+        p += 8;
+        size -= 8;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, size);
+    h ^= tail * 0x87c37b91114253d5ull;
+    // final avalanche
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint64_t hashTransform(const MeshTransform& transform){
+    float values[] = {
+        transform.rotation.x, transform.rotation.y, transform.rotation.z, transform.scale,
+        (float) transform.center, (float) transform.floor, transform.floorHeight,
+        transform.translation.x, transform.translation.y, transform.translation.z
+    };
+    return hashBytes(values, sizeof(values));
+}
+
+
+namespace meshcache{
+    template <typename T>
+    void writeArray(std::ofstream& file, const std::vector<T>& array){
+        file.write((const char*) array.data(), array.size() * sizeof(T));
+    }
+
+    template <typename T>
+    bool readArray(const char*& p, const char* end, std::vector<T>& array, uint64_t count){
+        if ((uint64_t)(end - p) < count * sizeof(T)) return false;
+        array.resize(count);
+        memcpy(array.data(), p, count * sizeof(T));
+        p += count * sizeof(T);
+        return true;
+    }
+
+    inline bool read(const std::string& path, uint64_t sourceHash, uint64_t transformHash, TriangleMesh& mesh){
+        MappedFile file(path);
+        if (!file.isOpen() || file.size < sizeof(MeshCacheHeader)) return false;
+        MeshCacheHeader header;
+        memcpy(&header, file.data, sizeof(header));
+        if (memcmp(header.magic, "RTMC", 4) != 0 || header.version != MESH_CACHE_VERSION){
+            return false;
+        }
+        if (header.sourceHash != sourceHash || header.transformHash != transformHash){
+            return false;
+        }
+        const char* p = file.data + sizeof(header);
+        const char* end = file.data + file.size;
+        bool complete = readArray(p, end, mesh.vertices, header.vertexCount)
+            && readArray(p, end, mesh.normals, header.normalCount)
+            && readArray(p, end, mesh.texcoords, header.texcoordCount)
+            && readArray(p, end, mesh.indices, header.indexCount)
+            && readArray(p, end, mesh.bvh.nodes, header.nodeCount)
+            && readArray(p, end, mesh.bvh.triIndices, header.triIndexCount)
+            && readArray(p, end, mesh.bvh.packets, header.packetCount);
+        if (!complete || p != end){
+            return false;
+        }
+        mesh.boundingBox[0] = header.boundingBox[0];
+        mesh.boundingBox[1] = header.boundingBox[1];
+        return true;
+    }
+
+    inline bool write(const std::string& path, uint64_t sourceHash, uint64_t transformHash, const TriangleMesh& mesh){
+        MeshCacheHeader header;
+        memcpy(header.magic, "RTMC", 4);
+        header.version = MESH_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.transformHash = transformHash;
+        header.vertexCount = mesh.vertices.size();
+        header.normalCount = mesh.normals.size();
+        header.texcoordCount = mesh.texcoords.size();
+        header.indexCount = mesh.indices.size();
+        header.nodeCount = mesh.bvh.nodes.size();
+        header.triIndexCount = mesh.bvh.triIndices.size();
+        header.packetCount = mesh.bvh.packets.size();
+        header.boundingBox[0] = mesh.boundingBox[0];
+        header.boundingBox[1] = mesh.boundingBox[1];
+
+        // write to a temporary file first so a crash never leaves a truncated cache behind
+        std::string temp = path + ".tmp";
+        {
+            std::ofstream file(temp, std::ios::out|std::ios::binary);
+            if (!file.is_open()) return false;
+            file.write((const char*) &header, sizeof(header));
+            writeArray(file, mesh.vertices);
+            writeArray(file, mesh.normals);
+            writeArray(file, mesh.texcoords);
+            writeArray(file, mesh.indices);
+            writeArray(file, mesh.bvh.nodes);
+            writeArray(file, mesh.bvh.triIndices);
+            writeArray(file, mesh.bvh.packets);
+            if (!file.good()) return false;
+        }
+        std::remove(path.c_str());
+        return std::rename(temp.c_str(), path.c_str()) == 0;
+    }
+}
+
+
+// loads a mesh, transforms it and builds its BVH, going through the binary cache next to the OBJ
+// octreeDepth = 0 builds a BVH, anything else an octree of that depth and no BVH at all
+// pool, if given, parses the OBJ, transforms the mesh and builds the BVH on all its threads
+inline std::shared_ptr<TriangleMesh> loadMesh(const std::string& filename, const MeshTransform& transform, const Vec3& colour, std::shared_ptr<Material> material, ThreadPool* pool = nullptr, int octreeDepth = 0){
+    STATS_TIME(MeshLoad);
+    uint64_t sourceHash;
+    {
+        MappedFile source(filename);
+        if (!source.isOpen()){
+            std::cerr << "Could not open file " << filename << std::endl;
+            return std::make_shared<TriangleMesh>(colour, material);
+        }
+        sourceHash = hashBytes(source.data, source.size);
+    }
+    uint64_t transformHash = hashTransform(transform);
+    std::string cachePath = filename + ".cache";
+
+    auto mesh = std::make_shared<TriangleMesh>(colour, material);
+    bool cached = meshcache::read(cachePath, sourceHash, transformHash, *mesh);
+    if (cached){
+        std::cout << "Loaded " << filename << " from cache" << std::endl;
+        if (octreeDepth > 0){
+            mesh->recalcOctree(octreeDepth, pool);
+            return mesh;
+        }
+        if (!mesh->bvh.empty() || mesh->indices.empty()){
+            return mesh;
+        }
+    }
+    else{
+        mesh = std::make_shared<TriangleMesh>(filename, colour, material, pool);
+        mesh->applyTransform(transform, pool);
+    }
+
+    if (octreeDepth > 0){
+        mesh->recalcOctree(octreeDepth, pool);
+    }
+    else{
+        mesh->recalcBVH(true, pool);
+    }
+    if (!meshcache::write(cachePath, sourceHash, transformHash, *mesh)){
+        std::cerr << "Could not write mesh cache " << cachePath << std::endl;
+    }
+    return mesh;
+}
+
+
+/*
+   meshes loaded once per process, so a batch of scenes using the same model with the same
+   transform shares one copy of its vertices and BVH
+   colour and material belong to whichever scene is using the mesh, scenes that need several
+   looks of one mesh at the same time wrap it in an Instance
+*/
+class MeshLibrary{
+    public:
+        // pool, if given, builds the meshes' BVHs and octrees on all its threads
+        MeshLibrary(ThreadPool* pool_ = nullptr): pool(pool_){
+        }
+
+        // octreeDepth = 0 keeps the BVH, anything else replaces it with an octree of that depth
+        std::shared_ptr<TriangleMesh> load(const std::string& filename, const MeshTransform& transform, int octreeDepth = 0){
+            Key key{filename, hashTransform(transform), octreeDepth};
+            auto found = meshes.find(key);
+            if (found != meshes.end()){
+                return found->second;
+            }
+            std::shared_ptr<TriangleMesh> mesh = loadMesh(filename, transform, Vec3(255), nullptr, pool, octreeDepth);
+            meshes[key] = mesh;
+            return mesh;
+        }
+
+        size_t size() const{
+            return meshes.size();
+        }
+
+        // every mesh loaded so far
+        std::vector<std::shared_ptr<TriangleMesh>> loaded() const{
+            std::vector<std::shared_ptr<TriangleMesh>> all;
+            for (const auto& entry: meshes){
+                all.push_back(entry.second);
+            }
+            return all;
+        }
+
+    private:
+        struct Key{
+            std::string filename;
+            uint64_t transformHash;
+            int octreeDepth;
+
+            bool operator<(const Key& other) const{
+                return std::tie(filename, transformHash, octreeDepth) < std::tie(other.filename, other.transformHash, other.octreeDepth);
+            }
+        };
+
+        ThreadPool* pool;
+        std::map<Key, std::shared_ptr<TriangleMesh>> meshes;
+};
@@ -0,0 +1,417 @@
+#pragma once
+
+#include "vector.h"
+#include "threadpool.h"
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// read only view of a whole file mapped into memory
+class MappedFile{
+    public:
+        MappedFile(){
+        }
+
+        MappedFile(const std::string& filename){
+            open(filename);
+        }
+
+        ~MappedFile(){
+            close();
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool open(const std::string& filename){
+            close();
+#ifdef _WIN32
+            file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (file == INVALID_HANDLE_VALUE) return false;
+            LARGE_INTEGER fileSize;
+            GetFileSizeEx(file, &fileSize);
+            size = fileSize.QuadPart;
+            if (size > 0){
+                mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+                if (mapping == NULL) return false;
+                data = (const char*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            }
+#else
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat info;
+            fstat(fd, &info);
+            size = info.st_size;
+            if (size > 0){
+                void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                data = mapped == MAP_FAILED ? nullptr : (const char*) mapped;
+            }
+            ::close(fd);
+#endif
+            valid = size == 0 || data != nullptr;
+            return valid;
+        }
+
+        void close(){
+#ifdef _WIN32
+            if (data) UnmapViewOfFile(data);
+            if (mapping) CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+            mapping = NULL;
+            file = INVALID_HANDLE_VALUE;
+#else
+            if (data) munmap((void*) data, size);
+#endif
+            data = nullptr;
+            size = 0;
+            valid = false;
+        }
+
+        bool isOpen() const{
+            return valid;
+        }
+
+    public:
+        const char* data = nullptr;
+        size_t size = 0;
+
+    private:
+        bool valid = false;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = NULL;
+#endif
+};
+
+
+// geometry read from an OBJ file, faces are fan triangulated
+struct ObjData{
+    std::vector<Vec3> vertices;
+    // one normal per vertex, empty when the file has none
+    std::vector<Vec3> normals;
+    std::vector<Vec3> texcoords;
+    // three zero based vertex indices per triangle
+    std::vector<uint32_t> indices;
+};
+
+
+namespace obj{
+    const uint32_t NONE = 0xffffffff;
+    // negative OBJ indices are stored relative to the start of the chunk they were read in,
+    // offset by RELATIVE so they can be told apart until the chunks are merged
+    const int64_t RELATIVE = (int64_t) 1 << 40;
+    const int64_t MISSING = -1;
+
+    struct Chunk{
+        std::vector<Vec3> vertices;
+        std::vector<Vec3> normals;
+        std::vector<Vec3> texcoords;
+        std::vector<int64_t> indices;
+        std::vector<int64_t> normalIndices;
+        bool hasNormalIndices = false;
+    };
+
+    inline bool isSpace(char c){
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline const char* skipSpace(const char* p, const char* end){
+        while (p < end && isSpace(*p)) p++;
+        return p;
+    }
+
+    inline const char* skipLine(const char* p, const char* end){
+        const char* next = (const char*) memchr(p, '\n', end - p);
+        return next ? next + 1 : end;
+    }
+
+    inline const char* parseInt(const char* p, const char* end, long& value){
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')){
+            negative = *p == '-';
+            p++;
+        }
+        long result = 0;
+        while (p < end && *p >= '0' && *p <= '9'){
+            result = result * 10 + (*p - '0');
+            p++;
+        }
+        value = negative ? -result : result;
+        return p;
+    }
+
+    inline const char* parseFloat(const char* p, const char* end, float& value){
+        static const double powers[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+            1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        p = skipSpace(p, end);
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')){
+            negative = *p == '-';
+            p++;
+        }
+        // keep at most 19 significant digits, the rest only move the exponent
+        uint64_t mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        while (p < end && *p >= '0' && *p <= '9'){
+            if (digits < 19){
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) digits++;
+            }
+            else{
+                exponent++;
+            }
+            p++;
+        }
+        if (p < end && *p == '.'){
+            p++;
+            while (p < end && *p >= '0' && *p <= '9'){
+                if (digits < 19){
+                    mantissa = mantissa * 10 + (*p - '0');
+                    if (mantissa) digits++;
+                    exponent--;
+                }
+                p++;
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E')){
+            long e;
+            p = parseInt(p + 1, end, e);
+            exponent += e;
+        }
+        double result = mantissa;
+        if (exponent < 0){
+            while (exponent < -22){
+                result /= 1e22;
+                exponent += 22;
+            }
+            result /= powers[-exponent];
+        }
+        else{
+            while (exponent > 22){
+                result *= 1e22;
+                exponent -= 22;
+            }
+            result *= powers[exponent];
+        }
+        value = negative ? -result : result;
+        return p;
+    }
+
+    inline const char* parseVec3(const char* p, const char* end, Vec3& v, int components){
+        p = parseFloat(p, end, v.x);
+        p = parseFloat(p, end, v.y);
+        if (components == 3){
+            p = parseFloat(p, end, v.z);
+        }
+        return p;
+    }
+
+    // converts a one based or negative OBJ index into a zero based one
+    inline int64_t resolve(long index, size_t localCount){
+        if (index > 0) return index - 1;
+        if (index < 0) return (int64_t) localCount + index - RELATIVE;
+        return MISSING;
+    }
+
+    // final index once the number of elements read before the chunk is known
+    inline uint32_t merge(int64_t index, size_t offset, size_t count){
+        if (index < -RELATIVE / 2){
+            index += RELATIVE + (int64_t) offset;
+        }
+        return (index < 0 || index >= (int64_t) count) ? NONE : (uint32_t) index;
+    }
+
+    inline void parseChunk(const char* p, const char* end, Chunk& chunk){
+        std::vector<int64_t> corners;
+        std::vector<int64_t> cornerNormals;
+        while (p < end){
+            p = skipSpace(p, end);
+            if (p + 1 >= end){
+                break;
+            }
+            if (p[0] == 'v' && isSpace(p[1])){
+                Vec3 v;
+                p = parseVec3(p + 2, end, v, 3);
+                chunk.vertices.push_back(v);
+            }
+            else if (p[0] == 'v' && p[1] == 'n'){
+                Vec3 vn;
+                p = parseVec3(p + 2, end, vn, 3);
+                chunk.normals.push_back(vn);
+            }
+            else if (p[0] == 'v' && p[1] == 't'){
+                Vec3 vt;
+                p = parseVec3(p + 2, end, vt, 2);
+                chunk.texcoords.push_back(vt);
+            }
+            else if (p[0] == 'f' && isSpace(p[1])){
+                // face made of v, v/vt, v//vn or v/vt/vn corners
+                corners.clear();
+                cornerNormals.clear();
+                p += 2;
+                while (true){
+                    p = skipSpace(p, end);
+                    if (p >= end || *p == '\n' || *p == '#') break;
+                    long v = 0, vt = 0, vn = 0;
+                    p = parseInt(p, end, v);
+                    if (p < end && *p == '/'){
+                        p = parseInt(p + 1, end, vt);
+                        if (p < end && *p == '/'){
+                            p = parseInt(p + 1, end, vn);
+                        }
+                    }
+                    // skip anything we did not understand in this corner
+                    while (p < end && !isSpace(*p) && *p != '\n') p++;
+                    corners.push_back(resolve(v, chunk.vertices.size()));
+                    cornerNormals.push_back(resolve(vn, chunk.normals.size()));
+                }
+                // fan triangulation of polygons
+                for (size_t i = 1; i + 1 < corners.size(); i++){
+                    size_t fan[3] = {0, i, i + 1};
+                    for (size_t c: fan){
+                        chunk.indices.push_back(corners[c]);
+                        chunk.normalIndices.push_back(cornerNormals[c]);
+                        chunk.hasNormalIndices = chunk.hasNormalIndices || cornerNormals[c] != MISSING;
+                    }
+                }
+            }
+            p = skipLine(p, end);
+        }
+    }
+}
+
+
+// parses an OBJ file, splitting it into line aligned chunks that are parsed on the threads of pool
+// without a pool the whole file is parsed on the calling thread
+inline bool loadOBJ(const std::string& filename, ObjData& out, ThreadPool* pool = nullptr){
+    MappedFile file(filename);
+    if (!file.isOpen()){
+        return false;
+    }
+    // chunks smaller than this are not worth a thread
+    const size_t MIN_CHUNK = 1 << 20;
+    size_t threads = pool ? pool->size() : 1;
+    size_t chunks = std::max<size_t>(1, std::min<size_t>(threads, file.size / MIN_CHUNK));
+
+    const char* begin = file.data;
+    const char* end = file.data + file.size;
+    std::vector<const char*> bounds(chunks + 1);
+    bounds[0] = begin;
+    bounds[chunks] = end;
+    for (size_t i = 1; i < chunks; i++){
+        const char* p = std::max(begin + file.size * i / chunks, bounds[i - 1]);
+        bounds[i] = obj::skipLine(p, end);
+    }
+
+    std::vector<obj::Chunk> parsed(chunks);
+    if (chunks > 1){
+        pool->parallelFor(chunks, [&](uint32_t i, unsigned){
+            obj::parseChunk(bounds[i], bounds[i + 1], parsed[i]);
+        });
+    }
+    else{
+        obj::parseChunk(bounds[0], bounds[1], parsed[0]);
+    }
+
+    // merge in file order, local indices are offset by everything read in the chunks before
+    size_t vertexCount = 0, normalCount = 0, texcoordCount = 0, indexCount = 0;
+    bool hasNormalIndices = false;
+    for (const obj::Chunk& chunk: parsed){
+        vertexCount += chunk.vertices.size();
+        normalCount += chunk.normals.size();
+        texcoordCount += chunk.texcoords.size();
+        indexCount += chunk.indices.size();
+        hasNormalIndices = hasNormalIndices || chunk.hasNormalIndices;
+    }
+    out.vertices.clear();
+    out.normals.clear();
+    out.texcoords.clear();
+    out.indices.clear();
+    out.vertices.reserve(vertexCount);
+    out.texcoords.reserve(texcoordCount);
+    out.indices.reserve(indexCount);
+    std::vector<Vec3> fileNormals;
+    std::vector<uint32_t> normalIndices;
+    fileNormals.reserve(normalCount);
+    if (hasNormalIndices){
+        normalIndices.reserve(indexCount);
+    }
+    for (const obj::Chunk& chunk: parsed){
+        size_t vertexOffset = out.vertices.size();
+        size_t normalOffset = fileNormals.size();
+        for (size_t i = 0; i < chunk.indices.size(); i++){
+            out.indices.push_back(obj::merge(chunk.indices[i], vertexOffset, vertexCount));
+            if (hasNormalIndices){
+                normalIndices.push_back(obj::merge(chunk.normalIndices[i], normalOffset, normalCount));
+            }
+        }
+        out.vertices.insert(out.vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+        fileNormals.insert(fileNormals.end(), chunk.normals.begin(), chunk.normals.end());
+        out.texcoords.insert(out.texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+    }
+
+    // drop triangles that reference vertices that do not exist
+    size_t kept = 0;
+    for (size_t i = 0; i + 2 < out.indices.size(); i += 3){
+        if (out.indices[i] >= vertexCount || out.indices[i + 1] >= vertexCount || out.indices[i + 2] >= vertexCount){
+            continue;
+        }
+        for (int c = 0; c < 3; c++){
+            out.indices[kept + c] = out.indices[i + c];
+            if (hasNormalIndices) normalIndices[kept + c] = normalIndices[i + c];
+        }
+        kept += 3;
+    }
+    if (kept != out.indices.size()){
+        std::cerr << "Skipped " << (out.indices.size() - kept) / 3 << " faces with invalid indices in " << filename << std::endl;
+        out.indices.resize(kept);
+    }
+
+    if (hasNormalIndices){
+        // normals are stored per vertex, a vertex used with different normals is split
+        std::vector<uint32_t> assigned(out.vertices.size(), obj::NONE);
+        std::unordered_map<uint64_t, uint32_t> splits;
+        out.normals.assign(out.vertices.size(), Vec3(0));
+        for (size_t i = 0; i < out.indices.size(); i++){
+            uint32_t v = out.indices[i];
+            uint32_t n = normalIndices[i];
+            if (n >= fileNormals.size() || assigned[v] == n) continue;
+            if (assigned[v] == obj::NONE){
+                assigned[v] = n;
+                out.normals[v] = fileNormals[n];
+                continue;
+            }
+            uint64_t key = ((uint64_t) v << 32) | n;
+            auto found = splits.find(key);
+            if (found == splits.end()){
+                found = splits.emplace(key, out.vertices.size()).first;
+                out.vertices.push_back(out.vertices[v]);
+                out.normals.push_back(fileNormals[n]);
+            }
+            out.indices[i] = found->second;
+        }
+    }
+    else if (fileNormals.size() == out.vertices.size()){
+        // no normal indices on the faces, the normals line up with the vertices
+        out.normals = std::move(fileNormals);
+    }
+    return true;
+}
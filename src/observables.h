@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ray.h"
+#include "raypacket.h"
 #include <iostream>
 #include <memory>
 #include <vector>
@@ -15,7 +16,7 @@ struct Intersection{
     Vec3 colour;
     float timestep;
     uint32_t sceneIndex;
-    std::shared_ptr<Material> material;
+    const Material* material;
     bool inside;
 
     Intersection(){
@@ -33,7 +34,43 @@ class Observable{
     public:
         std::shared_ptr<Material> material;
         Observable(){}
-        virtual bool intersection(Ray& ray, Intersection& inter) = 0;
+        virtual bool intersection(const Ray& ray, Intersection& inter) const = 0;
+
+        // closest hits for every valid ray of the packet, returns a bit mask of the rays whose
+        // intersection was updated, objects without a packet path test the rays one by one
+        virtual uint32_t intersection(const RayPacket& packet, Intersection* inter) const{
+            uint32_t found = 0;
+            for (int i = 0; i < RayPacket::SIZE; i++){
+                if ((packet.valid & (1u << i)) && intersection(packet.rays[i], inter[i])){
+                    found |= 1u << i;
+                }
+            }
+            return found;
+        }
+
+        // true if anything is hit closer than tmax, an any hit query that skips the shading attributes
+        // objects without a faster path fall back to the closest hit
+        virtual bool occluded(const Ray& ray, float tmax) const{
+            Intersection inter;
+            inter.timestep = tmax;
+            return intersection(ray, inter);
+        }
+
+        // bit mask of the valid rays hitting anything closer than their tmax, lanes with a negative tmax are skipped
+        virtual uint32_t occluded(const RayPacket& packet, const float* tmax) const{
+            uint32_t found = 0;
+            for (int i = 0; i < RayPacket::SIZE; i++){
+                if ((packet.valid & (1u << i)) && tmax[i] > 0 && occluded(packet.rays[i], tmax[i])){
+                    found |= 1u << i;
+                }
+            }
+            return found;
+        }
+
+        // world space bounding box, unbounded objects such as planes return false
+        virtual bool bounds(Vec3& min, Vec3& max) const{
+            return false;
+        }
 };
 
 
@@ -84,3 +121,45 @@ inline bool AABBIntersection(const Vec3& center, const Vec3& e, Vec3 v0, Vec3 v1
 
     return (fabs(r) > s);
 }
+
+inline float AABBDistance(const Vec3& min, const Vec3& max, const Ray& ray, float tfar){
+    // slab test returning the entry distance of the ray into the box
+    // returns finf when the box is missed or lies beyond tfar
+    Vec3 t0 = (min - ray.origin) * ray.invDirection;
+    Vec3 t1 = (max - ray.origin) * ray.invDirection;
+    float tmin = t0.min(t1).maxComponent();
+    float tmax = t0.max(t1).minComponent();
+
+    if (tmax < tmin || tmax < 0 || tmin >= tfar) return finf;
+    return tmin;
+}
+
+inline bool rayTriangleEdgesIntersection(const Ray& ray, const Vec3& v0, const Vec3& v0v1, const Vec3& v0v2, float& t, float& u, float& v, bool& backface){
+    // moller-trumbore ray triangle intersection on a triangle given as a vertex and two edges
+    Vec3 pvec = ray.direction.cross(v0v2);
+    float det = v0v1.dot(pvec);
+    if (std::fabs(det) < EPSILLON){
+        return false;
+    }
+
+    float invdet = 1.0 / det;
+    Vec3 tvec = ray.origin - v0;
+    u = tvec.dot(pvec) * invdet;
+    if (u < 0 || u > 1){
+        return false;
+    }
+
+    Vec3 qvec = tvec.cross(v0v1);
+    v = ray.direction.dot(qvec) * invdet;
+    if (v < 0 || u + v > 1){
+        return false;
+    }
+
+    t = v0v2.dot(qvec) * invdet;
+    backface = (det < 0);
+    return true;
+}
+
+inline bool rayTriangleIntersection(const Ray& ray, const Vec3& v0, const Vec3& v1, const Vec3& v2, float& t, float& u, float& v, bool& backface){
+    return rayTriangleEdgesIntersection(ray, v0, v1 - v0, v2 - v0, t, u, v, backface);
+}
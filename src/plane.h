@@ -17,7 +17,7 @@ class Plane: public Observable{
             material = material_;
         }
 
-        bool intersection(Ray& ray, Intersection& inter){
+        bool intersection(const Ray& ray, Intersection& inter) const{
             float denom = normal.dot(ray.direction);
             if (std::fabs(denom) > EPSILLON){
                 float t = (point - ray.origin).dot(normal) / denom;
@@ -39,6 +39,15 @@ class Plane: public Observable{
             return false;
         }
 
+        bool occluded(const Ray& ray, float tmax) const{
+            float denom = normal.dot(ray.direction);
+            if (std::fabs(denom) > EPSILLON){
+                float t = (point - ray.origin).dot(normal) / denom;
+                return t > EPSILLON && t < tmax;
+            }
+            return false;
+        }
+
         bool checkered;
         Vec3 normal;
         Vec3 point;
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "rowencoder.h"
+#include "deflate.h"
+#include "threadpool.h"
+#include <vector>
+#include <cstdlib>
+
+
+/*
+   8 bit RGB PNG, the image is cut into strips of STRIP_ROWS rows that are filtered and
+   deflated on the threads of a pool, each strip becomes its own IDAT chunk
+   complete strips are collected until there is one for every thread of the pool, compressed
+   together and written in order, so no more than that many strips are ever held
+   the zlib checksum of the whole image is combined from the checksums of the strips
+*/
+class PNGEncoder: public RowEncoder{
+    public:
+        static constexpr int STRIP_ROWS = 64;
+
+        // pool, if given, compresses the strips on all its threads, otherwise they are compressed one by one
+        PNGEncoder(ThreadPool* pool_ = nullptr): pool(pool_){
+        }
+
+        void begin(BufferedWriter& out, int width_, int height_){
+            width = width_;
+            height = height_;
+            rowSize = (size_t) width * 3;
+            previous.assign(rowSize, 0);
+            batch.assign(pool ? pool->size() : 1, Strip());
+            pending = 0;
+            batch[0].raw.clear();
+            stripRows = 0;
+            adler = 1;
+            first = true;
+
+            static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+            out.write(signature, sizeof(signature));
+            uint8_t header[13];
+            put32(header, width);
+            put32(header + 4, height);
+            header[8] = 8;
+            header[9] = 2;
+            header[10] = 0;
+            header[11] = 0;
+            header[12] = 0;
+            chunk(out, "IHDR", header, sizeof(header));
+        }
+
+        void rows(BufferedWriter& out, int, const Vec3* pixels, size_t size){
+            for (size_t i = 0; i < size; i++){
+                std::vector<uint8_t>& raw = batch[pending].raw;
+                raw.push_back(toByte(pixels[i].x));
+                raw.push_back(toByte(pixels[i].y));
+                raw.push_back(toByte(pixels[i].z));
+                if ((i + 1) % width == 0 && ++stripRows == STRIP_ROWS){
+                    submit(out, false);
+                }
+            }
+        }
+
+        void end(BufferedWriter& out){
+            submit(out, true);
+            uint8_t checksum[4];
+            put32(checksum, adler);
+            chunk(out, "IDAT", checksum, 4);
+            chunk(out, "IEND", nullptr, 0);
+        }
+
+    private:
+        // the rows of a strip, the row above them for the up filters, and what they compress to
+        struct Strip{
+            std::vector<uint8_t> raw;
+            std::vector<uint8_t> above;
+            bool last = false;
+            std::vector<uint8_t> data;
+            uint32_t adler = 1;
+            size_t rawSize = 0;
+        };
+
+        // closes the strip being filled, compressing the batch once it is full or the image is done
+        void submit(BufferedWriter& out, bool last){
+            Strip& strip = batch[pending];
+            strip.above = previous;
+            strip.last = last;
+            if (stripRows > 0){
+                previous.assign(strip.raw.end() - rowSize, strip.raw.end());
+            }
+            stripRows = 0;
+            pending++;
+            if (pending == batch.size() || last){
+                auto compress = [&](uint32_t i, unsigned){
+                    compressStrip(batch[i], rowSize);
+                };
+                if (pool && pending > 1){
+                    pool->parallelFor(pending, compress);
+                }
+                else{
+                    for (uint32_t i = 0; i < pending; i++){
+                        compress(i, 0);
+                    }
+                }
+                for (uint32_t i = 0; i < pending; i++){
+                    writeStrip(out, batch[i]);
+                }
+                pending = 0;
+            }
+            batch[pending].raw.clear();
+        }
+
+        void writeStrip(BufferedWriter& out, Strip& done){
+            if (first){
+                // zlib header in front of the first strip, deflate with a 32k window
+                done.data.insert(done.data.begin(), {0x78, 0x01});
+                first = false;
+            }
+            adler = deflate::adler32Combine(adler, done.adler, done.rawSize);
+            chunk(out, "IDAT", done.data.data(), done.data.size());
+        }
+
+        static void compressStrip(Strip& strip, size_t rowSize){
+            size_t rows = strip.raw.size() / rowSize;
+            std::vector<uint8_t> filtered((rowSize + 1) * rows);
+            for (size_t r = 0; r < rows; r++){
+                const uint8_t* row = strip.raw.data() + r * rowSize;
+                const uint8_t* up = r == 0 ? strip.above.data() : row - rowSize;
+                filterRow(row, up, rowSize, filtered.data() + r * (rowSize + 1));
+            }
+            strip.rawSize = filtered.size();
+            strip.adler = deflate::adler32(filtered.data(), filtered.size());
+            strip.data.clear();
+            deflate::compressSegment(filtered.data(), filtered.size(), strip.last, strip.data);
+        }
+
+        // picks the PNG filter with the smallest sum of absolute differences over the row
+        static void filterRow(const uint8_t* row, const uint8_t* up, size_t size, uint8_t* out){
+            long cost[5] = {};
+            for (size_t i = 0; i < size; i++){
+                int a = i >= 3 ? row[i - 3] : 0;
+                int b = up[i];
+                int c = i >= 3 ? up[i - 3] : 0;
+                int x = row[i];
+                cost[0] += std::abs((int8_t) x);
+                cost[1] += std::abs((int8_t)(x - a));
+                cost[2] += std::abs((int8_t)(x - b));
+                cost[3] += std::abs((int8_t)(x - (a + b) / 2));
+                cost[4] += std::abs((int8_t)(x - paeth(a, b, c)));
+            }
+            int type = 0;
+            for (int t = 1; t < 5; t++){
+                if (cost[t] < cost[type]) type = t;
+            }
+            out[0] = type;
+            for (size_t i = 0; i < size; i++){
+                int a = i >= 3 ? row[i - 3] : 0;
+                int b = up[i];
+                int c = i >= 3 ? up[i - 3] : 0;
+                int predicted = 0;
+                if (type == 1) predicted = a;
+                else if (type == 2) predicted = b;
+                else if (type == 3) predicted = (a + b) / 2;
+                else if (type == 4) predicted = paeth(a, b, c);
+                out[i + 1] = row[i] - predicted;
+            }
+        }
+
+        static int paeth(int a, int b, int c){
+            int p = a + b - c;
+            int pa = std::abs(p - a);
+            int pb = std::abs(p - b);
+            int pc = std::abs(p - c);
+            if (pa <= pb && pa <= pc) return a;
+            if (pb <= pc) return b;
+            return c;
+        }
+
+        static void put32(uint8_t* p, uint32_t value){
+            p[0] = value >> 24;
+            p[1] = value >> 16;
+            p[2] = value >> 8;
+            p[3] = value;
+        }
+
+        static void chunk(BufferedWriter& out, const char* type, const uint8_t* data, size_t size){
+            out.write32(size);
+            out.write(type, 4);
+            if (size > 0){
+                out.write(data, size);
+            }
+            uint32_t crc = deflate::crc32((const uint8_t*) type, 4);
+            crc = deflate::crc32(data, size, crc);
+            out.write32(crc);
+        }
+
+    private:
+        int width = 0;
+        int height = 0;
+        size_t rowSize = 0;
+        ThreadPool* pool;
+        // last row of the previous strip, the up filters of a strip's first row need it
+        std::vector<uint8_t> previous;
+        // strips compressed together, those before pending are complete, pending is being filled
+        std::vector<Strip> batch;
+        uint32_t pending = 0;
+        int stripRows = 0;
+        uint32_t adler = 1;
+        bool first = true;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "rowencoder.h"
+#include <string>
+#include <algorithm>
+
+
+// binary 8 bit PPM, rows are stored top to bottom exactly as they arrive
+class PPMEncoder: public RowEncoder{
+    public:
+        void begin(BufferedWriter& out, int width, int height){
+            std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+            out.write(header.data(), header.size());
+        }
+
+        void rows(BufferedWriter& out, int, const Vec3* pixels, size_t size){
+            // converted in small blocks so the writer sees a few large copies
+            uint8_t block[3 * 1024];
+            for (size_t i = 0; i < size; i += 1024){
+                size_t count = std::min(size - i, (size_t) 1024);
+                for (size_t k = 0; k < count; k++){
+                    block[k * 3] = toByte(pixels[i + k].x);
+                    block[k * 3 + 1] = toByte(pixels[i + k].y);
+                    block[k * 3 + 2] = toByte(pixels[i + k].z);
+                }
+                out.write(block, count * 3);
+            }
+        }
+
+        void end(BufferedWriter&){
+        }
+};
+
+
+// little endian float PFM with colours scaled to 0-1
+// the format stores rows bottom to top, so each band is written at its own offset
+class PFMEncoder: public RowEncoder{
+    public:
+        void begin(BufferedWriter& out, int width_, int height_){
+            width = width_;
+            height = height_;
+            std::string header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+            out.write(header.data(), header.size());
+            headerSize = header.size();
+        }
+
+        void rows(BufferedWriter& out, int y, const Vec3* pixels, size_t size){
+            int bandRows = size / width;
+            uint64_t rowSize = (uint64_t) width * 3 * sizeof(float);
+            // the last row of the band is the first one in the file
+            out.seek(headerSize + (uint64_t)(height - y - bandRows) * rowSize);
+            for (int row = bandRows - 1; row >= 0; row--){
+                const Vec3* line = pixels + (size_t) row * width;
+                for (int x = 0; x < width; x++){
+                    float rgb[3] = {line[x].x / 255.0f, line[x].y / 255.0f, line[x].z / 255.0f};
+                    out.write(rgb, sizeof(rgb));
+                }
+            }
+        }
+
+        void end(BufferedWriter&){
+        }
+
+    private:
+        int width = 0;
+        int height = 0;
+        uint64_t headerSize = 0;
+};
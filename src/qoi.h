@@ -0,0 +1,123 @@
+#pragma once
+
+#include "rowencoder.h"
+#include <cstdint>
+
+// byte headers for QOI file
+const int QOI_OP_RUN   = 0xc0;
+const int QOI_OP_INDEX = 0x00;
+const int QOI_OP_DIFF  = 0x40;
+const int QOI_OP_LUMA  = 0x80;
+const int QOI_OP_RGB   = 0xfe;
+const int QOI_OP_RGBA  = 0xff;
+
+// every file ends in seven zero bytes and a one
+const uint8_t QOI_END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+
+// streaming QOI encoder following the specification, pixels are written as opaque RGB
+class QOIEncoder: public RowEncoder{
+    public:
+        void begin(BufferedWriter& out, int width, int height){
+            // write file headers
+            out.write32(0x716f6966);
+            out.write32(width);
+            out.write32(height);
+            out.put(3);
+            out.put(1);
+            for (uint32_t& entry: lookup){
+                entry = 0;
+            }
+            previous = rgba(0, 0, 0);
+            run_length = 0;
+        }
+
+        void rows(BufferedWriter& out, int, const Vec3* pixels, size_t size){
+            for (size_t i = 0; i < size; i++){
+                // the same input pixel always gives the same bytes, so runs skip the conversion
+                bool repeat = i > 0 && pixels[i] == pixels[i - 1];
+                uint8_t r = 0, g = 0, b = 0;
+                uint32_t colour = previous;
+                if (!repeat){
+                    r = toByte(pixels[i].x);
+                    g = toByte(pixels[i].y);
+                    b = toByte(pixels[i].z);
+                    colour = rgba(r, g, b);
+                }
+                if (colour == previous){
+                    // run length encoding
+                    run_length += 1;
+                    if (run_length == 62){
+                        out.put(QOI_OP_RUN | (run_length - 1));
+                        run_length = 0;
+                    }
+                    continue;
+                }
+                // write previous run length encoding
+                if (run_length > 0){
+                    out.put(QOI_OP_RUN | (run_length - 1));
+                    run_length = 0;
+                }
+                // check if we've already seen pixel
+                int key = getKey(r, g, b);
+                if (lookup[key] == colour){
+                    out.put(QOI_OP_INDEX | key);
+                }
+                else{
+                    lookup[key] = colour;
+                    // channel differences wrap around as in the decoder
+                    int8_t dr = r - channel(previous, 0);
+                    int8_t dg = g - channel(previous, 1);
+                    int8_t db = b - channel(previous, 2);
+                    int dr_dg = dr - dg;
+                    int db_dg = db - dg;
+                    // small difference of -2 to 1 in each colour channel
+                    if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1){
+                        out.put(QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+                    }
+                    // larger difference of -32 to 31 in green channel and -8 to 7 in red and blue channels
+                    else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7){
+                        out.put(QOI_OP_LUMA | (dg + 32));
+                        out.put(((dr_dg + 8) << 4) | (db_dg + 8));
+                    }
+                    else{
+                        // no encoding possible so write RGB header and RGB values
+                        out.put(QOI_OP_RGB);
+                        out.put(r);
+                        out.put(g);
+                        out.put(b);
+                    }
+                }
+                previous = colour;
+            }
+        }
+
+        void end(BufferedWriter& out){
+            // a run still open at the last pixel
+            if (run_length > 0){
+                out.put(QOI_OP_RUN | (run_length - 1));
+                run_length = 0;
+            }
+            out.write(QOI_END_MARKER, sizeof(QOI_END_MARKER));
+        }
+
+    private:
+        static uint32_t rgba(uint8_t r, uint8_t g, uint8_t b){
+            return (uint32_t) r << 24 | (uint32_t) g << 16 | (uint32_t) b << 8 | 255;
+        }
+
+        static uint8_t channel(uint32_t colour, int i){
+            return colour >> (24 - i * 8);
+        }
+
+        // index of a colour in the lookup table, alpha is always 255
+        static int getKey(uint8_t r, uint8_t g, uint8_t b){
+            return (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+        }
+
+    private:
+        // colours as rgba, zero marks an entry never written since alpha is always 255
+        uint32_t lookup[64];
+        uint32_t previous;
+        int run_length;
+};
@@ -17,7 +17,7 @@ class Ray{
             direction = Vec3(0);
         }
 
-        Vec3 attime(float t){
+        Vec3 attime(float t) const{
             return origin + direction * t;
         }
 
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "ray.h"
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RT_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+
+/*
+   a group of up to SIZE coherent rays, such as the primary rays of a 4x4 pixel block
+   origins and inverse directions are also kept as structure of arrays so a box can be
+   tested against four rays at a time, lanes not in use are left out of the valid mask
+*/
+struct RayPacket{
+    static constexpr int SIZE = 16;
+
+    alignas(16) float ox[SIZE], oy[SIZE], oz[SIZE];
+    alignas(16) float idx[SIZE], idy[SIZE], idz[SIZE];
+    Ray rays[SIZE];
+    uint32_t valid = 0;
+
+    void set(int lane, const Ray& ray){
+        rays[lane] = ray;
+        ox[lane] = ray.origin.x;
+        oy[lane] = ray.origin.y;
+        oz[lane] = ray.origin.z;
+        idx[lane] = ray.invDirection.x;
+        idy[lane] = ray.invDirection.y;
+        idz[lane] = ray.invDirection.z;
+        valid |= 1u << lane;
+    }
+
+    // bit mask of the valid rays entering the box before their tmax
+    uint32_t intersectBox(const Vec3& min, const Vec3& max, const float* tmax) const{
+        uint32_t mask = 0;
+#ifdef RT_X86_SIMD
+        const __m128 minx = _mm_set1_ps(min.x), miny = _mm_set1_ps(min.y), minz = _mm_set1_ps(min.z);
+        const __m128 maxx = _mm_set1_ps(max.x), maxy = _mm_set1_ps(max.y), maxz = _mm_set1_ps(max.z);
+        const __m128 zero = _mm_setzero_ps();
+        for (int i = 0; i < SIZE; i += 4){
+            if (((valid >> i) & 0xf) == 0) continue;
+            __m128 ix = _mm_load_ps(idx + i), iy = _mm_load_ps(idy + i), iz = _mm_load_ps(idz + i);
+            __m128 x0 = _mm_mul_ps(_mm_sub_ps(minx, _mm_load_ps(ox + i)), ix);
+            __m128 x1 = _mm_mul_ps(_mm_sub_ps(maxx, _mm_load_ps(ox + i)), ix);
+            __m128 y0 = _mm_mul_ps(_mm_sub_ps(miny, _mm_load_ps(oy + i)), iy);
+            __m128 y1 = _mm_mul_ps(_mm_sub_ps(maxy, _mm_load_ps(oy + i)), iy);
+            __m128 z0 = _mm_mul_ps(_mm_sub_ps(minz, _mm_load_ps(oz + i)), iz);
+            __m128 z1 = _mm_mul_ps(_mm_sub_ps(maxz, _mm_load_ps(oz + i)), iz);
+            __m128 tnear = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_min_ps(z0, z1));
+            __m128 tfar = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_max_ps(z0, z1));
+            __m128 hit = _mm_and_ps(_mm_cmpge_ps(tfar, tnear), _mm_cmpge_ps(tfar, zero));
+            hit = _mm_and_ps(hit, _mm_cmplt_ps(tnear, _mm_loadu_ps(tmax + i)));
+            mask |= (uint32_t)_mm_movemask_ps(hit) << i;
+        }
+#else
+        for (int i = 0; i < SIZE; i++){
+            if (!(valid & (1u << i))) continue;
+            Vec3 t0 = (min - rays[i].origin) * rays[i].invDirection;
+            Vec3 t1 = (max - rays[i].origin) * rays[i].invDirection;
+            float tnear = t0.min(t1).maxComponent();
+            float tfar = t0.max(t1).minComponent();
+            if (tfar >= tnear && tfar >= 0 && tnear < tmax[i]){
+                mask |= 1u << i;
+            }
+        }
+#endif
+        return mask & valid;
+    }
+};
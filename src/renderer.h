@@ -0,0 +1,656 @@
+#pragma once
+
+#include "scene.h"
+#include "material.h"
+#include "raypacket.h"
+#include "framebuffer.h"
+#include "imagewriter.h"
+#include "threadpool.h"
+#include "sampler.h"
+#include "stats.h"
+#include "arena.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <cmath>
+
+
+// size of the square tiles handed out to the render threads
+const int TILE_SIZE = 32;
+
+// side length of the pixel blocks traced together as one ray packet
+const int PACKET_SIZE = 4;
+static_assert(PACKET_SIZE * PACKET_SIZE == RayPacket::SIZE, "a pixel block must fill a ray packet");
+
+
+// rays traced by a render, counted per thread
+struct RayCounts{
+    // camera rays
+    uint64_t primary = 0;
+    // rays towards the light
+    uint64_t shadow = 0;
+    // rays leaving a surface, refracted or reflected
+    uint64_t secondary = 0;
+
+    uint64_t total() const{
+        return primary + shadow + secondary;
+    }
+
+    RayCounts& operator+=(const RayCounts& other){
+        primary += other.primary;
+        shadow += other.shadow;
+        secondary += other.secondary;
+        return *this;
+    }
+};
+
+
+Vec3 trace(const Ray& ray, const RenderScene& world, int depth, RayCounts& rays);
+
+Ray shadowRay(const Intersection& inter, const Vec3& light, float& distance){
+    Vec3 l = (light - inter.point);
+    float rs = l.lengthsquared();
+    l.normalise();
+    distance = sqrt(rs);
+    return Ray(inter.point + l * 0.0001f, l);
+}
+
+// colour of a hit once its shadow ray has been traced
+Vec3 shade(const Ray& ray, Intersection& inter, bool shadowed, const RenderScene& world, int depth, RayCounts& rays){
+    if (shadowed){
+        return Vec3(0, 0, 0);
+    }
+    STATS_COUNT(Shaded);
+    Ray transmitted;
+    Vec3 col;
+    // deal with transmission (refraction, reflection)
+    if (inter.material->transmit(ray, inter, col, transmitted, world)){
+        // the last bounce is never traced
+        if (depth > 1) rays.secondary++;
+        return trace(transmitted, world, depth - 1, rays);
+    }
+    return col;
+}
+
+Vec3 trace(const Ray& ray, const RenderScene& world, int depth, RayCounts& rays){
+    if (depth <= 0) return Vec3(0, 0, 0);
+    STATS_BOUNCE(1);
+
+    Intersection inter;
+    if (world.intersection(ray, inter)){
+        float distance;
+        Ray shadow = shadowRay(inter, world.light, distance);
+        rays.shadow++;
+        return shade(ray, inter, world.occluded(shadow, distance), world, depth, rays);
+    }
+    return Vec3(0);
+}
+
+// traces a packet of primary rays together, then their shadow rays as a second packet,
+// the secondary rays have nothing in common anymore and are traced one by one
+void tracePacket(const RayPacket& packet, const RenderScene& world, int depth, Vec3* colours, RayCounts& rays){
+    STATS_BOUNCE(__builtin_popcount(packet.valid));
+    Intersection inter[RayPacket::SIZE];
+    uint32_t hit = world.intersection(packet, inter);
+
+    RayPacket shadows;
+    float distance[RayPacket::SIZE];
+    for (uint32_t bits = hit; bits; bits &= bits - 1){
+        int i = __builtin_ctz(bits);
+        shadows.set(i, shadowRay(inter[i], world.light, distance[i]));
+    }
+    uint32_t shadowed = hit ? world.occluded(shadows, distance) : 0;
+    rays.shadow += __builtin_popcount(hit);
+
+    for (int i = 0; i < RayPacket::SIZE; i++){
+        uint32_t bit = 1u << i;
+        colours[i] = (hit & bit) ? shade(packet.rays[i], inter[i], shadowed & bit, world, depth, rays) : Vec3(0);
+    }
+}
+
+// colour ramp for the sample heatmap, black through blue, red and yellow to white as value goes from 0 to 1
+Vec3 heat(float value){
+    static const Vec3 stops[] = {Vec3(0, 0, 0), Vec3(0, 0, 255), Vec3(255, 0, 0), Vec3(255, 255, 0), Vec3(255, 255, 255)};
+    float t = std::min(std::max(value, 0.0f), 1.0f) * 4;
+    int i = std::min((int) t, 3);
+    return stops[i] + (stops[i + 1] - stops[i]) * (t - i);
+}
+
+
+// how an image is sampled
+struct RenderSettings{
+    int width = 2560;
+    int height = 1440;
+    // the image spans tan(fov) above and below its centre
+    float fov = M_PI / 3;
+    // most bounces a path takes
+    int depth = 20;
+    // samples per pixel, stratified over the pixel
+    int spp = 9;
+    // spreads the samples over the output pixels
+    Filter filter;
+    // primary and shadow rays are traced as packets unless --no-packets asks for single rays
+    bool packets = true;
+    // adaptive sampling: every pixel gets minSpp samples, then pixels whose estimated error is above
+    // threshold (a fraction of the 0-255 range) keep doubling their samples up to maxSpp
+    bool adaptive = false;
+    int minSpp = 4;
+    int maxSpp = 64;
+    float threshold = 0.01f;
+    // progressive rendering: passes over the whole image until spp samples per pixel or timeBudget
+    // seconds (0 for no limit) are reached, with a snapshot every snapshotInterval seconds (0 for none)
+    bool progressive = false;
+    float timeBudget = 0;
+    float snapshotInterval = 0;
+};
+
+// a sample at image position x, y in pixels
+struct TileSample{
+    float x;
+    float y;
+    Vec3 colour;
+};
+
+// what a render thread keeps about the tile it is working on
+struct TileState{
+    int tx, ty;
+    int x0, y0, x1, y1;
+    // image position of the first pixel of samples
+    int left, top;
+    // filtered samples of the tile and the border they spill into
+    Accumulator samples;
+    // samples taken so far and samples wanted after the next round, per pixel
+    std::vector<int> count;
+    std::vector<int> target;
+    // running mean and sum of squared differences of the sample luminance (Welford)
+    std::vector<float> mean;
+    std::vector<float> m2;
+    // adaptive samples of the tile, filtered once every pixel has its final count,
+    // kept in the thread's arena, which holds the scratch of the tile being rendered
+    ScratchArray<TileSample> taken;
+    // rays traced by the thread since the render started
+    RayCounts rays;
+    // bytes held by the thread's arena when the render started
+    size_t scratchBytes = 0;
+
+    int index(int x, int y) const{
+        return (y - y0) * TILE_SIZE + (x - x0);
+    }
+};
+
+
+/*
+   renders a RenderScene tile by tile on a thread pool
+   each tile filters its samples into a buffer of its own that is reach pixels larger on every side,
+   then adds that buffer to the shared accumulator under the locks of the tiles it overlaps,
+   so memory stays proportional to the output resolution whatever the sample count
+*/
+class Renderer{
+    public:
+        Renderer(const RenderScene& world_, const RenderSettings& settings_, ThreadPool& pool_):
+            world(world_), settings(settings_), pool(pool_), filter(settings_.filter){
+            width = settings.width;
+            height = settings.height;
+            reach = filter.reach();
+            invWidth = 1/(width + 0.0);
+            invHeight = 1/(height + 0.0);
+            ratio = width/(height + 0.0);
+            angle = tan(settings.fov);
+            // camera frame, looking down -z with y up unless the scene turns it
+            Vec3 direction = world.cameraDirection;
+            forward = direction.normalise();
+            right = forward.cross(world.cameraUp).normalise();
+            up = right.cross(forward);
+            tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+            tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+            tileLocks.reset(new std::mutex[tilesX * tilesY]);
+            bandTiles.reset(new std::atomic<int>[tilesY]);
+            bandResolved.reset(new std::atomic<bool>[tilesY]);
+            accumulator = Accumulator(width, height);
+            states.resize(pool.size());
+            for (TileState& state: states){
+                state.samples = Accumulator(TILE_SIZE + 2 * reach, TILE_SIZE + 2 * reach);
+                state.count.resize(TILE_SIZE * TILE_SIZE);
+                state.target.resize(TILE_SIZE * TILE_SIZE);
+                state.mean.resize(TILE_SIZE * TILE_SIZE);
+                state.m2.resize(TILE_SIZE * TILE_SIZE);
+            }
+        }
+
+        /*
+           renders the image in one go and hands every finished band of tiles to the encoder
+           a band is resolved into image once it and the bands next to it are done, as those spill into it
+           with adaptive sampling the tile keeps going over its noisy pixels, heatmap (if not null)
+           then shows the samples each pixel got, returns the number of samples taken
+        */
+        uint64_t render(Framebuffer& image, ImageEncoder& encoder, Framebuffer* heatmap = nullptr){
+            STATS_TIME(Render);
+            adaptive = settings.adaptive;
+            openEnded = settings.adaptive;
+            reset();
+            int tiles = tilesX * tilesY;
+            int spp = std::max(settings.spp, 1);
+            int minSpp = std::max(settings.minSpp, 1);
+            int maxSpp = std::max(settings.maxSpp, minSpp);
+            std::atomic<int> finished(0);
+            std::atomic<uint64_t> totalSamples(0);
+            for (int i = 0; i < tilesY; i++){
+                bandTiles[i] = 0;
+                bandResolved[i] = false;
+            }
+            auto bandDone = [&](int band){
+                return band < 0 || band >= tilesY || bandTiles[band] == tilesX;
+            };
+
+            pool.parallelFor(tiles, [&](uint32_t tile, unsigned thread){
+                STATS_TIME(Tile);
+                STATS_ALLOCATIONS(TileAllocations);
+                TileState& state = beginTile(thread, tile, 0, settings.adaptive ? minSpp : spp);
+                sampleTile(state);
+                if (settings.adaptive){
+                    refineTile(state, maxSpp);
+                }
+                uint64_t taken = 0;
+                for (int y = state.y0; y < state.y1; y++){
+                    for (int x = state.x0; x < state.x1; x++){
+                        int n = state.count[state.index(x, y)];
+                        taken += n;
+                        if (heatmap){
+                            heatmap->at(x, y) = heat(std::log2((float) n) / std::log2(std::max(settings.adaptive ? maxSpp : spp, 2)));
+                        }
+                    }
+                }
+                totalSamples += taken;
+                mergeTile(state);
+
+                // the last tile a band waits for resolves it and sends its rows off to be written
+                if (++bandTiles[state.ty] == tilesX){
+                    int spill = reach > 0 ? 1 : 0;
+                    for (int band = std::max(state.ty - spill, 0); band <= std::min(state.ty + spill, tilesY - 1); band++){
+                        if (!bandDone(band - spill) || !bandDone(band) || !bandDone(band + spill)) continue;
+                        if (bandResolved[band].exchange(true)) continue;
+                        int r0 = band * TILE_SIZE;
+                        int r1 = std::min(r0 + TILE_SIZE, height);
+                        resolve(image, r0, r1);
+                        encoder.push(r0, r1 - r0, &image.at(0, r0));
+                    }
+                }
+                // update user on render progress
+                int done = ++finished;
+                if (done * 10 / tiles != (done - 1) * 10 / tiles){
+                    std::cout << "Rendering: " << (done * 100) / tiles << "%" << std::endl;
+                }
+            });
+            return totalSamples;
+        }
+
+        /*
+           renders passes over the whole image, the first with one sample per pixel and every later one
+           doubling the samples so far, until settings.spp or the time budget is reached
+           a pass is kept shorter than a snapshot interval and the time left in the budget,
+           tiles not started when the budget runs out keep the samples of the earlier passes
+           snapshots and the final image are all written to output, the renderer must outlive the
+           encoder's work on them, returns the number of samples taken
+        */
+        uint64_t renderProgressive(const std::string& output, ImageEncoder& encoder){
+            STATS_TIME(Render);
+            using clock = std::chrono::steady_clock;
+            adaptive = false;
+            openEnded = true;
+            reset();
+            int tiles = tilesX * tilesY;
+            int spp = std::max(settings.spp, 1);
+            auto start = clock::now();
+            auto elapsed = [&]{
+                return std::chrono::duration<double>(clock::now() - start).count();
+            };
+            auto outOfTime = [&]{
+                return settings.timeBudget > 0 && elapsed() >= settings.timeBudget;
+            };
+            // the encoder holds at most capacity images, so a ring of that many snapshots
+            // never resolves into one that is still being written
+            snapshots.resize(encoder.capacity());
+            int written = 0;
+            auto snapshot = [&]{
+                encoder.open(output, width, height);
+                Framebuffer& image = snapshots[written++ % snapshots.size()];
+                if (image.pixels.empty()){
+                    image = Framebuffer(width, height);
+                }
+                resolve(image, 0, height);
+                encoder.push(0, height, image.pixels.data());
+            };
+
+            uint64_t totalSamples = 0;
+            int done = 0;
+            double secondsPerSample = 0;
+            double nextSnapshot = settings.snapshotInterval;
+            for (int pass = 1; done < spp; pass++){
+                double now = elapsed();
+                if (pass > 1 && outOfTime()) break;
+                int count = std::min(std::max(done, 1), spp - done);
+                if (pass > 1){
+                    // no longer than a snapshot interval or the time left
+                    double limit = 1e30;
+                    if (settings.snapshotInterval > 0){
+                        limit = settings.snapshotInterval;
+                    }
+                    if (settings.timeBudget > 0){
+                        limit = std::min(limit, settings.timeBudget - now);
+                    }
+                    double fits = limit / secondsPerSample;
+                    if (fits < count){
+                        count = std::max((int) fits, 1);
+                    }
+                    // the sequence is stratified over runs of a power of two samples
+                    while (count & (count - 1)){
+                        count &= count - 1;
+                    }
+                }
+                std::atomic<bool> cut(false);
+                std::atomic<uint64_t> passSamples(0);
+                pool.parallelFor(tiles, [&](uint32_t tile, unsigned thread){
+                    // the first pass always finishes, so every pixel has a sample
+                    if (pass > 1 && outOfTime()){
+                        cut = true;
+                        return;
+                    }
+                    STATS_TIME(Tile);
+                    STATS_ALLOCATIONS(TileAllocations);
+                    TileState& state = beginTile(thread, tile, done, done + count);
+                    sampleTile(state);
+                    passSamples += (uint64_t) (state.x1 - state.x0) * (state.y1 - state.y0) * count;
+                    mergeTile(state);
+                });
+                secondsPerSample = (elapsed() - now) / count;
+                done += count;
+                totalSamples += passSamples;
+                std::cout << "Pass " << pass << ": " << done << " spp after " << (int) (elapsed() * 1000) << "ms" << (cut ? ", cut short by the time budget" : "") << std::endl;
+                if (cut) break;
+                if (settings.snapshotInterval > 0 && elapsed() >= nextSnapshot && done < spp && !outOfTime()){
+                    snapshot();
+                    while (nextSnapshot <= elapsed()){
+                        nextSnapshot += settings.snapshotInterval;
+                    }
+                }
+            }
+            snapshot();
+            return totalSamples;
+        }
+
+        // rays traced by the last render, by kind
+        RayCounts rays() const{
+            RayCounts total;
+            for (const TileState& state: states){
+                total += state.rays;
+            }
+            return total;
+        }
+
+    private:
+        // forgets the samples and counts of an earlier render
+        void reset(){
+            accumulator.clear();
+            for (TileState& state: states){
+                state.rays = RayCounts();
+            }
+            shareScratch();
+        }
+
+        // grows the arena of every thread to the largest any of them holds, so once every tile has
+        // been rendered on some thread no tile allocates, whichever thread it lands on next time
+        void shareScratch(){
+            pool.forEachThread([&](unsigned thread){
+                Arena& scratch = Arena::local();
+                scratch.reset();
+                states[thread].scratchBytes = scratch.capacity();
+            });
+            size_t largest = 0;
+            for (const TileState& state: states){
+                largest = std::max(largest, state.scratchBytes);
+            }
+            pool.forEachThread([&](unsigned){
+                Arena::local().reserve(largest);
+            });
+        }
+
+        // ray through the image position sx, sy in pixels
+        Ray primaryRay(float sx, float sy) const{
+            float xd = (2 * (sx * invWidth) - 1) * angle * ratio;
+            float yd = (1 - 2 * (sy * invHeight)) * angle;
+            return Ray(world.camera, (right * xd + up * yd + forward).normalise());
+        }
+
+        // when the sample count of a pixel is not known up front the samples come from an open ended sequence
+        void samplePosition(int x, int y, int k, float& u, float& v) const{
+            if (openEnded){
+                sequenceSample(x, y, k, u, v);
+            }
+            else{
+                stratifiedSample(x, y, k, std::max(settings.spp, 1), u, v);
+            }
+        }
+
+        // readies the thread's tile state to take samples first to target of every pixel in tile
+        TileState& beginTile(unsigned thread, uint32_t tile, int first, int target){
+            TileState& state = states[thread];
+            state.tx = tile % tilesX;
+            state.ty = tile / tilesX;
+            state.x0 = state.tx * TILE_SIZE;
+            state.y0 = state.ty * TILE_SIZE;
+            state.x1 = std::min(state.x0 + TILE_SIZE, width);
+            state.y1 = std::min(state.y0 + TILE_SIZE, height);
+            state.left = state.x0 - reach;
+            state.top = state.y0 - reach;
+            state.samples.clear();
+            Arena& scratch = Arena::local();
+            scratch.reset();
+            state.taken.start(scratch);
+            for (int y = state.y0; y < state.y1; y++){
+                for (int x = state.x0; x < state.x1; x++){
+                    int i = state.index(x, y);
+                    state.count[i] = first;
+                    state.target[i] = target;
+                    state.mean[i] = 0;
+                    state.m2[i] = 0;
+                }
+            }
+            return state;
+        }
+
+        // filters a sample taken at sx, sy into the tile
+        void splat(TileState& state, float sx, float sy, const Vec3& colour, float scale) const{
+            int px0 = std::max((int) std::ceil(sx - 0.5f - filter.radius), 0);
+            int py0 = std::max((int) std::ceil(sy - 0.5f - filter.radius), 0);
+            int px1 = std::min((int) std::floor(sx - 0.5f + filter.radius), width - 1);
+            int py1 = std::min((int) std::floor(sy - 0.5f + filter.radius), height - 1);
+            // the filter is separable, so each axis is evaluated once per pixel row and column
+            float wx[Filter::MAX_SPAN];
+            for (int px = px0; px <= px1; px++){
+                wx[px - px0] = filter.weight(px + 0.5f - sx) * scale;
+            }
+            for (int py = py0; py <= py1; py++){
+                float wy = filter.weight(py + 0.5f - sy);
+                if (wy == 0) continue;
+                for (int px = px0; px <= px1; px++){
+                    if (wx[px - px0] != 0){
+                        state.samples.add(px - state.left, py - state.top, colour, wx[px - px0] * wy);
+                    }
+                }
+            }
+        }
+
+        // takes a sample of pixel x, y, adaptive samples update the pixel's statistics and are kept
+        // until the pixel's final count is known
+        void record(TileState& state, int x, int y, float sx, float sy, const Vec3& colour) const{
+            Vec3 clamped = colour.clamp(0, 255);
+            int i = state.index(x, y);
+            state.count[i]++;
+            if (!adaptive){
+                splat(state, sx, sy, clamped, 1);
+                return;
+            }
+            state.taken.push_back({sx, sy, clamped});
+            float luminance = 0.2126f * clamped.x + 0.7152f * clamped.y + 0.0722f * clamped.z;
+            float delta = luminance - state.mean[i];
+            state.mean[i] += delta / state.count[i];
+            state.m2[i] += delta * (luminance - state.mean[i]);
+        }
+
+        // takes every pixel of the tile from its sample count up to its target
+        void sampleTile(TileState& state) const{
+            if (settings.packets){
+                for (int by = state.y0; by < state.y1; by += PACKET_SIZE){
+                    for (int bx = state.x0; bx < state.x1; bx += PACKET_SIZE){
+                        int first[RayPacket::SIZE];
+                        int rounds = 0;
+                        for (int i = 0; i < RayPacket::SIZE; i++){
+                            int x = bx + i % PACKET_SIZE;
+                            int y = by + i / PACKET_SIZE;
+                            first[i] = 0;
+                            if (x < state.x1 && y < state.y1){
+                                first[i] = state.count[state.index(x, y)];
+                                rounds = std::max(rounds, state.target[state.index(x, y)] - first[i]);
+                            }
+                        }
+                        // one packet per sample index keeps the rays of a packet close together
+                        for (int j = 0; j < rounds; j++){
+                            RayPacket packet;
+                            float sx[RayPacket::SIZE];
+                            float sy[RayPacket::SIZE];
+                            for (int i = 0; i < RayPacket::SIZE; i++){
+                                int x = bx + i % PACKET_SIZE;
+                                int y = by + i / PACKET_SIZE;
+                                if (x < state.x1 && y < state.y1 && first[i] + j < state.target[state.index(x, y)]){
+                                    float u, v;
+                                    samplePosition(x, y, first[i] + j, u, v);
+                                    sx[i] = x + u;
+                                    sy[i] = y + v;
+                                    packet.set(i, primaryRay(sx[i], sy[i]));
+                                }
+                            }
+                            Vec3 colours[RayPacket::SIZE];
+                            state.rays.primary += __builtin_popcount(packet.valid);
+                            tracePacket(packet, world, settings.depth, colours, state.rays);
+                            for (uint32_t bits = packet.valid; bits; bits &= bits - 1){
+                                int i = __builtin_ctz(bits);
+                                record(state, bx + i % PACKET_SIZE, by + i / PACKET_SIZE, sx[i], sy[i], colours[i]);
+                            }
+                        }
+                    }
+                }
+            }
+            else{
+                for (int y = state.y0; y < state.y1; y++){
+                    for (int x = state.x0; x < state.x1; x++){
+                        for (int k = state.count[state.index(x, y)]; k < state.target[state.index(x, y)]; k++){
+                            float u, v;
+                            samplePosition(x, y, k, u, v);
+                            state.rays.primary++;
+                            record(state, x, y, x + u, y + v, trace(primaryRay(x + u, y + v), world, settings.depth, state.rays));
+                        }
+                    }
+                }
+            }
+        }
+
+        // keeps doubling the samples of noisy pixels until they settle or reach maxSpp
+        void refineTile(TileState& state, int maxSpp) const{
+            // error allowed on the mean of a pixel, squared to compare with its variance
+            float tolerance = settings.threshold * 255 * settings.threshold * 255;
+            // a pixel is noisy while the variance of its mean is above the tolerance, the pixels next
+            // to a noisy one keep sampling too, as a few samples can all miss a thin feature
+            auto noisy = [&](int x, int y){
+                int i = state.index(x, y);
+                int n = state.count[i];
+                return n < 2 || state.m2[i] / ((n - 1) * (float) n) > tolerance;
+            };
+            while (true){
+                bool refine = false;
+                for (int y = state.y0; y < state.y1; y++){
+                    for (int x = state.x0; x < state.x1; x++){
+                        int i = state.index(x, y);
+                        state.target[i] = state.count[i];
+                        if (state.count[i] >= maxSpp) continue;
+                        bool near = false;
+                        for (int ny = std::max(y - 1, state.y0); ny <= std::min(y + 1, state.y1 - 1) && !near; ny++){
+                            for (int nx = std::max(x - 1, state.x0); nx <= std::min(x + 1, state.x1 - 1) && !near; nx++){
+                                near = noisy(nx, ny);
+                            }
+                        }
+                        if (near){
+                            state.target[i] = std::min(state.count[i] * 2, maxSpp);
+                            refine = true;
+                        }
+                    }
+                }
+                if (!refine) break;
+                sampleTile(state);
+            }
+            // a sample counts for its share of its pixel, otherwise the densely sampled pixels would
+            // outweigh their neighbours wherever the filter overlaps them
+            for (const TileSample& sample: state.taken){
+                splat(state, sample.x, sample.y, sample.colour, 1.0f / state.count[state.index((int) sample.x, (int) sample.y)]);
+            }
+        }
+
+        // adds the tile and its border to every tile it overlaps
+        void mergeTile(const TileState& state){
+            const Accumulator& samples = state.samples;
+            for (int ny = std::max(state.ty - 1, 0); ny <= std::min(state.ty + 1, tilesY - 1); ny++){
+                for (int nx = std::max(state.tx - 1, 0); nx <= std::min(state.tx + 1, tilesX - 1); nx++){
+                    int mx0 = std::max(nx * TILE_SIZE, state.left);
+                    int my0 = std::max(ny * TILE_SIZE, state.top);
+                    int mx1 = std::min({(nx + 1) * TILE_SIZE, width, state.left + samples.width});
+                    int my1 = std::min({(ny + 1) * TILE_SIZE, height, state.top + samples.height});
+                    if (mx0 >= mx1 || my0 >= my1) continue;
+                    std::lock_guard<std::mutex> lock(tileLocks[ny * tilesX + nx]);
+                    accumulator.merge(samples, state.left, state.top, mx0, my0, mx1, my1);
+                }
+            }
+        }
+
+        // filtered colours of rows [y0, y1)
+        void resolve(Framebuffer& image, int y0, int y1) const{
+            for (int y = y0; y < y1; y++){
+                for (int x = 0; x < width; x++){
+                    image.at(x, y) = accumulator.resolve(x, y);
+                }
+            }
+        }
+
+    private:
+        const RenderScene& world;
+        RenderSettings settings;
+        ThreadPool& pool;
+        Filter filter;
+        int width;
+        int height;
+        int reach;
+        float invWidth;
+        float invHeight;
+        float ratio;
+        float angle;
+        Vec3 forward;
+        Vec3 right;
+        Vec3 up;
+        int tilesX;
+        int tilesY;
+        std::unique_ptr<std::mutex[]> tileLocks;
+        // tiles finished per band and bands handed to the encoder, for render
+        std::unique_ptr<std::atomic<int>[]> bandTiles;
+        std::unique_ptr<std::atomic<bool>[]> bandResolved;
+        Accumulator accumulator;
+        std::vector<TileState> states;
+        // images handed to the encoder by renderProgressive
+        std::vector<Framebuffer> snapshots;
+        // tiles refine their noisy pixels
+        bool adaptive = false;
+        // samples come from the open ended sequence instead of the fixed grid
+        bool openEnded = false;
+};
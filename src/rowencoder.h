@@ -0,0 +1,23 @@
+#pragma once
+
+#include "vector.h"
+#include "bufferedwriter.h"
+
+
+/*
+   encodes an image handed over in bands of whole rows, pixels are colours in the 0-255 range
+   rows(out, y, pixels, size) gets size pixels making up whole rows starting at row y,
+   bands arrive top to bottom, each directly following the previous one
+*/
+class RowEncoder{
+    public:
+        virtual ~RowEncoder(){}
+        virtual void begin(BufferedWriter& out, int width, int height) = 0;
+        virtual void rows(BufferedWriter& out, int y, const Vec3* pixels, size_t size) = 0;
+        virtual void end(BufferedWriter& out) = 0;
+};
+
+
+inline uint8_t toByte(float value){
+    return value <= 0 ? 0 : (value >= 255 ? 255 : (uint8_t) value);
+}
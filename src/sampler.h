@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <algorithm>
+
+
+// integer hash from the PCG family, good enough to turn pixel coordinates into random numbers
+inline uint32_t hashSample(uint32_t value){
+    uint32_t state = value * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// float in [0, 1) from the top 24 bits of a hash
+inline float toUnit(uint32_t hash){
+    return (hash >> 8) * (1.0f / 16777216.0f);
+}
+
+/*
+   position of sample k out of n inside pixel (x, y), u and v in [0, 1)
+   the pixel is cut into a grid of at least n strata and every sample is jittered inside its own stratum
+   when the grid has more cells than samples the pixel picks which ones stay empty
+   the random numbers only depend on the pixel and k, so an image does not change with the thread count
+   a single sample goes through the pixel centre
+*/
+inline void stratifiedSample(int x, int y, int k, int n, float& u, float& v){
+    if (n <= 1){
+        u = 0.5f;
+        v = 0.5f;
+        return;
+    }
+    int columns = (int) std::ceil(std::sqrt((float) n));
+    int rows = (n + columns - 1) / columns;
+    uint32_t pixel = hashSample((uint32_t) x * 73856093u ^ (uint32_t) y * 19349663u);
+    int cell = (k + pixel % (columns * rows)) % (columns * rows);
+    uint32_t jitter = hashSample(pixel + k);
+    u = (cell % columns + toUnit(jitter)) / columns;
+    v = (cell / columns + toUnit(hashSample(jitter))) / rows;
+    // float rounding can land exactly on the far edge
+    u = std::min(u, 0.99999994f);
+    v = std::min(v, 0.99999994f);
+}
+
+
+/*
+   sample k of an open ended sequence inside pixel (x, y), u and v in [0, 1)
+   the first two dimensions of Sobol's sequence, XOR scrambled with random bits per pixel,
+   every power of two samples from the start is stratified over the pixel, so samples can be
+   added a few at a time when it is not known up front how many a pixel will get
+*/
+inline void sequenceSample(int x, int y, uint32_t k, float& u, float& v){
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for (uint32_t bit = 1u << 31, direction = 1u << 31; k; k >>= 1, bit >>= 1, direction ^= direction >> 1){
+        if (k & 1){
+            a ^= bit;
+            b ^= direction;
+        }
+    }
+    uint32_t scramble = hashSample((uint32_t) x * 73856093u ^ (uint32_t) y * 19349663u);
+    u = toUnit(a ^ scramble);
+    v = toUnit(b ^ hashSample(scramble));
+}
+
+
+enum class FilterType{
+    Box,
+    Tent,
+    Gaussian,
+    Mitchell
+};
+
+/*
+   separable reconstruction filter, every sample is spread over the pixels whose centres are closer than radius
+   box keeps samples inside their pixel, the others blend into the neighbours for smoother edges,
+   mitchell has negative lobes and keeps edges the sharpest
+*/
+class Filter{
+    public:
+        Filter(FilterType type_ = FilterType::Gaussian){
+            type = type_;
+            switch (type){
+                case FilterType::Box: radius = 0.5f; break;
+                case FilterType::Tent: radius = 1; break;
+                case FilterType::Gaussian: radius = 1.5f; break;
+                case FilterType::Mitchell: radius = 2; break;
+            }
+            // a Gaussian that reaches zero at the radius instead of having a step there
+            gaussianEdge = std::exp(-radius * radius / (2 * SIGMA * SIGMA));
+            // every sample needs a weight for each pixel it reaches, a table saves the exp and the branches
+            tableScale = TABLE_SIZE / radius;
+            for (int i = 0; i < TABLE_SIZE; i++){
+                table[i] = evaluate((i + 0.5f) / tableScale);
+            }
+        }
+
+        // false if the name is not one of box, tent, gaussian or mitchell
+        static bool parse(const std::string& name, FilterType& type){
+            if (name == "box") type = FilterType::Box;
+            else if (name == "tent") type = FilterType::Tent;
+            else if (name == "gaussian") type = FilterType::Gaussian;
+            else if (name == "mitchell") type = FilterType::Mitchell;
+            else return false;
+            return true;
+        }
+
+        // weight of a sample dx, dy pixels away from a pixel centre
+        float weight(float dx, float dy) const{
+            return weight(dx) * weight(dy);
+        }
+
+        // weight along one axis, the filter is the product of the two axes
+        float weight(float d) const{
+            int i = (int)(std::fabs(d) * tableScale);
+            return i < TABLE_SIZE ? table[i] : 0;
+        }
+
+        // how many pixels a sample can reach past the pixel it was taken in
+        int reach() const{
+            return (int) std::ceil(radius + 0.5f) - 1;
+        }
+
+    private:
+        float evaluate(float d) const{
+            if (d >= radius) return 0;
+            switch (type){
+                case FilterType::Box: return 1;
+                case FilterType::Tent: return 1 - d;
+                case FilterType::Gaussian: return std::exp(-d * d / (2 * SIGMA * SIGMA)) - gaussianEdge;
+                case FilterType::Mitchell: return mitchell(d);
+            }
+            return 0;
+        }
+
+        // Mitchell-Netravali with B = C = 1/3
+        static float mitchell(float d){
+            const float B = 1 / 3.0f;
+            const float C = 1 / 3.0f;
+            if (d < 1){
+                return ((12 - 9 * B - 6 * C) * d * d * d + (-18 + 12 * B + 6 * C) * d * d + (6 - 2 * B)) / 6;
+            }
+            return ((-B - 6 * C) * d * d * d + (6 * B + 30 * C) * d * d + (-12 * B - 48 * C) * d + (8 * B + 24 * C)) / 6;
+        }
+
+    public:
+        // most pixels a sample can reach along one axis, for the widest filter
+        static constexpr int MAX_SPAN = 5;
+        FilterType type;
+        float radius;
+
+    private:
+        static constexpr float SIGMA = 0.5f;
+        static constexpr int TABLE_SIZE = 256;
+        float gaussianEdge;
+        float tableScale;
+        float table[TABLE_SIZE];
+};
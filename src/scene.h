@@ -6,6 +6,8 @@
 #include <memory>
 #include "ray.h"
 #include "observables.h"
+#include "bvh.h"
+#include "stats.h"
 
 
 class Scene{
@@ -13,9 +15,16 @@ class Scene{
         std::vector<std::shared_ptr<Observable>> objects;
         Vec3 light;
         Vec3 camera;
+        // where the camera looks and which way is up in the image
+        Vec3 cameraDirection = Vec3(0, 0, -1);
+        Vec3 cameraUp = Vec3(0, 1, 0);
 
         Scene(){}
 
+        void lookAt(const Vec3& target){
+            cameraDirection = target - camera;
+        }
+
         void addObject(std::shared_ptr<Observable> object){
             objects.push_back(object);
         }
@@ -23,19 +32,185 @@ class Scene{
         void clear(){
             objects.clear();
         }
+};
+
+
+/*
+   immutable scene used while rendering, built once from a Scene
+   holds plain pointers so nothing is reference counted on the hot path,
+   the Scene it was built from must outlive it
+   bounded objects sit in a top level BVH over their world boxes, objects without bounds
+   such as planes are tested on every ray
+*/
+class RenderScene{
+    public:
+        RenderScene(const Scene& scene){
+            STATS_TIME(SceneBuild);
+            std::vector<Vec3> mins, maxs;
+            for (uint32_t i = 0; i < scene.objects.size(); i++){
+                const auto& object = scene.objects[i];
+                objects.push_back(object.get());
+                materials.push_back(object->material.get());
+                Vec3 min, max;
+                if (!object->bounds(min, max)){
+                    unbounded.push_back(i);
+                }
+                else if (min <= max){
+                    bounded.push_back(i);
+                    mins.push_back(min);
+                    maxs.push_back(max);
+                }
+            }
+            top.build(mins, maxs);
+            light = scene.light;
+            camera = scene.camera;
+            cameraDirection = scene.cameraDirection;
+            cameraUp = scene.cameraUp;
+        }
 
-        bool intersection(Ray& ray, Intersection& inter) const{
+        bool intersection(const Ray& ray, Intersection& inter) const{
             Intersection temp;
             temp.timestep = inter.timestep;
-            bool contact = false;
-            for (int i = 0; i < objects.size(); i++){
+            int closest = -1;
+            for (uint32_t i: unbounded){
                 if (objects[i]->intersection(ray, temp)){
-                    contact = true;
-                    inter = temp;
-                    inter.sceneIndex = i;
-                    inter.material = objects[i]->material;
+                    closest = i;
                 }
             }
+            if (!top.empty()){
+                top.traverse(ray, 0, temp.timestep, [&](const BVHNode& leaf){
+                    bool found = false;
+                    for (uint32_t k = leaf.leftFirst; k < leaf.leftFirst + leaf.count; k++){
+                        uint32_t i = bounded[top.triIndices[k]];
+                        if (objects[i]->intersection(ray, temp)){
+                            closest = i;
+                            found = true;
+                        }
+                    }
+                    return found;
+                });
+            }
+            STATS_COUNT(ClosestRays);
+            if (closest < 0) return false;
+            STATS_COUNT(ClosestHits);
+            inter = temp;
+            inter.sceneIndex = closest;
+            inter.material = materials[closest];
+            return true;
+        }
+
+        // closest hits for a packet, returns a bit mask of the rays that hit anything
+        uint32_t intersection(const RayPacket& packet, Intersection* inter) const{
+            Intersection temp[RayPacket::SIZE];
+            float tmax[RayPacket::SIZE];
+            for (int i = 0; i < RayPacket::SIZE; i++){
+                temp[i].timestep = inter[i].timestep;
+            }
+            uint32_t contact = 0;
+            auto test = [&](uint32_t i){
+                uint32_t found = objects[i]->intersection(packet, temp);
+                for (uint32_t bits = found; bits; bits &= bits - 1){
+                    int lane = __builtin_ctz(bits);
+                    inter[lane] = temp[lane];
+                    inter[lane].sceneIndex = i;
+                    inter[lane].material = materials[i];
+                    tmax[lane] = temp[lane].timestep;
+                }
+                contact |= found;
+            };
+            for (uint32_t i: unbounded){
+                test(i);
+            }
+            if (!top.empty()){
+                for (int i = 0; i < RayPacket::SIZE; i++){
+                    tmax[i] = temp[i].timestep;
+                }
+                top.traverseLeaves(packet, tmax, [&](const BVHNode& leaf, uint32_t){
+                    for (uint32_t k = leaf.leftFirst; k < leaf.leftFirst + leaf.count; k++){
+                        test(bounded[top.triIndices[k]]);
+                    }
+                });
+            }
+            STATS_ADD(ClosestRays, __builtin_popcount(packet.valid));
+            STATS_ADD(ClosestHits, __builtin_popcount(contact));
             return contact;
         }
-};
\ No newline at end of file
+
+        // true if anything lies along the ray closer than tmax, stops at the first hit found
+        bool occluded(const Ray& ray, float tmax) const{
+            STATS_COUNT(OcclusionRays);
+            bool blocked = occludedBy(ray, tmax);
+            if (blocked) STATS_COUNT(Occluded);
+            return blocked;
+        }
+
+        // bit mask of the valid rays with anything closer than their tmax
+        uint32_t occluded(const RayPacket& packet, const float* tmax) const{
+            uint32_t blocked = occludedBy(packet, tmax);
+            STATS_ADD(OcclusionRays, __builtin_popcount(packet.valid));
+            STATS_ADD(Occluded, __builtin_popcount(blocked));
+            return blocked;
+        }
+
+        // bytes held by the top level BVH, the objects' own structures are not counted
+        size_t structureMemory() const{
+            return top.memory();
+        }
+
+    private:
+        // the occlusion tests, occluded counts their rays
+        bool occludedBy(const Ray& ray, float tmax) const{
+            for (uint32_t i: unbounded){
+                if (objects[i]->occluded(ray, tmax)) return true;
+            }
+            if (top.empty()) return false;
+            return top.traverseAny(ray, 0, tmax, [&](const BVHNode& leaf){
+                for (uint32_t k = leaf.leftFirst; k < leaf.leftFirst + leaf.count; k++){
+                    if (objects[bounded[top.triIndices[k]]]->occluded(ray, tmax)) return true;
+                }
+                return false;
+            });
+        }
+
+        uint32_t occludedBy(const RayPacket& packet, const float* tmax) const{
+            // occluded lanes get a negative tmax so later objects skip them
+            float limit[RayPacket::SIZE];
+            for (int i = 0; i < RayPacket::SIZE; i++){
+                limit[i] = tmax[i];
+            }
+            uint32_t blocked = 0;
+            auto test = [&](uint32_t i){
+                uint32_t found = objects[i]->occluded(packet, limit);
+                for (uint32_t bits = found; bits; bits &= bits - 1){
+                    limit[__builtin_ctz(bits)] = -finf;
+                }
+                blocked |= found;
+            };
+            for (uint32_t i: unbounded){
+                test(i);
+                if (blocked == packet.valid) return blocked;
+            }
+            if (!top.empty()){
+                top.traverseLeaves(packet, limit, [&](const BVHNode& leaf, uint32_t){
+                    for (uint32_t k = leaf.leftFirst; k < leaf.leftFirst + leaf.count; k++){
+                        test(bounded[top.triIndices[k]]);
+                    }
+                });
+            }
+            return blocked;
+        }
+
+    public:
+        std::vector<const Observable*> objects;
+        std::vector<const Material*> materials;
+        Vec3 light;
+        Vec3 camera;
+        Vec3 cameraDirection;
+        Vec3 cameraUp;
+
+    private:
+        // object indices of the objects in the top level BVH and of the unbounded ones
+        std::vector<uint32_t> bounded;
+        std::vector<uint32_t> unbounded;
+        BVH top;
+};
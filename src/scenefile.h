@@ -0,0 +1,517 @@
+#pragma once
+
+#include "scene.h"
+#include "renderer.h"
+#include "meshcache.h"
+#include "instance.h"
+#include "animation.h"
+#include "plane.h"
+#include "sphere.h"
+#include "material.h"
+#include "matrix.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+
+// everything one image needs, read from a scene file and the command line
+struct RenderJob{
+    Scene scene;
+    RenderSettings settings;
+    std::string output;
+    // samples per pixel heatmap of adaptive renders, nothing is written if empty
+    std::string heatmap;
+    // depth of the octrees of meshes that ask for one instead of a BVH
+    int octreeDepth = 7;
+    // frame count and what moves between frames, output then gets the frame number
+    Animation animation;
+};
+
+
+/*
+   scene description files, one statement per line, # starts a comment, colours are 0-255 and angles degrees
+
+   settings, every one of them can also be given as --<name> on the command line, which wins over the file:
+       resolution <w> <h>         width <w>             height <h>
+       fov <degrees>              depth <bounces>       octree-depth <levels>
+       spp <n>                    filter <box|tent|gaussian|mitchell>            no-packets
+       adaptive                   min-spp <n>           max-spp <n>           threshold <t>
+       heatmap <path>             progressive           time-budget <s>       snapshot-interval <s>
+       output <path>              camera <x y z>        lookat <x y z>        up <x y z>
+       light <x y z>              frames <n>            refit-limit <ratio>
+
+   materials, lambertian, phong and glass (refraction index 1.5) always exist:
+       material <name> lambertian|phong|glass [refraction index]
+
+   objects:
+       plane point <x y z> normal <x y z> colour <r g b> material <name> [checkered]
+       sphere center <x y z> radius <r> colour <r g b> material <name>
+       mesh file <obj> colour <r g b> material <name> [name <id>] [rotate <pitch roll yaw>] [scale <s>]
+            [center] [floor <height>] [translate <x y z>] [octree]
+            [spin <pitch roll yaw>] [move <x y z>] [wobble <amplitude> <period>]
+       instance <id> [colour <r g b>] [material <name>] [scale <s>] [rotate <pitch roll yaw>] [translate <x y z>]
+            [spin <pitch roll yaw>] [move <x y z>]
+       keyframe <frame> [camera <x y z>] [lookat <x y z>] [fov <degrees>]
+
+   a mesh's transform is baked into its vertices and cached next to the OBJ, instances place another copy
+   of a named mesh by transforming rays, on top of the mesh's own transform
+   with frames above 1 every frame is written to output with its number added, spin and move are added
+   to the pose every frame, a spinning mesh turns about the centre of its box and an instance about the
+   mesh's origin, neither touches the geometry, wobble ripples the mesh's vertices along their normals with
+   a wave taking period frames, refitting its BVH every frame and building it again once it is refit-limit
+   times as costly as a fresh one (default 1.5)
+   keyframes move the camera along a smooth path through them, values a keyframe leaves out are kept from
+   the one before, the first from the camera settings, frames defaults to the last keyframe's frame + 1,
+   with frames 1 the scene renders as a still from the camera at frame 0
+   settings are applied before any object is built
+*/
+class SceneLoader{
+    public:
+        SceneLoader(MeshLibrary& library_): library(library_){
+        }
+
+        // number of values a setting takes, -1 if keyword is not a setting
+        static int settingArguments(const std::string& keyword){
+            static const std::map<std::string, int> arguments = {
+                {"resolution", 2}, {"width", 1}, {"height", 1}, {"fov", 1}, {"depth", 1}, {"octree-depth", 1},
+                {"spp", 1}, {"filter", 1}, {"no-packets", 0},
+                {"adaptive", 0}, {"min-spp", 1}, {"max-spp", 1}, {"threshold", 1}, {"heatmap", 1},
+                {"progressive", 0}, {"time-budget", 1}, {"snapshot-interval", 1},
+                {"output", 1}, {"camera", 3}, {"lookat", 3}, {"up", 3}, {"light", 3},
+                {"frames", 1}, {"refit-limit", 1}
+            };
+            auto found = arguments.find(keyword);
+            return found == arguments.end() ? -1 : found->second;
+        }
+
+        /*
+           fills job from the scene file at path, then applies overrides, each one a setting line
+           problems are reported on std::cerr with their line, returns false if the job cannot be rendered
+        */
+        bool load(const std::string& path, const std::vector<std::string>& overrides, RenderJob& job){
+            std::ifstream file(path);
+            if (!file){
+                std::cerr << "Could not open scene " << path << std::endl;
+                return false;
+            }
+            std::vector<Line> settings;
+            std::vector<Line> definitions;
+            std::string text;
+            for (int number = 1; std::getline(file, text); number++){
+                Line line(path + ":" + std::to_string(number), text);
+                if (line.words.empty()) continue;
+                if (settingArguments(line.words[0]) >= 0){
+                    settings.push_back(line);
+                }
+                else{
+                    definitions.push_back(line);
+                }
+            }
+            for (const std::string& text: overrides){
+                settings.push_back(Line("command line", text));
+            }
+
+            job = RenderJob();
+            // output named after the scene unless it says otherwise
+            std::string stem = path.substr(path.find_last_of("/\\") + 1);
+            job.output = "images/" + stem.substr(0, stem.find_last_of('.')) + ".png";
+            sppGiven = false;
+            framesGiven = false;
+            hasTarget = false;
+            for (Line& line: settings){
+                if (!applySetting(line, job)) return false;
+            }
+            if (hasTarget){
+                job.scene.lookAt(target);
+            }
+            // a time budget alone keeps refining until the time is up
+            if (job.settings.progressive && job.settings.timeBudget > 0 && !sppGiven){
+                job.settings.spp = 1 << 20;
+            }
+
+            materials.clear();
+            materials["lambertian"] = std::make_shared<Lambertian>();
+            materials["phong"] = std::make_shared<Phong>();
+            materials["glass"] = std::make_shared<Glass>(1.5f);
+            named.clear();
+            used.clear();
+            keys.clear();
+            for (Line& line: definitions){
+                if (line.words[0] == "material" && !addMaterial(line)) return false;
+            }
+            for (Line& line: definitions){
+                if (line.words[0] == "material") continue;
+                if (line.words[0] == "keyframe"){
+                    if (!addKey(line)) return false;
+                    continue;
+                }
+                if (!addObject(line, job)) return false;
+            }
+            setCameraKeys(job);
+            if (job.animation.animated() && (job.settings.progressive || !job.heatmap.empty())){
+                std::cerr << path << ": animations render every frame in one go, without progressive or heatmap" << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        // words of one statement and the position of the next one to read
+        struct Line{
+            std::string where;
+            std::vector<std::string> words;
+            size_t next = 1;
+
+            Line(const std::string& where_, const std::string& text){
+                where = where_;
+                std::istringstream stream(text.substr(0, text.find('#')));
+                std::string word;
+                while (stream >> word){
+                    words.push_back(word);
+                }
+            }
+
+            bool done() const{
+                return next >= words.size();
+            }
+
+            bool word(std::string& value){
+                if (done()) return false;
+                value = words[next++];
+                return true;
+            }
+
+            bool number(float& value){
+                if (done()) return false;
+                try{
+                    size_t used;
+                    value = std::stof(words[next], &used);
+                    if (used != words[next].size()) return false;
+                }
+                catch (const std::exception&){
+                    return false;
+                }
+                next++;
+                return true;
+            }
+
+            bool integer(int& value){
+                float number_;
+                if (!number(number_)) return false;
+                value = (int) number_;
+                return true;
+            }
+
+            bool vector(Vec3& value){
+                return number(value.x) && number(value.y) && number(value.z);
+            }
+
+            bool fail(const std::string& message) const{
+                std::cerr << where << ": " << message << std::endl;
+                return false;
+            }
+        };
+
+        bool applySetting(Line& line, RenderJob& job){
+            const std::string& keyword = line.words[0];
+            RenderSettings& settings = job.settings;
+            bool ok = true;
+            if (keyword == "resolution") ok = line.integer(settings.width) && line.integer(settings.height);
+            else if (keyword == "width") ok = line.integer(settings.width);
+            else if (keyword == "height") ok = line.integer(settings.height);
+            else if (keyword == "fov"){
+                float degrees;
+                ok = line.number(degrees);
+                settings.fov = degrees * M_PI / 180;
+            }
+            else if (keyword == "depth") ok = line.integer(settings.depth) && settings.depth >= 0;
+            else if (keyword == "octree-depth") ok = line.integer(job.octreeDepth) && job.octreeDepth >= 1 && job.octreeDepth <= Octree::MAX_DEPTH;
+            else if (keyword == "spp"){
+                ok = line.integer(settings.spp) && settings.spp >= 1;
+                sppGiven = true;
+            }
+            else if (keyword == "filter"){
+                std::string name;
+                FilterType type;
+                if (!line.word(name) || !Filter::parse(name, type)){
+                    return line.fail("unknown filter " + name);
+                }
+                settings.filter = Filter(type);
+            }
+            else if (keyword == "no-packets") settings.packets = false;
+            else if (keyword == "adaptive") settings.adaptive = true;
+            else if (keyword == "min-spp") ok = line.integer(settings.minSpp) && settings.minSpp >= 1;
+            else if (keyword == "max-spp") ok = line.integer(settings.maxSpp) && settings.maxSpp >= 1;
+            else if (keyword == "threshold") ok = line.number(settings.threshold);
+            else if (keyword == "heatmap") ok = line.word(job.heatmap);
+            else if (keyword == "progressive") settings.progressive = true;
+            else if (keyword == "time-budget") ok = line.number(settings.timeBudget);
+            else if (keyword == "snapshot-interval") ok = line.number(settings.snapshotInterval);
+            else if (keyword == "output") ok = line.word(job.output);
+            else if (keyword == "camera") ok = line.vector(job.scene.camera);
+            else if (keyword == "lookat"){
+                ok = line.vector(target);
+                hasTarget = true;
+            }
+            else if (keyword == "up") ok = line.vector(job.scene.cameraUp);
+            else if (keyword == "light") ok = line.vector(job.scene.light);
+            else if (keyword == "frames"){
+                ok = line.integer(job.animation.frames) && job.animation.frames > 0;
+                framesGiven = true;
+            }
+            else if (keyword == "refit-limit") ok = line.number(job.animation.refitLimit) && job.animation.refitLimit >= 1;
+            if (!ok || !line.done()){
+                return line.fail("expected " + keyword + " and " + std::to_string(settingArguments(keyword)) + " values");
+            }
+            if (settings.width <= 0 || settings.height <= 0){
+                return line.fail("the resolution must be positive");
+            }
+            return true;
+        }
+
+        bool addMaterial(Line& line){
+            std::string name, type;
+            if (!line.word(name) || !line.word(type)){
+                return line.fail("expected material <name> <type>");
+            }
+            if (type == "lambertian") materials[name] = std::make_shared<Lambertian>();
+            else if (type == "phong") materials[name] = std::make_shared<Phong>();
+            else if (type == "glass"){
+                float index = 1.5f;
+                if (!line.done() && !line.number(index)){
+                    return line.fail("expected a refraction index");
+                }
+                materials[name] = std::make_shared<Glass>(index);
+            }
+            else{
+                return line.fail("unknown material type " + type);
+            }
+            return line.done() || line.fail("unexpected " + line.words[line.next]);
+        }
+
+        bool material(Line& line, std::shared_ptr<Material>& value){
+            std::string name;
+            if (!line.word(name)) return false;
+            auto found = materials.find(name);
+            if (found == materials.end()) return false;
+            value = found->second;
+            return true;
+        }
+
+        bool addObject(Line& line, RenderJob& job){
+            const std::string& type = line.words[0];
+            Vec3 colour(255);
+            std::shared_ptr<Material> mat = materials["lambertian"];
+            std::string key;
+            if (type == "plane"){
+                Vec3 point(0), normal(0, 1, 0);
+                bool checkered = false;
+                while (line.word(key)){
+                    bool ok = true;
+                    if (key == "point") ok = line.vector(point);
+                    else if (key == "normal") ok = line.vector(normal);
+                    else if (key == "colour") ok = line.vector(colour);
+                    else if (key == "material") ok = material(line, mat);
+                    else if (key == "checkered") checkered = true;
+                    else ok = false;
+                    if (!ok) return line.fail("bad plane option " + key);
+                }
+                job.scene.addObject(std::make_shared<Plane>(point, normal.normalise(), colour, checkered, mat));
+                return true;
+            }
+            if (type == "sphere"){
+                Vec3 center(0);
+                float radius = 1;
+                while (line.word(key)){
+                    bool ok = true;
+                    if (key == "center") ok = line.vector(center);
+                    else if (key == "radius") ok = line.number(radius);
+                    else if (key == "colour") ok = line.vector(colour);
+                    else if (key == "material") ok = material(line, mat);
+                    else ok = false;
+                    if (!ok) return line.fail("bad sphere option " + key);
+                }
+                job.scene.addObject(std::make_shared<Sphere>(center, radius, colour, mat));
+                return true;
+            }
+            if (type == "mesh"){
+                std::string filename, name;
+                MeshTransform transform;
+                bool octree = false;
+                Vec3 spin(0), move(0);
+                float amplitude = 0, period = 1;
+                while (line.word(key)){
+                    bool ok = true;
+                    if (key == "file") ok = line.word(filename);
+                    else if (key == "colour") ok = line.vector(colour);
+                    else if (key == "material") ok = material(line, mat);
+                    else if (key == "name") ok = line.word(name);
+                    else if (key == "rotate"){
+                        ok = line.vector(transform.rotation);
+                        transform.rotation = transform.rotation * (M_PI / 180);
+                    }
+                    else if (key == "scale") ok = line.number(transform.scale);
+                    else if (key == "center") transform.center = true;
+                    else if (key == "floor"){
+                        ok = line.number(transform.floorHeight);
+                        transform.floor = true;
+                    }
+                    else if (key == "translate") ok = line.vector(transform.translation);
+                    else if (key == "octree") octree = true;
+                    else if (key == "spin") ok = line.vector(spin);
+                    else if (key == "move") ok = line.vector(move);
+                    else if (key == "wobble") ok = line.number(amplitude) && line.number(period) && period > 0;
+                    else ok = false;
+                    if (!ok) return line.fail("bad mesh option " + key);
+                }
+                if (filename.empty()){
+                    return line.fail("mesh needs a file");
+                }
+                std::shared_ptr<TriangleMesh> mesh = library.load(filename, transform, octree ? job.octreeDepth : 0);
+                if (amplitude != 0){
+                    // the vertices change every frame, so the mesh gets a copy of its own
+                    mesh = std::make_shared<TriangleMesh>(*mesh);
+                    job.animation.wobbles.emplace_back(mesh, amplitude, period);
+                }
+                bool moving = spin != Vec3(0) || move != Vec3(0);
+                std::shared_ptr<Observable> object;
+                if (!moving && used.insert(mesh.get()).second){
+                    // first use in this scene, the shared mesh takes this scene's look
+                    mesh->colour = colour;
+                    mesh->material = mat;
+                    object = mesh;
+                }
+                else{
+                    auto instance = std::make_shared<Instance>(mesh, Mat4(), mat);
+                    instance->setColour(colour);
+                    object = instance;
+                    InstanceMotion motion;
+                    motion.instance = instance;
+                    Vec3 min, max;
+                    mesh->bounds(min, max);
+                    motion.pivot = (min + max) * 0.5f;
+                    motion.spin = spin * (M_PI / 180);
+                    motion.move = move;
+                    job.animation.motions.push_back(motion);
+                }
+                job.scene.addObject(object);
+                if (!name.empty()){
+                    named[name] = Look{mesh, colour, mat};
+                }
+                return true;
+            }
+            if (type == "instance"){
+                std::string name;
+                if (!line.word(name) || named.find(name) == named.end()){
+                    return line.fail("instance of unknown mesh " + name);
+                }
+                const Look& look = named[name];
+                colour = look.colour;
+                mat = look.material;
+                InstanceMotion motion;
+                while (line.word(key)){
+                    bool ok = true;
+                    if (key == "colour") ok = line.vector(colour);
+                    else if (key == "material") ok = material(line, mat);
+                    else if (key == "rotate") ok = line.vector(motion.rotation);
+                    else if (key == "scale") ok = line.number(motion.scale);
+                    else if (key == "translate") ok = line.vector(motion.translation);
+                    else if (key == "spin") ok = line.vector(motion.spin);
+                    else if (key == "move") ok = line.vector(motion.move);
+                    else ok = false;
+                    if (!ok) return line.fail("bad instance option " + key);
+                }
+                motion.rotation = motion.rotation * (M_PI / 180);
+                motion.spin = motion.spin * (M_PI / 180);
+                motion.instance = std::make_shared<Instance>(look.mesh, motion.at(0), mat);
+                motion.instance->setColour(colour);
+                job.scene.addObject(motion.instance);
+                job.animation.motions.push_back(motion);
+                return true;
+            }
+            return line.fail("unknown statement " + type);
+        }
+
+    private:
+        // a keyframe line, values it leaves out are taken from the key before it
+        struct Key{
+            CameraKey key;
+            bool position = false;
+            bool target = false;
+            bool fov = false;
+        };
+
+        bool addKey(Line& line){
+            Key key;
+            if (!line.integer(key.key.frame) || key.key.frame < 0){
+                return line.fail("expected keyframe <frame>");
+            }
+            std::string word;
+            while (line.word(word)){
+                bool ok = true;
+                if (word == "camera") ok = key.position = line.vector(key.key.position);
+                else if (word == "lookat") ok = key.target = line.vector(key.key.target);
+                else if (word == "fov"){
+                    ok = key.fov = line.number(key.key.fov);
+                    key.key.fov *= M_PI / 180;
+                }
+                else ok = false;
+                if (!ok) return line.fail("bad keyframe option " + word);
+            }
+            keys.push_back(key);
+            return true;
+        }
+
+        // fills in the keys in frame order, the first from the scene's camera settings
+        void setCameraKeys(RenderJob& job){
+            if (keys.empty()) return;
+            std::stable_sort(keys.begin(), keys.end(), [](const Key& a, const Key& b){
+                return a.key.frame < b.key.frame;
+            });
+            CameraKey last{0, job.scene.camera, job.scene.camera + job.scene.cameraDirection, job.settings.fov};
+            for (const Key& key: keys){
+                CameraKey filled = key.key;
+                if (!key.position) filled.position = last.position;
+                if (!key.target) filled.target = last.target;
+                if (!key.fov) filled.fov = last.fov;
+                job.animation.cameraKeys.push_back(filled);
+                last = filled;
+            }
+            // without a frame count the animation runs to the last key
+            if (!framesGiven){
+                job.animation.frames = keys.back().key.frame + 1;
+            }
+            // a single frame is rendered as a still, from where the keys put the camera at frame 0
+            CameraKey at{};
+            if (!job.animation.animated() && job.animation.camera(0, at)){
+                job.scene.camera = at.position;
+                job.scene.cameraDirection = at.target - at.position;
+                job.settings.fov = at.fov;
+            }
+        }
+
+        // a named mesh as its mesh line left it
+        struct Look{
+            std::shared_ptr<TriangleMesh> mesh;
+            Vec3 colour;
+            std::shared_ptr<Material> material;
+        };
+
+        MeshLibrary& library;
+        std::map<std::string, std::shared_ptr<Material>> materials;
+        // meshes given a name in the current scene, and the shared meshes it already uses
+        std::map<std::string, Look> named;
+        std::set<const TriangleMesh*> used;
+        std::vector<Key> keys;
+        bool sppGiven = false;
+        // a frames setting in the file or on the command line, even one of 1, wins over the keyframes
+        bool framesGiven = false;
+        bool hasTarget = false;
+        Vec3 target;
+};
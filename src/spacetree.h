@@ -1,170 +1,389 @@
 #pragma once
 
 #include "ray.h"
-#include <set>
+#include "bvh.h"
+#include "stats.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <vector>
+#include <cstdint>
 
-class SpaceTreeNode{
+
+/*
+   node of an Octree, stored in the tree's node array
+   an interior node's children are next to each other from nodes[first], count of them, empty octants are left out
+   a leaf's triangles are faces[first] to faces[first + count]
+*/
+struct OctreeNode{
+    Vec3 min;
+    Vec3 max;
+    uint32_t first;
+    uint32_t count;
+    bool leaf;
+};
+
+
+/*
+   octree over the triangles of a mesh, built top down to a fixed depth
+   only octants that overlap a triangle get a node, and nodes holding fewer than MIN_SPLIT triangles
+   are not split further, so the tree is as big as the mesh needs rather than 8^depth nodes
+   all nodes live in one array and all leaf triangle lists in another
+   with a thread pool the top levels are split on the calling thread until there are enough subtrees
+   to keep every thread busy, the subtrees are then built in parallel and appended to the arrays
+   nodes end up in traversal order: the children of a node are next to each other and every child's
+   subtree follows its siblings' in order, leaf triangle lists are in the same order
+*/
+class Octree{
     public:
-        SpaceTreeNode(){
-        }
+        // deepest level a tree is split to, the traversal stacks are sized from it
+        static constexpr int MAX_DEPTH = 32;
 
-        SpaceTreeNode(Vec3 min_, Vec3 max_){
-            center = (max_ + min_) * 0.5f;
-            extents = max_ - center;
-            box[0] = min_;
-            box[1] = max_;
+        Octree(){
         }
 
-        ~SpaceTreeNode(){
-            children.clear();
-            faces.clear();
-        }
+        Octree(const Vec3 boundingBox_[2], const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, int depth_, ThreadPool* pool = nullptr){
+            depth = std::min(std::max(depth_, 0), MAX_DEPTH);
+            uint32_t count = indices.size() / 3;
+            Task root;
+            root.node = 0;
+            root.level = 0;
+            root.box[0] = boundingBox_[0];
+            root.box[1] = boundingBox_[1];
+            root.faces.resize(count);
+            for (uint32_t face = 0; face < count; face++){
+                root.faces[face] = face;
+            }
+            nodes.push_back(OctreeNode());
 
-        void build(int depth){
-            if (depth == 0){
-                return;
+            std::vector<Task> tasks;
+            tasks.push_back(std::move(root));
+            unsigned threads = pool ? pool->size() : 1;
+            while (threads > 1 && tasks.size() < threads * TASKS_PER_THREAD){
+                std::vector<Task> next;
+                bool split = false;
+                for (Task& task: tasks){
+                    if (!splittable(task)){
+                        next.push_back(std::move(task));
+                        continue;
+                    }
+                    Task children[8];
+                    int used = splitNode(task, vertices, indices, children);
+                    OctreeNode& node = nodes[task.node];
+                    node.min = task.box[0];
+                    node.max = task.box[1];
+                    node.leaf = false;
+                    node.first = nodes.size();
+                    node.count = used;
+                    for (int i = 0; i < used; i++){
+                        children[i].node = nodes.size();
+                        nodes.push_back(OctreeNode());
+                        next.push_back(std::move(children[i]));
+                    }
+                    split = true;
+                }
+                tasks = std::move(next);
+                if (!split) break;
             }
-            Vec3 v0 = box[0];
-            Vec3 v1 = box[1];
-            // TOP/BOTTOM LEFT/RIGHT FRONT/BACK
-            SpaceTreeNode TRF = SpaceTreeNode(center, v1);
-            TRF.build(depth - 1);
-            SpaceTreeNode TLF = SpaceTreeNode(Vec3(v0.x, center.y, center.z), Vec3(center.x, v1.y, v1.z));
-            TLF.build(depth - 1);
-            SpaceTreeNode BLF = SpaceTreeNode(Vec3(v0.x, v0.y, center.z), Vec3(center.x, center.y, v1.z));
-            BLF.build(depth - 1);
-            SpaceTreeNode BRF = SpaceTreeNode(Vec3(center.x, v0.y, center.z), Vec3(v1.x, center.y, v1.z));
-            BRF.build(depth - 1);
-
-            SpaceTreeNode BRB = SpaceTreeNode(Vec3(center.x, v0.y, v0.z), Vec3(v1.x, center.y, center.z));
-            BRB.build(depth - 1);
-            SpaceTreeNode BLB = SpaceTreeNode(v0, center);
-            BLB.build(depth - 1);
-            SpaceTreeNode TLB = SpaceTreeNode(Vec3(v0.x, center.y, v0.z), Vec3(center.x, v1.y, center.z));
-            TLB.build(depth - 1);
-            SpaceTreeNode TRB = SpaceTreeNode(Vec3(center.x, center.y, v0.z), Vec3(v1.x, v1.y, center.z));
-            TRB.build(depth - 1);
-
-            children.push_back(TRF);
-            children.push_back(TLF);
-            children.push_back(BLF);
-            children.push_back(BRF);
-            children.push_back(BRB);
-            children.push_back(BLB);
-            children.push_back(TLB);
-            children.push_back(TRB);
-        }
 
-        bool insert(std::vector<int>& face, Vec3 v0, Vec3 v1, Vec3 v2, uint8_t depth){
-            if (depth <= 1){
-                // within the insertion box
-                if (AABBIntersection(center, extents, v0, v1, v2)){
-                    return true;
+            // every subtree goes into arrays of its own, which are then moved behind the shared ones
+            std::vector<Subtree> subtrees(tasks.size());
+            auto buildTask = [&](uint32_t i, unsigned){
+                buildNode(tasks[i], vertices, indices, subtrees[i], subtrees[i].root);
+                tasks[i].faces = std::vector<uint32_t>();
+            };
+            if (threads > 1){
+                pool->parallelFor(tasks.size(), buildTask);
+            }
+            else{
+                for (uint32_t i = 0; i < tasks.size(); i++){
+                    buildTask(i, 0);
                 }
-                return false;
             }
-            // within in the current box
-            if (AABBIntersection(center, extents, v0, v1, v2)){
-                for (SpaceTreeNode& child: children){
-                    if (child.insert(face, v0, v1, v2, depth -1)){
-                        child.faces.push_back(face);
-                    }
+            for (uint32_t i = 0; i < tasks.size(); i++){
+                Subtree& subtree = subtrees[i];
+                uint32_t nodeOffset = nodes.size();
+                uint32_t faceOffset = faces.size();
+                auto relocate = [&](OctreeNode& node){
+                    node.first += node.leaf ? faceOffset : nodeOffset;
+                };
+                relocate(subtree.root);
+                nodes[tasks[i].node] = subtree.root;
+                for (OctreeNode& node: subtree.nodes){
+                    relocate(node);
+                    nodes.push_back(node);
                 }
+                faces.insert(faces.end(), subtree.faces.begin(), subtree.faces.end());
+                subtree = Subtree();
             }
-            return false;
+            if (tasks.size() > 1){
+                // the top levels were split breadth first
+                reorder();
+            }
+            nodes.shrink_to_fit();
+            faces.shrink_to_fit();
+        }
+
+        bool empty() const{
+            return nodes.empty();
         }
 
-        bool intersection(Ray ray, std::vector<std::vector<int>>& array){
-            bool hit = false;
-            if (AABBIntersection(box[0], box[1], ray)){
-                // at bottom if no children
-                if (children.size() == 0){
-                    for (auto& face: faces){
-                        array.push_back(face);
+        // bytes held by the nodes and leaf triangle lists
+        size_t memory() const{
+            return nodes.capacity() * sizeof(OctreeNode) + faces.capacity() * sizeof(uint32_t);
+        }
+
+        bool intersection(const Ray& ray, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, TriangleHit& hit) const{
+            // closest hit traversal, children are visited front to back and
+            // triangles are tested in place so no memory is allocated per ray
+            if (nodes.empty() || AABBDistance(nodes[0].min, nodes[0].max, ray, hit.timestep) == finf){
+                return false;
+            }
+            uint32_t stack[STACK_SIZE];
+            float stackDistance[STACK_SIZE];
+            int top = 0;
+            stack[top] = 0;
+            stackDistance[top++] = 0;
+            bool found = false;
+            while (top > 0){
+                top--;
+                // every node left is further away than the closest hit so far
+                if (stackDistance[top] >= hit.timestep){
+                    continue;
+                }
+                const OctreeNode& node = nodes[stack[top]];
+                STATS_COUNT(NodesVisited);
+                if (node.leaf){
+                    STATS_ADD(TrianglesTested, node.count);
+                    for (uint32_t k = node.first; k < node.first + node.count; k++){
+                        uint32_t face = faces[k];
+                        const uint32_t* tri = &indices[face * 3];
+                        float t, u, v;
+                        bool backface;
+                        if (rayTriangleIntersection(ray, vertices[tri[0]], vertices[tri[1]], vertices[tri[2]], t, u, v, backface)){
+                            if (t > EPSILLON && t < hit.timestep){
+                                hit.timestep = t;
+                                hit.u = u;
+                                hit.v = v;
+                                hit.backface = backface;
+                                hit.face = face;
+                                found = true;
+                            }
+                        }
+                    }
+                    continue;
+                }
+                // sort the children that are hit by entry distance, nearest last so it is popped first
+                uint32_t order[8];
+                float distance[8];
+                int hits = 0;
+                for (uint32_t child = node.first; child < node.first + node.count; child++){
+                    float d = AABBDistance(nodes[child].min, nodes[child].max, ray, hit.timestep);
+                    if (d == finf) continue;
+                    int i = hits++;
+                    while (i > 0 && distance[i - 1] < d){
+                        order[i] = order[i - 1];
+                        distance[i] = distance[i - 1];
+                        i--;
                     }
-                    return true;
+                    order[i] = child;
+                    distance[i] = d;
                 }
-                // check children
-                for (SpaceTreeNode& node: children){
-                    hit = node.intersection(ray, array) || hit;
+                for (int i = 0; i < hits; i++){
+                    stack[top] = order[i];
+                    stackDistance[top++] = distance[i];
                 }
             }
-            return hit;
+            return found;
         }
 
-        bool cull(){
-            std::vector<SpaceTreeNode> tokeep;
-            for (SpaceTreeNode& node: children){
-                if (!node.cull()){
-                    tokeep.push_back(node);
+        // true as soon as any triangle is hit before tmax, children are visited in any order
+        bool occluded(const Ray& ray, float tmax, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices) const{
+            if (nodes.empty() || AABBDistance(nodes[0].min, nodes[0].max, ray, tmax) == finf){
+                return false;
+            }
+            uint32_t stack[STACK_SIZE];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0){
+                const OctreeNode& node = nodes[stack[--top]];
+                STATS_COUNT(NodesVisited);
+                if (node.leaf){
+                    for (uint32_t k = node.first; k < node.first + node.count; k++){
+                        const uint32_t* tri = &indices[faces[k] * 3];
+                        float t, u, v;
+                        bool backface;
+                        STATS_COUNT(TrianglesTested);
+                        if (rayTriangleIntersection(ray, vertices[tri[0]], vertices[tri[1]], vertices[tri[2]], t, u, v, backface)){
+                            if (t > EPSILLON && t < tmax) return true;
+                        }
+                    }
+                    continue;
+                }
+                for (uint32_t child = node.first; child < node.first + node.count; child++){
+                    if (AABBDistance(nodes[child].min, nodes[child].max, ray, tmax) != finf){
+                        stack[top++] = child;
+                    }
                 }
             }
-            children.clear();
-            children = tokeep;
-            return (children.size() == 0 && faces.size() == 0);
+            return false;
         }
 
-    public:
-        Vec3 box[2];
-        Vec3 center;
-        Vec3 extents;
-        std::vector<SpaceTreeNode> children;
-        std::vector<std::vector<int>> faces;
-};
+    private:
+        // a node still to be built, with the triangles overlapping its box
+        struct Task{
+            uint32_t node;
+            int level;
+            Vec3 box[2];
+            std::vector<uint32_t> faces;
+        };
 
-class Octree{
-    public:
-        Octree(){
+        // nodes below one task, numbered from zero until they are appended to the tree
+        struct Subtree{
+            OctreeNode root;
+            std::vector<OctreeNode> nodes;
+            std::vector<uint32_t> faces;
+        };
+
+        /*
+           a node is split while it is above the depth limit, holds enough triangles and its box can still be
+           halved on every axis it spans, below float precision the octants would be copies of their parent,
+           each holding the triangles of the parent again, down to the depth limit
+        */
+        bool splittable(const Task& task) const{
+            if (task.level >= depth || task.faces.size() < MIN_SPLIT) return false;
+            const Vec3& lo = task.box[0];
+            const Vec3& hi = task.box[1];
+            Vec3 center = (lo + hi) * 0.5f;
+            auto halves = [](float a, float c, float b){
+                return a == b || (a < c && c < b);
+            };
+            return halves(lo.x, center.x, hi.x) && halves(lo.y, center.y, hi.y) && halves(lo.z, center.z, hi.z);
         }
 
-        Octree(Vec3 boundingBox_[2], std::vector<std::vector<int>>& faces_, std::vector<Vec3>& vertices_, uint8_t depth_){
-            // add the meshes bounding box to the roots 
-            root = SpaceTreeNode(boundingBox_[0], boundingBox_[1]);
-            depth = depth_;
-            vertices = vertices_;
-            root.build(depth);
-            for (std::vector<int> face: faces_){
-                // inserting each face into the tree
-                for (SpaceTreeNode& child: root.children){
-                     if (child.insert(face, vertices[face[0] - 1], vertices[face[1] - 1], vertices[face[2] - 1], depth)){
-                        child.faces.push_back(face);
+        // fills children with the octants of task that overlap any of its triangles, returns how many
+        int splitNode(const Task& task, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, Task* children) const{
+            Vec3 center = (task.box[0] + task.box[1]) * 0.5f;
+            Task* octants[8];
+            Vec3 centers[8];
+            Vec3 extents[8];
+            for (int octant = 0; octant < 8; octant++){
+                Task& child = children[octant];
+                child.level = task.level + 1;
+                child.box[0] = Vec3(octant & 1 ? center.x : task.box[0].x, octant & 2 ? center.y : task.box[0].y, octant & 4 ? center.z : task.box[0].z);
+                child.box[1] = Vec3(octant & 1 ? task.box[1].x : center.x, octant & 2 ? task.box[1].y : center.y, octant & 4 ? task.box[1].z : center.z);
+                child.faces.clear();
+                octants[octant] = &child;
+                centers[octant] = (child.box[0] + child.box[1]) * 0.5f;
+                extents[octant] = child.box[1] - centers[octant];
+            }
+            for (uint32_t face: task.faces){
+                const uint32_t* tri = &indices[face * 3];
+                const Vec3& v0 = vertices[tri[0]];
+                const Vec3& v1 = vertices[tri[1]];
+                const Vec3& v2 = vertices[tri[2]];
+                // the triangle's box rules out the octants on the far side of the centre on each axis
+                Vec3 lo = v0.min(v1.min(v2));
+                Vec3 hi = v0.max(v1.max(v2));
+                int x0 = lo.x <= center.x ? 0 : 1, x1 = hi.x >= center.x ? 1 : 0;
+                int y0 = lo.y <= center.y ? 0 : 1, y1 = hi.y >= center.y ? 1 : 0;
+                int z0 = lo.z <= center.z ? 0 : 1, z1 = hi.z >= center.z ? 1 : 0;
+                for (int z = z0; z <= z1; z++){
+                    for (int y = y0; y <= y1; y++){
+                        for (int x = x0; x <= x1; x++){
+                            int octant = x | y << 1 | z << 2;
+                            if (AABBIntersection(centers[octant], extents[octant], v0, v1, v2)){
+                                octants[octant]->faces.push_back(face);
+                            }
+                        }
                     }
                 }
             }
-            root.cull();
-            std::cout << "Faces: " << faces_.size() << std::endl;
+            // the used octants go to the front
+            int used = 0;
+            for (int octant = 0; octant < 8; octant++){
+                if (children[octant].faces.empty()) continue;
+                if (used != octant){
+                    std::swap(children[used], children[octant]);
+                }
+                used++;
+            }
+            return used;
         }
 
-        ~Octree(){
-            root = SpaceTreeNode();
-            vertices.clear();
+        // builds task's subtree into out, with node as its root, depth first
+        // only the triangle lists of the nodes on the path down are alive at any time
+        void buildNode(Task& task, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, Subtree& out, OctreeNode& node) const{
+            node.min = task.box[0];
+            node.max = task.box[1];
+            Task children[8];
+            int used = 0;
+            if (splittable(task)){
+                used = splitNode(task, vertices, indices, children);
+            }
+            if (used == 0){
+                node.leaf = true;
+                node.first = out.faces.size();
+                node.count = task.faces.size();
+                out.faces.insert(out.faces.end(), task.faces.begin(), task.faces.end());
+                return;
+            }
+            task.faces = std::vector<uint32_t>();
+            node.leaf = false;
+            node.first = out.nodes.size();
+            node.count = used;
+            uint32_t first = node.first;
+            out.nodes.resize(out.nodes.size() + used);
+            for (int i = 0; i < used; i++){
+                // out.nodes grows while the child is built, so it is built on the side
+                OctreeNode child;
+                buildNode(children[i], vertices, indices, out, child);
+                out.nodes[first + i] = child;
+                children[i].faces = std::vector<uint32_t>();
+            }
         }
 
-        std::vector<std::vector<int>> intersection(Ray ray){
-            // doesn't intersect with root nodes bounding box
-            if (!AABBIntersection(root.box[0], root.box[1], ray)){
-                // return empty array
-                std::vector<std::vector<int>> array;
-                return array;
-            }
-            // find the faces we need to test
-            std::vector<std::vector<int>> tests = {};
-            for (SpaceTreeNode& node: root.children){
-                node.intersection(ray, tests);
-            }
-            // return array with no duplicate faces
-            std::set<std::vector<int>> s;
-            unsigned size = tests.size();
-            for(unsigned i = 0; i < size; i++){
-                s.insert(tests[i]);
-            }
-            tests.assign(s.begin(), s.end());
-            return tests;
+        // copies the tree into new arrays in the order a serial build gives
+        void reorder(){
+            std::vector<OctreeNode> ordered;
+            std::vector<uint32_t> orderedFaces;
+            ordered.reserve(nodes.size());
+            orderedFaces.reserve(faces.size());
+            ordered.push_back(nodes[0]);
+            copyChildren(0, ordered, orderedFaces);
+            nodes = std::move(ordered);
+            faces = std::move(orderedFaces);
         }
 
+        // copies the children of ordered[at] and everything below them
+        void copyChildren(uint32_t at, std::vector<OctreeNode>& ordered, std::vector<uint32_t>& orderedFaces) const{
+            OctreeNode& node = ordered[at];
+            if (node.leaf){
+                uint32_t first = orderedFaces.size();
+                orderedFaces.insert(orderedFaces.end(), faces.begin() + node.first, faces.begin() + node.first + node.count);
+                node.first = first;
+                return;
+            }
+            uint32_t source = node.first;
+            uint32_t first = ordered.size();
+            uint32_t count = node.count;
+            node.first = first;
+            ordered.insert(ordered.end(), nodes.begin() + source, nodes.begin() + source + count);
+            for (uint32_t i = 0; i < count; i++){
+                copyChildren(first + i, ordered, orderedFaces);
+            }
+        }
+
+        // at most seven siblings are left on the stack per level, plus the eighth child of the deepest one
+        static constexpr int STACK_SIZE = 256;
+        static_assert(7 * MAX_DEPTH + 1 <= STACK_SIZE, "octree traversal stack too small for MAX_DEPTH");
+        // nodes with fewer triangles stay leaves
+        static constexpr size_t MIN_SPLIT = 8;
+        // subtrees handed to every thread of the pool, more than one evens out their sizes
+        static constexpr unsigned TASKS_PER_THREAD = 8;
+
     public:
-        uint8_t depth;
-        Vec3 box[2];
-        std::vector<Vec3> vertices;
-        SpaceTreeNode root;
-};
\ No newline at end of file
+        uint8_t depth = 0;
+        std::vector<OctreeNode> nodes;
+        // triangle ids of the leaves, a triangle overlapping several leaves is listed in each
+        std::vector<uint32_t> faces;
+};
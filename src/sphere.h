@@ -15,7 +15,7 @@ class Sphere: public Observable{
             material = material_;
         }
 
-        bool intersection(Ray& ray, Intersection& inter){
+        bool intersection(const Ray& ray, Intersection& inter) const{
             Vec3 oc = ray.origin - center;
             auto a = ray.direction.lengthsquared();
             auto half_b = oc.dot(ray.direction);
@@ -37,10 +37,32 @@ class Sphere: public Observable{
             inter.point = ray.attime(root);
             Vec3 outward_normal = (inter.point - center) / radius;
             inter.set_face_normal(ray, outward_normal);
+            inter.colour = colour;
 
             return true;        
         }
 
+        bool occluded(const Ray& ray, float tmax) const{
+            Vec3 oc = ray.origin - center;
+            auto a = ray.direction.lengthsquared();
+            auto half_b = oc.dot(ray.direction);
+            auto c = oc.lengthsquared() - radius*radius;
+
+            auto discriminant = half_b*half_b - a*c;
+            if (discriminant < 0) return false;
+            auto sqrtd = sqrt(discriminant);
+            auto root = (-half_b - sqrtd) / a;
+            if (root >= EPSILLON && root <= tmax) return true;
+            root = (-half_b + sqrtd) / a;
+            return root >= EPSILLON && root <= tmax;
+        }
+
+        bool bounds(Vec3& min, Vec3& max) const{
+            min = center - Vec3(radius);
+            max = center + Vec3(radius);
+            return true;
+        }
+
         Vec3 center;
         float radius;
         Vec3 colour;
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+
+/*
+   counters and stage timers showing where a run spends its time, compiled in only when RT_STATS is
+   defined (cmake -DRT_STATS=ON), otherwise every STATS_ macro is empty and the hot paths are untouched
+   every thread counts into a block of its own, registered the first time the thread counts anything,
+   so counting never takes a lock or shares a cache line, report sums the blocks once the run is over
+   with tracing started every timed stage is also kept as an event, written out in the Chrome trace
+   format (chrome://tracing or ui.perfetto.dev)
+   an executable that places STATS_ALLOCATION_HOOK at file scope also counts its heap allocations,
+   STATS_ALLOCATIONS then adds those made by the calling thread in a scope to a counter
+*/
+namespace stats{
+    #ifdef RT_STATS
+    constexpr bool ENABLED = true;
+    #else
+    constexpr bool ENABLED = false;
+    #endif
+
+    enum Counter{
+        // closest hit rays through the scene and how many of them hit
+        ClosestRays,
+        ClosestHits,
+        // any hit rays through the scene and how many of them were blocked
+        OcclusionRays,
+        Occluded,
+        // BVH and octree nodes entered, a packet entering a node counts once per active ray
+        NodesVisited,
+        // triangles tested, packet leaves count every slot of a packet
+        TrianglesTested,
+        // hits whose material was evaluated
+        Shaded,
+        // heap allocations made while rendering tiles, zero once the scratch arenas have grown
+        TileAllocations,
+        COUNTER_COUNT
+    };
+
+    enum Stage{
+        MeshLoad,
+        Normals,
+        Transform,
+        BVHBuild,
+        BVHRefit,
+        OctreeBuild,
+        SceneBuild,
+        Render,
+        Tile,
+        Encode,
+        STAGE_COUNT
+    };
+
+    const char* const COUNTER_NAMES[COUNTER_COUNT] = {
+        "closest hit rays", "closest hits", "occlusion rays", "occluded", "nodes visited", "triangles tested", "shaded", "tile allocations"
+    };
+
+    const char* const STAGE_NAMES[STAGE_COUNT] = {
+        "mesh load", "normals", "transform", "BVH build", "BVH refit", "octree build", "scene build", "render", "tile", "encode"
+    };
+
+    // rays traced at each bounce, camera rays are bounce 0, the last bin holds everything deeper
+    const int BOUNCE_BINS = 24;
+
+    // a timed stage, in microseconds since the first thread registered
+    struct Event{
+        Stage stage;
+        int64_t start;
+        int64_t duration;
+    };
+
+    // a cache line of its own, neighbouring threads never write to the same one
+    struct alignas(64) ThreadStats{
+        unsigned id;
+        uint64_t counters[COUNTER_COUNT] = {};
+        uint64_t bounces[BOUNCE_BINS] = {};
+        int64_t stageNanoseconds[STAGE_COUNT] = {};
+        uint64_t stageCalls[STAGE_COUNT] = {};
+        // bounce of the ray being traced
+        int bounce = 0;
+        std::vector<Event> events;
+    };
+
+    using clock = std::chrono::steady_clock;
+
+    inline clock::time_point epoch(){
+        static const clock::time_point start = clock::now();
+        return start;
+    }
+
+    inline std::atomic<bool>& tracing(){
+        static std::atomic<bool> enabled(false);
+        return enabled;
+    }
+
+    // blocks of every thread that ever counted, they outlive their threads
+    struct Registry{
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ThreadStats>> threads;
+    };
+
+    inline Registry& registry(){
+        static Registry instance;
+        return instance;
+    }
+
+    inline ThreadStats& local(){
+        thread_local ThreadStats* block = nullptr;
+        if (!block){
+            epoch();
+            Registry& all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            all.threads.push_back(std::make_unique<ThreadStats>());
+            block = all.threads.back().get();
+            block->id = all.threads.size() - 1;
+        }
+        return *block;
+    }
+
+    // adds the time until it goes out of scope to a stage
+    class ScopedTimer{
+        public:
+            ScopedTimer(Stage stage_): stage(stage_){
+                // the first event must not start before the epoch
+                epoch();
+                start = clock::now();
+            }
+
+            ~ScopedTimer(){
+                clock::time_point end = clock::now();
+                ThreadStats& block = local();
+                block.stageNanoseconds[stage] += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+                block.stageCalls[stage]++;
+                if (tracing()){
+                    int64_t begin = std::chrono::duration_cast<std::chrono::microseconds>(start - epoch()).count();
+                    int64_t duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+                    block.events.push_back({stage, begin, duration});
+                }
+            }
+
+        private:
+            Stage stage;
+            clock::time_point start;
+    };
+
+    // counts rays into the bin of the current bounce, rays traced while it lives are one bounce deeper
+    class BounceScope{
+        public:
+            BounceScope(uint64_t rays){
+                ThreadStats& block = local();
+                block.bounces[std::min(block.bounce, BOUNCE_BINS - 1)] += rays;
+                block.bounce++;
+            }
+
+            ~BounceScope(){
+                local().bounce--;
+            }
+    };
+
+    // heap allocations of the calling thread, counted by STATS_ALLOCATION_HOOK
+    // a plain thread_local, as registering a block would allocate from inside operator new
+    inline uint64_t& allocations(){
+        thread_local uint64_t count = 0;
+        return count;
+    }
+
+    // counted heap blocks behind STATS_ALLOCATION_HOOK, over-aligned ones come from the aligned allocator
+    // and go back to it through release(p, true), as Windows keeps those apart from malloc
+    inline void* allocate(std::size_t size, std::size_t alignment = 0){
+        allocations()++;
+        if (size == 0) size = 1;
+        void* p;
+        if (alignment <= alignof(std::max_align_t)){
+            p = std::malloc(size);
+        }
+        else{
+#ifdef _WIN32
+            p = _aligned_malloc(size, alignment);
+#else
+            // aligned_alloc wants a multiple of the alignment
+            p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+        }
+        if (!p) throw std::bad_alloc();
+        return p;
+    }
+
+    inline void release(void* p, bool aligned = false) noexcept{
+#ifdef _WIN32
+        if (aligned){
+            _aligned_free(p);
+            return;
+        }
+#else
+        (void) aligned;
+#endif
+        std::free(p);
+    }
+
+    // adds the allocations the calling thread makes until it goes out of scope to a counter
+    class AllocationScope{
+        public:
+            AllocationScope(Counter counter_): counter(counter_){
+                // registering the thread's block allocates, which is not the scope's doing
+                local();
+                start = allocations();
+            }
+
+            ~AllocationScope(){
+                uint64_t made = allocations() - start;
+                local().counters[counter] += made;
+            }
+
+        private:
+            Counter counter;
+            uint64_t start;
+    };
+
+    // sum of a counter over every thread, exact only while no thread is counting
+    inline uint64_t total(Counter counter){
+        Registry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        uint64_t sum = 0;
+        for (const auto& block: all.threads){
+            sum += block->counters[counter];
+        }
+        return sum;
+    }
+
+    // keeps timed stages as events from now on
+    inline void startTrace(){
+        tracing() = true;
+    }
+
+    // writes the events kept since startTrace, call once no thread is counting anymore
+    inline bool writeTrace(const std::string& path){
+        std::ofstream file(path);
+        if (!file) return false;
+        Registry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        file << "{\"traceEvents\": [\n";
+        bool first = true;
+        for (const auto& block: all.threads){
+            for (const Event& event: block->events){
+                file << (first ? "" : ",\n") << "{\"name\": \"" << STAGE_NAMES[event.stage] << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << block->id
+                     << ", \"ts\": " << event.start << ", \"dur\": " << event.duration << "}";
+                first = false;
+            }
+        }
+        file << "\n]}\n";
+        return file.good();
+    }
+
+    // prints the totals of every thread, call once no thread is counting anymore
+    inline void report(std::ostream& out){
+        if (!ENABLED) return;
+        ThreadStats total;
+        size_t threads;
+        {
+            Registry& all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            threads = all.threads.size();
+            for (const auto& block: all.threads){
+                for (int i = 0; i < COUNTER_COUNT; i++) total.counters[i] += block->counters[i];
+                for (int i = 0; i < BOUNCE_BINS; i++) total.bounces[i] += block->bounces[i];
+                for (int i = 0; i < STAGE_COUNT; i++){
+                    total.stageNanoseconds[i] += block->stageNanoseconds[i];
+                    total.stageCalls[i] += block->stageCalls[i];
+                }
+            }
+        }
+        const uint64_t* c = total.counters;
+        uint64_t rays = c[ClosestRays] + c[OcclusionRays];
+        auto ratio = [](uint64_t a, uint64_t b){
+            return b > 0 ? a / (double) b : 0.0;
+        };
+        out << "Statistics over " << threads << " threads" << std::endl;
+        for (int i = 0; i < COUNTER_COUNT; i++){
+            out << "  " << std::left << std::setw(20) << COUNTER_NAMES[i] << std::right << std::setw(16) << c[i] << std::endl;
+        }
+        out << std::fixed << std::setprecision(2);
+        out << "  hit rate " << ratio(c[ClosestHits], c[ClosestRays]) * 100 << "%, occluded " << ratio(c[Occluded], c[OcclusionRays]) * 100 << "%" << std::endl;
+        out << "  per ray: " << ratio(c[NodesVisited], rays) << " nodes, " << ratio(c[TrianglesTested], rays) << " triangles" << std::endl;
+        out << "  closest hit rays per bounce:";
+        for (int i = 0; i < BOUNCE_BINS; i++){
+            if (total.bounces[i] > 0){
+                out << " " << i << (i == BOUNCE_BINS - 1 ? "+" : "") << ": " << total.bounces[i];
+            }
+        }
+        out << std::endl;
+        // stages nest, mesh load includes the normals, transform and builds of meshes not found in the cache,
+        // and times of stages running on several threads at once add up
+        for (int i = 0; i < STAGE_COUNT; i++){
+            if (total.stageCalls[i] == 0) continue;
+            out << "  " << std::left << std::setw(20) << STAGE_NAMES[i] << std::right << std::setw(12) << total.stageNanoseconds[i] / 1e6 << "ms"
+                << std::setw(10) << total.stageCalls[i] << " calls" << std::endl;
+        }
+        out << std::defaultfloat << std::setprecision(6);
+    }
+}
+
+
+#ifdef RT_STATS
+#define STATS_JOIN_(a, b) a##b
+#define STATS_JOIN(a, b) STATS_JOIN_(a, b)
+#define STATS_COUNT(counter) (stats::local().counters[stats::counter]++)
+#define STATS_ADD(counter, n) (stats::local().counters[stats::counter] += (n))
+#define STATS_TIME(stage) stats::ScopedTimer STATS_JOIN(statsTimer, __LINE__)(stats::stage)
+#define STATS_BOUNCE(rays) stats::BounceScope STATS_JOIN(statsBounce, __LINE__)(rays)
+#define STATS_ALLOCATIONS(counter) stats::AllocationScope STATS_JOIN(statsAllocations, __LINE__)(stats::counter)
+// replaces the global operator new, so it must appear in exactly one translation unit of an executable
+#define STATS_ALLOCATION_HOOK \
+    void* operator new(std::size_t size){ return stats::allocate(size); } \
+    void* operator new[](std::size_t size){ return stats::allocate(size); } \
+    void* operator new(std::size_t size, std::align_val_t alignment){ return stats::allocate(size, (std::size_t) alignment); } \
+    void* operator new[](std::size_t size, std::align_val_t alignment){ return stats::allocate(size, (std::size_t) alignment); } \
+    void operator delete(void* p) noexcept{ stats::release(p); } \
+    void operator delete[](void* p) noexcept{ stats::release(p); } \
+    void operator delete(void* p, std::size_t) noexcept{ stats::release(p); } \
+    void operator delete[](void* p, std::size_t) noexcept{ stats::release(p); } \
+    void operator delete(void* p, std::align_val_t) noexcept{ stats::release(p, true); } \
+    void operator delete[](void* p, std::align_val_t) noexcept{ stats::release(p, true); } \
+    void operator delete(void* p, std::size_t, std::align_val_t) noexcept{ stats::release(p, true); } \
+    void operator delete[](void* p, std::size_t, std::align_val_t) noexcept{ stats::release(p, true); }
+#else
+#define STATS_COUNT(counter) ((void) 0)
+#define STATS_ADD(counter, n) ((void) 0)
+#define STATS_TIME(stage) ((void) 0)
+#define STATS_BOUNCE(rays) ((void) 0)
+#define STATS_ALLOCATIONS(counter) ((void) 0)
+#define STATS_ALLOCATION_HOOK
+#endif
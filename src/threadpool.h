@@ -0,0 +1,160 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+
+/*
+   fixed set of worker threads, each with its own queue of work items
+   a worker takes items from the back of its own queue and, once that is empty,
+   steals from the front of the other queues so no thread sits idle while work remains
+   the thread calling parallelFor takes part as worker 0
+   a queue only ever holds one contiguous range of items, and the task is called through a plain
+   function pointer, so handing out work never allocates
+*/
+class ThreadPool{
+    public:
+        // threads = 0 uses the hardware concurrency
+        ThreadPool(unsigned threads = 0){
+            if (threads == 0){
+                threads = std::thread::hardware_concurrency();
+            }
+            if (threads == 0){
+                threads = 1;
+            }
+            for (unsigned i = 0; i < threads; i++){
+                queues.push_back(std::make_unique<Queue>());
+            }
+            for (unsigned i = 1; i < threads; i++){
+                workers.emplace_back(&ThreadPool::workerLoop, this, i);
+            }
+        }
+
+        ~ThreadPool(){
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (std::thread& worker: workers){
+                worker.join();
+            }
+        }
+
+        unsigned size() const{
+            return queues.size();
+        }
+
+        // runs task(item, thread) for every item in [0, count) and returns once all are done
+        template<typename Task>
+        void parallelFor(uint32_t count, const Task& task){
+            if (count == 0) return;
+            // deal items out in contiguous blocks so neighbouring items start on the same thread
+            unsigned n = queues.size();
+            for (unsigned i = 0; i < n; i++){
+                std::lock_guard<std::mutex> lock(queues[i]->mutex);
+                queues[i]->begin = (uint64_t)count * i / n;
+                queues[i]->end = (uint64_t)count * (i + 1) / n;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                current = &task;
+                invoke = [](const void* task, uint32_t item, unsigned thread){
+                    (*static_cast<const Task*>(task))(item, thread);
+                };
+                busy = workers.size();
+                generation++;
+            }
+            wake.notify_all();
+            work(0);
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this]{ return busy == 0; });
+            current = nullptr;
+        }
+
+        // runs task(thread) once on every thread of the pool, for state each thread keeps, like thread_local scratch
+        // an item waits until every thread holds one, so no thread can take a second
+        template<typename Task>
+        void forEachThread(const Task& task){
+            unsigned n = queues.size();
+            std::atomic<unsigned> arrived(0);
+            parallelFor(n, [&](uint32_t, unsigned thread){
+                arrived++;
+                while (arrived < n){
+                    std::this_thread::yield();
+                }
+                task(thread);
+            });
+        }
+
+    private:
+        // items [begin, end) not taken yet
+        struct Queue{
+            std::mutex mutex;
+            uint32_t begin = 0;
+            uint32_t end = 0;
+        };
+
+        bool pop(unsigned id, uint32_t& item){
+            Queue& queue = *queues[id];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.begin == queue.end) return false;
+            item = --queue.end;
+            return true;
+        }
+
+        bool steal(unsigned id, uint32_t& item){
+            for (unsigned i = 1; i < queues.size(); i++){
+                Queue& queue = *queues[(id + i) % queues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.begin == queue.end) continue;
+                item = queue.begin++;
+                return true;
+            }
+            return false;
+        }
+
+        void work(unsigned id){
+            uint32_t item;
+            while (pop(id, item) || steal(id, item)){
+                invoke(current, item, id);
+            }
+        }
+
+        void workerLoop(unsigned id){
+            uint64_t seen = 0;
+            while (true){
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&]{ return stopping || generation != seen; });
+                    if (stopping) return;
+                    seen = generation;
+                }
+                work(id);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (--busy == 0){
+                        done.notify_all();
+                    }
+                }
+            }
+        }
+
+    private:
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        // the task of the running parallelFor and how to call it
+        const void* current = nullptr;
+        void (*invoke)(const void*, uint32_t, unsigned) = nullptr;
+        uint64_t generation = 0;
+        unsigned busy = 0;
+        bool stopping = false;
+};
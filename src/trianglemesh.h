@@ -3,82 +3,50 @@
 #include "ray.h"
 #include "observables.h"
 #include "spacetree.h"
+#include "bvh.h"
+#include "objloader.h"
+#include "stats.h"
+#include "threadpool.h"
+#include "matrix.h"
 #include <iostream>
 #include <vector>
-#include <fstream>
-#include <sstream>
 #include <memory>
 
 
-std::string replaceSlash(std::string str){
-    std::string newStr = "";
-    for (int i = 0; i < str.length(); i++){
-        if (str[i] == '/'){
-            newStr += " ";
-        }
-        else {
-            newStr += str[i];
-        }
-    }
-    return newStr;
-}
+// transform applied to a mesh after it is loaded
+// steps run in the order rotate, rescale, center, floor, translate
+struct MeshTransform{
+    // pitch, roll and yaw in radians
+    Vec3 rotation = Vec3(0);
+    float scale = 1;
+    bool center = false;
+    bool floor = false;
+    float floorHeight = 0;
+    Vec3 translation = Vec3(0);
+};
+
 
 class TriangleMesh: public Observable{
     public:
-        TriangleMesh(const std::string& filename, const Vec3& colour_, std::shared_ptr<Material> material_){
-            std::ifstream file(filename);
-            if(!file.is_open()){
-                std::cerr << "Could not open file " << filename << std::endl;
-                return;
-            }
+        // empty mesh, filled in by the caller
+        TriangleMesh(const Vec3& colour_, std::shared_ptr<Material> material_){
             colour = colour_;
             material = material_;
-            std::string line;
-            while(std::getline(file, line)){
-                if(line.empty()) continue;
-                if(line[0] == 'v'){
-                    std::istringstream iss(line);
-                    std::string type;
-                    iss >> type;
-                    // vertex
-                    if(type == "v"){
-                        Vec3 v;
-                        iss >> v.x >> v.y >> v.z;
-                        vertices.push_back(v);
-                    }
-                    // vertex normal
-                    else if(type == "vn"){
-                        Vec3 vn;
-                        iss >> vn.x >> vn.y >> vn.z;                     
-                        normals.push_back(vn);
-                    }
-                    // vertex texture
-                    else if(type == "vt"){
-                        Vec3 vt;
-                        iss >> vt.x >> vt.y;
-                        texcoords.push_back(vt);
-                    }
-                }
-                // face
-                else if (line[0] == 'f'){
-                    std::istringstream iss(line);
-                    std::string type;
-                    iss >> type;
-                    std::string fc;
-                    if(type == "f"){
-                        std::vector<int> face;
-                        while (iss >> fc){
-                            fc = replaceSlash(fc);
-                            int v;
-                            std::istringstream fcss(fc);
-                            fcss >> v;
-                            face.push_back(v);
-                        }
-                        faces.push_back(face);
-                    }
-                }
+        }
+
+        // pool, if given, parses the file on all its threads
+        TriangleMesh(const std::string& filename, const Vec3& colour_, std::shared_ptr<Material> material_, ThreadPool* pool = nullptr){
+            colour = colour_;
+            material = material_;
+            ObjData data;
+            if (!loadOBJ(filename, data, pool)){
+                std::cerr << "Could not open file " << filename << std::endl;
+                return;
             }
-            file.close();
+            vertices = std::move(data.vertices);
+            normals = std::move(data.normals);
+            texcoords = std::move(data.texcoords);
+            indices = std::move(data.indices);
             // calculate normals if they are not given
             if (normals.size() == 0){
                 recalcNormals();
@@ -86,33 +54,47 @@ class TriangleMesh: public Observable{
             recalcBoundingBox();
         }
 
+        /*
+           transform steps are lazy, each one is folded into a pending matrix and commit applies
+           them all in one pass over the vertices and normals, which also yields the new bounds
+           steps that depend on the bounds or centroid (rescale, center, floor) work them out from
+           the pending matrix, bounds are only measured again after a rotation
+        */
         void rescale(float factor){
             Vec3 centroid = getCentroid();
-            for (int i = 0; i < vertices.size(); i++){
-                vertices[i] = (vertices[i] - centroid) * factor + centroid;
+            compose(Mat4::translation(centroid) * Mat4::scaling(Vec3(factor)) * Mat4::translation(-centroid));
+            if (boundsKnown){
+                // a uniform scale maps the box onto the new one, a negative one swaps its corners
+                Vec3 a = (pendingMin - centroid) * factor + centroid;
+                Vec3 b = (pendingMax - centroid) * factor + centroid;
+                pendingMin = a.min(b);
+                pendingMax = a.max(b);
             }
-            recalcBoundingBox();
         }
 
         void recalcNormals(){
-            for (int i = 0; i < faces.size(); i++){
-                normals.push_back(Vec3(0,0,0));
-            }
-            for (auto face: faces){
-                Vec3 v0 = vertices[face[0] - 1];
-                Vec3 v1 = vertices[face[1] - 1];
-                Vec3 v2 = vertices[face[2] - 1];
+            STATS_TIME(Normals);
+            normals.assign(vertices.size(), Vec3(0));
+            for (uint32_t i = 0; i < indices.size(); i += 3){
+                Vec3 v0 = vertices[indices[i]];
+                Vec3 v1 = vertices[indices[i + 1]];
+                Vec3 v2 = vertices[indices[i + 2]];
                 Vec3 normal = (v1 - v0).cross(v2 - v0).normalise();
-                normals[face[0] - 1] += normal;
-                normals[face[1] - 1] += normal;
-                normals[face[2] - 1] += normal;
+                normals[indices[i]] += normal;
+                normals[indices[i + 1]] += normal;
+                normals[indices[i + 2]] += normal;
             }
-            for (int i = 0; i < normals.size(); i++){
+            for (uint32_t i = 0; i < normals.size(); i++){
                 normals[i] = normals[i].normalise();
             }
         }
 
+        // measures the vertices, any pending steps are applied first
         void recalcBoundingBox(){
+            if (transformed){
+                commit();
+                return;
+            }
             // calculate bounding box for quick intersection testing
             Vec3 vmax = Vec3(-finf);
             Vec3 vmin = Vec3(finf);
@@ -120,157 +102,309 @@ class TriangleMesh: public Observable{
                 vmax = vmax.max(v);
                 vmin = vmin.min(v);
             }
-            std::cout << "vmin: " << vmin << std::endl;
-            std::cout << "vmax: " << vmax << std::endl;
-            Vec3 extend = (vmax - vmin) * 0.01;
-            boundingBox[0] = vmin - extend;
-            boundingBox[1] = vmax + extend;
+            setBounds(vmin, vmax);
         }
 
-        void recalcOctree(){
-            recalcBoundingBox();
-            tree = Octree(boundingBox, faces, vertices, 7);
+        // applies the pending transform steps to the vertices and normals on the pool's threads
+        // and takes the bounds from the same pass, does nothing when no step is pending
+        void commit(ThreadPool* pool = nullptr){
+            if (!transformed) return;
+            STATS_TIME(Transform);
+            const Mat4 matrix = pending;
+            // normals go through the inverse transpose, which keeps them perpendicular under scaling
+            const Mat4 inverse = pending.inverse();
+            uint32_t count = vertices.size();
+            bool withNormals = normals.size() == vertices.size();
+            uint32_t chunks = std::max((count + TRANSFORM_CHUNK - 1) / TRANSFORM_CHUNK, 1u);
+            std::vector<Vec3> mins(chunks, Vec3(finf));
+            std::vector<Vec3> maxs(chunks, Vec3(-finf));
+            auto transformChunk = [&](uint32_t chunk, unsigned){
+                uint32_t first = chunk * TRANSFORM_CHUNK;
+                uint32_t last = std::min(first + TRANSFORM_CHUNK, count);
+                Vec3 vmin = Vec3(finf);
+                Vec3 vmax = Vec3(-finf);
+                for (uint32_t i = first; i < last; i++){
+                    Vec3 v = matrix.transformPoint(vertices[i]);
+                    vertices[i] = v;
+                    vmin = vmin.min(v);
+                    vmax = vmax.max(v);
+                }
+                if (withNormals){
+                    for (uint32_t i = first; i < last; i++){
+                        normals[i] = inverse.transformTransposed(normals[i]).normalise();
+                    }
+                }
+                mins[chunk] = vmin;
+                maxs[chunk] = vmax;
+            };
+            if (pool && pool->size() > 1 && chunks > 1){
+                pool->parallelFor(chunks, transformChunk);
+            }
+            else{
+                for (uint32_t chunk = 0; chunk < chunks; chunk++){
+                    transformChunk(chunk, 0);
+                }
+            }
+            Vec3 vmin = Vec3(finf);
+            Vec3 vmax = Vec3(-finf);
+            for (uint32_t chunk = 0; chunk < chunks; chunk++){
+                vmin = vmin.min(mins[chunk]);
+                vmax = vmax.max(maxs[chunk]);
+            }
+            if (centroidKnown){
+                centroid = matrix.transformPoint(centroid);
+            }
+            pending = Mat4();
+            transformed = false;
+            setBounds(vmin, vmax);
         }
 
-        Vec3 getCentroid(){
-            Vec3 centroid = Vec3(0,0,0);
-            for (const auto& v : vertices){
-                centroid += v;
+        // pool, if given, builds the tree on all its threads
+        void recalcOctree(int depth = 7, ThreadPool* pool = nullptr){
+            commit(pool);
+            STATS_TIME(OctreeBuild);
+            if (!boundsKnown){
+                recalcBoundingBox();
             }
-            centroid / vertices.size();
-            return centroid / vertices.size();
+            bvh = BVH();
+            tree = Octree(boundingBox, vertices, indices, depth, pool);
         }
 
-        void center(){
-            Vec3 cent = (boundingBox[1] + boundingBox[0]) * 0.5f;
-            for (int i = 0; i < vertices.size(); i++){
-                vertices[i] -= cent;
+        void recalcBVH(bool usePackets = true, ThreadPool* pool = nullptr){
+            commit(pool);
+            STATS_TIME(BVHBuild);
+            if (!boundsKnown){
+                recalcBoundingBox();
             }
-            recalcBoundingBox();
+            tree = Octree();
+            bvh.build(vertices, indices, usePackets, pool);
         }
 
-        void floor(){
-            recalcBoundingBox();
-            float miny = boundingBox[0].y;
-            translate(Vec3(0, -miny, 0));
+        /*
+           updates the acceleration structure after the vertices moved, a BVH is refit and only built
+           again once refitting has made it more than limit times as costly to traverse as it was when
+           built, an octree is always built again, returns true if the structure was built again
+        */
+        bool refit(ThreadPool* pool = nullptr, float limit = REFIT_LIMIT){
+            commit(pool);
+            // whatever was known about the old positions is stale
+            boundsKnown = false;
+            centroidKnown = false;
+            if (bvh.empty()){
+                if (!tree.empty()){
+                    recalcOctree(tree.depth, pool);
+                }
+                return true;
+            }
+            float quality;
+            {
+                STATS_TIME(BVHRefit);
+                quality = bvh.refit(vertices, indices, pool);
+            }
+            if (quality > limit){
+                recalcBVH(bvh.hasPackets(), pool);
+                return true;
+            }
+            // the root box is the box of the vertices
+            setBounds(bvh.nodes[0].min, bvh.nodes[0].max);
+            return false;
         }
-        
-        void floor(float floorHeight){
-            float miny = boundingBox[0].y;
-            translate(Vec3(0, -miny + floorHeight, 0));
+
+        uint32_t triangleCount() const{
+            return indices.size() / 3;
         }
 
-        void rotate(float pitch, float roll, float yaw){
-            float cosa = cos(yaw);
-            float sina = sin(yaw);
+        // bytes held by the vertex attributes and indices
+        size_t geometryMemory() const{
+            return (vertices.capacity() + normals.capacity() + texcoords.capacity() + faceNormals.capacity()) * sizeof(Vec3) + indices.capacity() * sizeof(uint32_t);
+        }
+
+        // bytes held by the BVH or octree
+        size_t structureMemory() const{
+            return bvh.memory() + tree.memory();
+        }
 
-            float cosb = cos(pitch);
-            float sinb = sin(pitch);
+        // centroid of the vertices with the pending steps applied
+        Vec3 getCentroid(){
+            if (!centroidKnown){
+                Vec3 sum = Vec3(0,0,0);
+                for (const auto& v : vertices){
+                    sum += v;
+                }
+                centroid = sum / vertices.size();
+                centroidKnown = true;
+            }
+            return pending.transformPoint(centroid);
+        }
 
-            float cosc = cos(roll);
-            float sinc = sin(roll);
+        // moves the middle of the bounding box to the origin
+        void center(){
+            Vec3 box[2];
+            pendingBox(box);
+            translate(-(box[0] + box[1]) * 0.5f);
+        }
 
-            float Axx = cosa * cosb;
-            float Axy = cosa * sinb * sinc - sina * cosc;
-            float Axz = cosa * sinb * cosc + sina * sinc;
+        void floor(){
+            floor(0);
+        }
 
-            float Ayx = sina * cosb;
-            float Ayy = sina * sinb * sinc + cosa * cosc;
-            float Ayz = sina * sinb * cosc - cosa * sinc;
+        // moves the bottom of the bounding box to floorHeight
+        void floor(float floorHeight){
+            Vec3 box[2];
+            pendingBox(box);
+            translate(Vec3(0, -box[0].y + floorHeight, 0));
+        }
 
-            float Azx = -sinb;
-            float Azy = cosb * sinc;
-            float Azz = cosb * cosc;
+        void rotate(float pitch, float roll, float yaw){
+            compose(Mat4::rotation(Vec3(pitch, roll, yaw)));
+            // the rotated box is not the box of the rotated vertices
+            boundsKnown = false;
+        }
 
-            for (int i = 0; i < vertices.size(); i++){
-                Vec3 v = vertices[i];
-                vertices[i] = Vec3(
-                    v.x * Axx + v.y * Ayx + v.z * Azx,
-                    v.x * Axy + v.y * Ayy + v.z * Azy,
-                    v.x * Axz + v.y * Ayz + v.z * Azz
-                );
+        void translate(const Vec3& translation){
+            compose(Mat4::translation(translation));
+            if (boundsKnown){
+                pendingMin += translation;
+                pendingMax += translation;
             }
-            recalcNormals();
-            recalcBoundingBox();
         }
 
-        void translate(const Vec3& translation){
-            for(auto& v : vertices){
-                v += translation;
+        // the steps run in the order of MeshTransform and are applied in one pass at the end
+        void applyTransform(const MeshTransform& transform, ThreadPool* pool = nullptr){
+            if (transform.rotation != Vec3(0)){
+                rotate(transform.rotation.x, transform.rotation.y, transform.rotation.z);
             }
-            recalcBoundingBox();
+            if (transform.scale != 1){
+                rescale(transform.scale);
+            }
+            if (transform.center){
+                center();
+            }
+            if (transform.floor){
+                floor(transform.floorHeight);
+            }
+            if (transform.translation != Vec3(0)){
+                translate(transform.translation);
+            }
+            commit(pool);
         }
 
         ~TriangleMesh(){
             vertices.clear();
             normals.clear();
             texcoords.clear();
-            faces.clear();
+            indices.clear();
         }
 
-        bool intersection(Ray& ray, Intersection& inter){
+        bool intersection(const Ray& ray, Intersection& inter) const{
             if (!AABBIntersection(boundingBox[0], boundingBox[1], ray)){
                 return false;
             }
-            int index = -1;
-            float pu = 0;
-            float pv = 0;
-            bool in = false;
-            std::vector<std::vector<int>> possibleFaces = tree.intersection(ray);
-            // check if all elements in possibleFaces are in faces
-            if (possibleFaces.size() == 0){
+            TriangleHit hit;
+            hit.timestep = inter.timestep;
+            if (!bvh.empty()){
+                if (!bvh.intersection(ray, vertices, indices, hit)){
+                    return false;
+                }
+            }
+            else if (!tree.intersection(ray, vertices, indices, hit)){
                 return false;
             }
-            //std::cout << "possibleFaces: " << possibleFaces.size() << std::endl;
-            for(int i = 0; i < possibleFaces.size(); i++){
-                // check if ray intersects face by using moller-trumbore algorithm
-                auto face = possibleFaces[i];
-                Vec3 v0 = vertices[face[0] - 1];
-                Vec3 v1 = vertices[face[1] - 1];
-                Vec3 v2 = vertices[face[2] - 1];
-                Vec3 v0v1 = v1 - v0;
-                Vec3 v0v2 = v2 - v0;
-                Vec3 pvec = ray.direction.cross(v0v2);
-                float det = v0v1.dot(pvec);
-                if (std::fabs(det) < EPSILLON){
-                    continue;
-                }
-
-                float invdet = 1.0 / det;
-                Vec3 tvec = ray.origin - v0;
-                float u = tvec.dot(pvec) * invdet;
-                
-                if (u < 0 || u > 1){
-                    continue;
-                }
+            inter.timestep = hit.timestep;
+            setIntersection(ray, inter, hit.face, hit.u, hit.v, hit.backface);
+            return true;
+        }
 
-                Vec3 qvec = tvec.cross(v0v1);
-                float v = ray.direction.dot(qvec) * invdet;
+        uint32_t intersection(const RayPacket& packet, Intersection* inter) const{
+            if (bvh.empty()){
+                return Observable::intersection(packet, inter);
+            }
+            TriangleHit hits[RayPacket::SIZE];
+            for (int i = 0; i < RayPacket::SIZE; i++){
+                hits[i].timestep = inter[i].timestep;
+            }
+            uint32_t found = bvh.intersection(packet, vertices, indices, hits);
+            for (uint32_t bits = found; bits; bits &= bits - 1){
+                int i = __builtin_ctz(bits);
+                inter[i].timestep = hits[i].timestep;
+                setIntersection(packet.rays[i], inter[i], hits[i].face, hits[i].u, hits[i].v, hits[i].backface);
+            }
+            return found;
+        }
 
-                if (v < 0 || u + v > 1){
-                    continue;
-                }
+        bool occluded(const Ray& ray, float tmax) const{
+            if (!AABBIntersection(boundingBox[0], boundingBox[1], ray)){
+                return false;
+            }
+            if (!bvh.empty()){
+                return bvh.occluded(ray, tmax, vertices, indices);
+            }
+            return tree.occluded(ray, tmax, vertices, indices);
+        }
 
-                float t = v0v2.dot(qvec) * invdet;
-                if (t > EPSILLON && t < inter.timestep){
-                    in = (det < 0);
-                    pu = u;
-                    pv = v;
-                    inter.timestep = t;
-                    index = i;
-                }
+        uint32_t occluded(const RayPacket& packet, const float* tmax) const{
+            if (bvh.empty()){
+                return Observable::occluded(packet, tmax);
             }
-            // index is greater than -1 if there is an intersection
-            if (index > -1){
-                inter.inside = in;
-                inter.point = ray.attime(inter.timestep);
-                auto face = possibleFaces[index];
-                inter.normal = normals[face[0] - 1] * (1 - pu - pv) + normals[face[1] - 1] * pu + normals[face[2] - 1] * pv;
-                inter.set_face_normal(ray, inter.normal);
-                inter.colour = colour;
+            return bvh.occluded(packet, tmax, vertices, indices);
+        }
+
+        bool bounds(Vec3& min, Vec3& max) const{
+            if (vertices.empty()){
+                // empty box, left out of the scene
+                min = Vec3(finf);
+                max = Vec3(-finf);
                 return true;
             }
-            return false;
+            min = boundingBox[0];
+            max = boundingBox[1];
+            return true;
+        }
+
+    private:
+        // the step runs after the ones already pending
+        void compose(const Mat4& step){
+            pending = step * pending;
+            transformed = true;
+        }
+
+        // the bounding box as padded by setBounds, with the pending steps applied
+        void pendingBox(Vec3 box[2]){
+            if (!boundsKnown){
+                // measured without touching the vertices, the pass of commit is still the only write
+                Vec3 vmin = Vec3(finf);
+                Vec3 vmax = Vec3(-finf);
+                for (const auto& v : vertices){
+                    Vec3 p = pending.transformPoint(v);
+                    vmin = vmin.min(p);
+                    vmax = vmax.max(p);
+                }
+                pendingMin = vmin;
+                pendingMax = vmax;
+                boundsKnown = true;
+            }
+            Vec3 extend = (pendingMax - pendingMin) * 0.01;
+            box[0] = pendingMin - extend;
+            box[1] = pendingMax + extend;
+        }
+
+        // bounds of the vertices as they are now, the box is padded a little
+        void setBounds(const Vec3& vmin, const Vec3& vmax){
+            pendingMin = vmin;
+            pendingMax = vmax;
+            boundsKnown = true;
+            Vec3 extend = (vmax - vmin) * 0.01;
+            boundingBox[0] = vmin - extend;
+            boundingBox[1] = vmax + extend;
+        }
+
+        void setIntersection(const Ray& ray, Intersection& inter, uint32_t face, float u, float v, bool in) const{
+            const uint32_t* tri = &indices[face * 3];
+            inter.inside = in;
+            inter.point = ray.origin + ray.direction * inter.timestep;
+            inter.normal = normals[tri[0]] * (1 - u - v) + normals[tri[1]] * u + normals[tri[2]] * v;
+            inter.set_face_normal(ray, inter.normal);
+            inter.colour = colour;
         }
 
     public:
@@ -278,8 +412,27 @@ class TriangleMesh: public Observable{
         std::vector<Vec3> normals;
         std::vector<Vec3> texcoords;
         std::vector<Vec3> faceNormals;
-        std::vector<std::vector<int>> faces;
+        // three vertex indices per triangle, zero based
+        std::vector<uint32_t> indices;
         Vec3 boundingBox[2];
         Octree tree;
+        BVH bvh;
         Vec3 colour;
+
+        // refit accepts a BVH this many times as costly as a fresh build before building again
+        static constexpr float REFIT_LIMIT = 1.5f;
+
+    private:
+        // vertices per work item of commit
+        static constexpr uint32_t TRANSFORM_CHUNK = 16384;
+        // transform steps not yet applied to the vertices
+        Mat4 pending;
+        bool transformed = false;
+        // exact vertex bounds with pending applied, only known until a rotation
+        Vec3 pendingMin;
+        Vec3 pendingMax;
+        bool boundsKnown = false;
+        // centroid of the vertices as stored, without pending
+        Vec3 centroid;
+        bool centroidKnown = false;
 };
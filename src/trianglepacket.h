@@ -0,0 +1,234 @@
+#pragma once
+
+#include "ray.h"
+#include "observables.h"
+#include "raypacket.h"
+#include <cstdint>
+#include <cstring>
+
+
+const int PACKET_WIDTH = 8;
+// padding lanes carry this face id and a degenerate triangle that is never hit
+const uint32_t PACKET_EMPTY = UINT32_MAX;
+
+
+// result of a closest hit query against a mesh acceleration structure
+struct TriangleHit{
+    float timestep;
+    float u, v;
+    uint32_t face;
+    bool backface;
+
+    TriangleHit(){
+        timestep = finf;
+        face = UINT32_MAX;
+    }
+};
+
+
+// eight triangles stored as structure of arrays, each as a vertex and two edges
+struct alignas(32) TrianglePacket{
+    float v0x[PACKET_WIDTH], v0y[PACKET_WIDTH], v0z[PACKET_WIDTH];
+    float e1x[PACKET_WIDTH], e1y[PACKET_WIDTH], e1z[PACKET_WIDTH];
+    float e2x[PACKET_WIDTH], e2y[PACKET_WIDTH], e2z[PACKET_WIDTH];
+    uint32_t face[PACKET_WIDTH];
+
+    TrianglePacket(){
+        memset(this, 0, sizeof(TrianglePacket));
+        for (int i = 0; i < PACKET_WIDTH; i++){
+            face[i] = PACKET_EMPTY;
+        }
+    }
+
+    void set(int lane, uint32_t id, const Vec3& v0, const Vec3& v1, const Vec3& v2){
+        Vec3 e1 = v1 - v0;
+        Vec3 e2 = v2 - v0;
+        v0x[lane] = v0.x; v0y[lane] = v0.y; v0z[lane] = v0.z;
+        e1x[lane] = e1.x; e1y[lane] = e1.y; e1z[lane] = e1.z;
+        e2x[lane] = e2.x; e2y[lane] = e2.y; e2z[lane] = e2.z;
+        face[lane] = id;
+    }
+};
+
+static_assert(sizeof(TrianglePacket) == 320, "TrianglePacket should be 320 bytes");
+
+
+// intersects a ray with every triangle of a packet, updating hit when a closer one is found
+typedef bool (*PacketKernel)(const Ray& ray, const TrianglePacket& packet, TriangleHit& hit);
+
+
+inline bool intersectPacketScalar(const Ray& ray, const TrianglePacket& packet, TriangleHit& hit){
+    bool found = false;
+    for (int i = 0; i < PACKET_WIDTH; i++){
+        if (packet.face[i] == PACKET_EMPTY) continue;
+        float t, u, v;
+        bool backface;
+        Vec3 v0 = Vec3(packet.v0x[i], packet.v0y[i], packet.v0z[i]);
+        Vec3 e1 = Vec3(packet.e1x[i], packet.e1y[i], packet.e1z[i]);
+        Vec3 e2 = Vec3(packet.e2x[i], packet.e2y[i], packet.e2z[i]);
+        if (rayTriangleEdgesIntersection(ray, v0, e1, e2, t, u, v, backface) && t > EPSILLON && t < hit.timestep){
+            hit.timestep = t;
+            hit.u = u;
+            hit.v = v;
+            hit.backface = backface;
+            hit.face = packet.face[i];
+            found = true;
+        }
+    }
+    return found;
+}
+
+
+#ifdef RT_X86_SIMD
+
+// moller-trumbore on four lanes of a packet starting at lane offset, hits beyond tmax are masked out
+__attribute__((target("sse2")))
+inline __m128 intersectLanesSSE(const Ray& ray, const TrianglePacket& packet, int offset, __m128 tmax, __m128& t, __m128& u, __m128& v, __m128& det){
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+    __m128 e1x = _mm_load_ps(packet.e1x + offset), e1y = _mm_load_ps(packet.e1y + offset), e1z = _mm_load_ps(packet.e1z + offset);
+    __m128 e2x = _mm_load_ps(packet.e2x + offset), e2y = _mm_load_ps(packet.e2y + offset), e2z = _mm_load_ps(packet.e2z + offset);
+
+    // pvec = direction x e2
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 mask = _mm_cmpge_ps(_mm_andnot_ps(signMask, det), _mm_set1_ps(EPSILLON));
+    __m128 invdet = _mm_div_ps(one, det);
+
+    __m128 tx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_load_ps(packet.v0x + offset));
+    __m128 ty = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_load_ps(packet.v0y + offset));
+    __m128 tz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_load_ps(packet.v0z + offset));
+    u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invdet);
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+
+    // qvec = tvec x e1
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+    v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invdet);
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+
+    t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invdet);
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(EPSILLON)), _mm_cmplt_ps(t, tmax)));
+    return mask;
+}
+
+__attribute__((target("sse2")))
+inline bool intersectPacketSSE(const Ray& ray, const TrianglePacket& packet, TriangleHit& hit){
+    bool found = false;
+    for (int offset = 0; offset < PACKET_WIDTH; offset += 4){
+        __m128 t, u, v, det;
+        __m128 mask = intersectLanesSSE(ray, packet, offset, _mm_set1_ps(hit.timestep), t, u, v, det);
+        int bits = _mm_movemask_ps(mask);
+        if (bits == 0) continue;
+        // horizontal min over the lanes that hit
+        __m128 masked = _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, _mm_set1_ps(finf)));
+        __m128 m = _mm_min_ps(masked, _mm_shuffle_ps(masked, masked, _MM_SHUFFLE(2, 3, 0, 1)));
+        m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        int lane = __builtin_ctz(_mm_movemask_ps(_mm_cmpeq_ps(masked, m)) & bits);
+        alignas(16) float ts[4], us[4], vs[4], dets[4];
+        _mm_store_ps(ts, t);
+        _mm_store_ps(us, u);
+        _mm_store_ps(vs, v);
+        _mm_store_ps(dets, det);
+        hit.timestep = ts[lane];
+        hit.u = us[lane];
+        hit.v = vs[lane];
+        hit.backface = dets[lane] < 0;
+        hit.face = packet.face[offset + lane];
+        found = true;
+    }
+    return found;
+}
+
+__attribute__((target("avx2,fma")))
+inline bool intersectPacketAVX2(const Ray& ray, const TrianglePacket& packet, TriangleHit& hit){
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 dx = _mm256_set1_ps(ray.direction.x), dy = _mm256_set1_ps(ray.direction.y), dz = _mm256_set1_ps(ray.direction.z);
+    __m256 e1x = _mm256_load_ps(packet.e1x), e1y = _mm256_load_ps(packet.e1y), e1z = _mm256_load_ps(packet.e1z);
+    __m256 e2x = _mm256_load_ps(packet.e2x), e2y = _mm256_load_ps(packet.e2y), e2z = _mm256_load_ps(packet.e2z);
+
+    // pvec = direction x e2
+    __m256 px = _mm256_fmsub_ps(dy, e2z, _mm256_mul_ps(dz, e2y));
+    __m256 py = _mm256_fmsub_ps(dz, e2x, _mm256_mul_ps(dx, e2z));
+    __m256 pz = _mm256_fmsub_ps(dx, e2y, _mm256_mul_ps(dy, e2x));
+    __m256 det = _mm256_fmadd_ps(e1x, px, _mm256_fmadd_ps(e1y, py, _mm256_mul_ps(e1z, pz)));
+    __m256 mask = _mm256_cmp_ps(_mm256_andnot_ps(signMask, det), _mm256_set1_ps(EPSILLON), _CMP_GE_OQ);
+    __m256 invdet = _mm256_div_ps(one, det);
+
+    __m256 tx = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_load_ps(packet.v0x));
+    __m256 ty = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_load_ps(packet.v0y));
+    __m256 tz = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_load_ps(packet.v0z));
+    __m256 u = _mm256_mul_ps(_mm256_fmadd_ps(tx, px, _mm256_fmadd_ps(ty, py, _mm256_mul_ps(tz, pz))), invdet);
+    mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+
+    // qvec = tvec x e1
+    __m256 qx = _mm256_fmsub_ps(ty, e1z, _mm256_mul_ps(tz, e1y));
+    __m256 qy = _mm256_fmsub_ps(tz, e1x, _mm256_mul_ps(tx, e1z));
+    __m256 qz = _mm256_fmsub_ps(tx, e1y, _mm256_mul_ps(ty, e1x));
+    __m256 v = _mm256_mul_ps(_mm256_fmadd_ps(dx, qx, _mm256_fmadd_ps(dy, qy, _mm256_mul_ps(dz, qz))), invdet);
+    mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+
+    __m256 t = _mm256_mul_ps(_mm256_fmadd_ps(e2x, qx, _mm256_fmadd_ps(e2y, qy, _mm256_mul_ps(e2z, qz))), invdet);
+    mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(EPSILLON), _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(hit.timestep), _CMP_LT_OQ)));
+
+    int bits = _mm256_movemask_ps(mask);
+    if (bits == 0) return false;
+    // horizontal min over the lanes that hit
+    __m256 masked = _mm256_blendv_ps(_mm256_set1_ps(finf), t, mask);
+    __m256 m = _mm256_min_ps(masked, _mm256_permute_ps(masked, _MM_SHUFFLE(2, 3, 0, 1)));
+    m = _mm256_min_ps(m, _mm256_permute_ps(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm256_min_ps(m, _mm256_permute2f128_ps(m, m, 0x01));
+    int lane = __builtin_ctz(_mm256_movemask_ps(_mm256_cmp_ps(masked, m, _CMP_EQ_OQ)) & bits);
+    alignas(32) float ts[8], us[8], vs[8], dets[8];
+    _mm256_store_ps(ts, t);
+    _mm256_store_ps(us, u);
+    _mm256_store_ps(vs, v);
+    _mm256_store_ps(dets, det);
+    hit.timestep = ts[lane];
+    hit.u = us[lane];
+    hit.v = vs[lane];
+    hit.backface = dets[lane] < 0;
+    hit.face = packet.face[lane];
+    return true;
+}
+
+#endif
+
+
+// name of a kernel for reporting, the order matches availablePacketKernels
+inline const char* packetKernelName(PacketKernel kernel){
+#ifdef RT_X86_SIMD
+    if (kernel == intersectPacketAVX2) return "avx2";
+    if (kernel == intersectPacketSSE) return "sse";
+#endif
+    return "scalar";
+}
+
+// every kernel the current CPU can run, slowest first
+inline int availablePacketKernels(PacketKernel kernels[3]){
+    int count = 0;
+    kernels[count++] = intersectPacketScalar;
+#ifdef RT_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) kernels[count++] = intersectPacketSSE;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) kernels[count++] = intersectPacketAVX2;
+#endif
+    return count;
+}
+
+// fastest kernel supported by the CPU, picked once at startup
+inline PacketKernel packetKernel(){
+    static const PacketKernel best = []{
+        PacketKernel kernels[3];
+        int count = availablePacketKernels(kernels);
+        return kernels[count - 1];
+    }();
+    return best;
+}
@@ -0,0 +1,1120 @@
+// checks of the renderer's building blocks against simple reference implementations
+// usage: tests [names], runs every test when no names are given, exits with 1 if any check failed
+// run from a scratch directory, the OBJ, image, mesh cache, scene file and tiles tests write files into it
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include "../src/bvh.h"
+#include "../src/meshcache.h"
+#include "../src/framebuffer.h"
+#include "../src/imagewriter.h"
+#include "../src/threadpool.h"
+#include "../src/renderer.h"
+#include "../src/scenefile.h"
+#include "../src/stats.h"
+
+
+// counts heap allocations, the tiles test checks that frames after the first make none
+STATS_ALLOCATION_HOOK
+
+
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static bool check(bool condition, const char* text, const char* file, int line){
+    if (!condition){
+        std::cerr << file << ":" << line << ": check failed: " << text << std::endl;
+        failures++;
+    }
+    return condition;
+}
+
+static std::vector<uint8_t> readFile(const std::string& path){
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static uint32_t get32(const uint8_t* p){
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+template<typename T>
+static bool sameBytes(const std::vector<T>& a, const std::vector<T>& b){
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+
+// closest hit over every triangle, the reference the BVH must agree with
+static bool bruteForce(const Ray& ray, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, float& closest){
+    closest = finf;
+    for (size_t i = 0; i < indices.size(); i += 3){
+        float t, u, v;
+        bool backface;
+        if (rayTriangleIntersection(ray, vertices[indices[i]], vertices[indices[i + 1]], vertices[indices[i + 2]], t, u, v, backface)){
+            if (t > EPSILLON && t < closest) closest = t;
+        }
+    }
+    return closest < finf;
+}
+
+static bool sameHit(bool found, float t, bool expected, float reference){
+    return found == expected && (!found || std::fabs(t - reference) <= 1e-4f * std::max(1.0f, reference));
+}
+
+static int depth(const BVH& bvh, uint32_t index){
+    const BVHNode& node = bvh.nodes[index];
+    if (node.isLeaf()) return 1;
+    return 1 + std::max(depth(bvh, index + 1), depth(bvh, node.leftFirst));
+}
+
+// small triangles scattered through a box, or strung out at exponentially shrinking distances,
+// which used to make the build peel off one triangle per level
+static void triangleSoup(uint32_t count, bool skewed, std::vector<Vec3>& vertices, std::vector<uint32_t>& indices){
+    std::mt19937 rng(count);
+    std::uniform_real_distribution<float> unit(-1, 1);
+    for (uint32_t i = 0; i < count; i++){
+        Vec3 centre = skewed ? Vec3(std::pow(0.97f, (float) i) * 10, 0, 0) : Vec3(unit(rng), unit(rng), unit(rng)) * 10;
+        uint32_t first = vertices.size();
+        for (int k = 0; k < 3; k++){
+            vertices.push_back(centre + Vec3(unit(rng), unit(rng), unit(rng)) * 0.5f);
+            indices.push_back(first + k);
+        }
+    }
+}
+
+// rays from a sphere around the soup towards points inside it, so most of them hit something
+static std::vector<Ray> testRays(uint32_t count){
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> unit(-1, 1);
+    std::vector<Ray> rays;
+    for (uint32_t i = 0; i < count; i++){
+        Vec3 origin = Vec3(unit(rng), unit(rng), unit(rng)).normalise() * 25;
+        Vec3 target = Vec3(unit(rng), unit(rng), unit(rng)) * 10;
+        rays.push_back(Ray(origin, (target - origin).normalise()));
+    }
+    return rays;
+}
+
+// single rays, packets and any hit queries of bvh that disagree with brute force
+static int mismatches(const BVH& bvh, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, const std::vector<Ray>& rays){
+    int count = 0;
+    for (size_t i = 0; i + RayPacket::SIZE <= rays.size(); i += RayPacket::SIZE){
+        RayPacket packet;
+        TriangleHit packetHits[RayPacket::SIZE];
+        float tmax[RayPacket::SIZE];
+        float reference[RayPacket::SIZE];
+        bool expected[RayPacket::SIZE];
+        for (int k = 0; k < RayPacket::SIZE; k++){
+            const Ray& ray = rays[i + k];
+            packet.set(k, ray);
+            expected[k] = bruteForce(ray, vertices, indices, reference[k]);
+            TriangleHit hit;
+            bool found = bvh.intersection(ray, vertices, indices, hit);
+            count += !sameHit(found, hit.timestep, expected[k], reference[k]);
+            // halfway to the closest hit nothing blocks the ray, just past it something does
+            float half = expected[k] ? reference[k] * 0.5f : 100.0f;
+            count += bvh.occluded(ray, half, vertices, indices);
+            if (expected[k]){
+                count += !bvh.occluded(ray, reference[k] * 1.01f, vertices, indices);
+            }
+            tmax[k] = half;
+        }
+        uint32_t found = bvh.intersection(packet, vertices, indices, packetHits);
+        uint32_t blocked = bvh.occluded(packet, tmax, vertices, indices);
+        for (int k = 0; k < RayPacket::SIZE; k++){
+            count += !sameHit(found >> k & 1, packetHits[k].timestep, expected[k], reference[k]);
+            count += blocked >> k & 1;
+        }
+    }
+    return count;
+}
+
+// single rays, packets and any hit queries against brute force, for every build the renderer makes
+static void testBVH(){
+    ThreadPool pool(8);
+    struct Case{
+        uint32_t triangles;
+        bool skewed;
+    };
+    // the largest soup is big enough for the parallel build
+    for (Case c: {Case{2000, false}, Case{3000, true}, Case{40000, false}}){
+        std::vector<Vec3> vertices;
+        std::vector<uint32_t> indices;
+        triangleSoup(c.triangles, c.skewed, vertices, indices);
+        std::vector<Ray> rays = testRays(512);
+        for (bool packets: {false, true}){
+            BVH bvh(vertices, indices, packets, &pool);
+            BVH serial(vertices, indices, packets);
+            CHECK(bvh.nodes.size() == serial.nodes.size());
+            // median splits keep even the skewed soup far from the traversal stack's limit
+            CHECK(depth(bvh, 0) <= 64);
+            CHECK(mismatches(bvh, vertices, indices, rays) == 0);
+        }
+    }
+}
+
+
+// levels below node, 0 for a leaf
+static int levels(const Octree& tree, uint32_t index){
+    const OctreeNode& node = tree.nodes[index];
+    if (node.leaf) return 0;
+    int deepest = 0;
+    for (uint32_t child = node.first; child < node.first + node.count; child++){
+        deepest = std::max(deepest, levels(tree, child));
+    }
+    return 1 + deepest;
+}
+
+static bool sameTree(const Octree& a, const Octree& b){
+    if (a.nodes.size() != b.nodes.size() || a.faces != b.faces) return false;
+    for (size_t i = 0; i < a.nodes.size(); i++){
+        const OctreeNode& x = a.nodes[i];
+        const OctreeNode& y = b.nodes[i];
+        if (x.min != y.min || x.max != y.max || x.first != y.first || x.count != y.count || x.leaf != y.leaf) return false;
+    }
+    return true;
+}
+
+// closest hit and any hit queries of tree that disagree with brute force
+static int mismatches(const Octree& tree, const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices, const std::vector<Ray>& rays){
+    int count = 0;
+    for (const Ray& ray: rays){
+        float reference;
+        bool expected = bruteForce(ray, vertices, indices, reference);
+        TriangleHit hit;
+        bool found = tree.intersection(ray, vertices, indices, hit);
+        count += !sameHit(found, hit.timestep, expected, reference);
+        float half = expected ? reference * 0.5f : 100.0f;
+        count += tree.occluded(ray, half, vertices, indices);
+        if (expected){
+            count += !tree.occluded(ray, reference * 1.01f, vertices, indices);
+        }
+    }
+    return count;
+}
+
+// closest and any hits against brute force at every depth up to the deepest the traversal stacks hold,
+// built serially and in parallel into the same layout
+static void testOctree(){
+    ThreadPool pool(8);
+    std::vector<Vec3> vertices;
+    std::vector<uint32_t> indices;
+    triangleSoup(3000, false, vertices, indices);
+    // a dozen specks at one point near the origin, where floats still tell the boxes apart at the deepest
+    // level, keep more triangles than a leaf holds in the octant around them all the way down
+    Vec3 speck(1.1e-7f, 2.3e-7f, 3.7e-7f);
+    for (int i = 0; i < 12; i++){
+        uint32_t first = vertices.size();
+        vertices.push_back(speck);
+        vertices.push_back(speck + Vec3(1e-10f, 0, 0));
+        vertices.push_back(speck + Vec3(0, 1e-10f, 0));
+        for (int k = 0; k < 3; k++){
+            indices.push_back(first + k);
+        }
+    }
+    Vec3 box[2] = {Vec3(finf), Vec3(-finf)};
+    for (const Vec3& v: vertices){
+        box[0] = box[0].min(v);
+        box[1] = box[1].max(v);
+    }
+    std::vector<Ray> rays = testRays(512);
+    // and rays at the specks, through the deepest nodes
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> unit(-1, 1);
+    for (int i = 0; i < 128; i++){
+        Vec3 origin = Vec3(unit(rng), unit(rng), unit(rng)).normalise() * 25;
+        Vec3 target = speck + Vec3(unit(rng), unit(rng), unit(rng)) * 1e-9f;
+        rays.push_back(Ray(origin, (target - origin).normalise()));
+    }
+    for (int depth: {1, 4, 7, Octree::MAX_DEPTH}){
+        Octree tree(box, vertices, indices, depth, &pool);
+        Octree serial(box, vertices, indices, depth);
+        CHECK(sameTree(tree, serial));
+        CHECK(levels(tree, 0) == depth);
+        CHECK(mismatches(tree, vertices, indices, rays) == 0);
+    }
+    // deeper than the stacks hold is built to the deepest they do
+    Octree clamped(box, vertices, indices, Octree::MAX_DEPTH + 10);
+    CHECK(clamped.depth == Octree::MAX_DEPTH && levels(clamped, 0) == Octree::MAX_DEPTH);
+}
+
+
+// a mesh over a soup of count triangles with a BVH, or an octree of octreeDepth levels
+static TriangleMesh soupMesh(uint32_t count, bool packets, int octreeDepth, ThreadPool& pool){
+    TriangleMesh mesh(Vec3(255), nullptr);
+    triangleSoup(count, false, mesh.vertices, mesh.indices);
+    mesh.recalcNormals();
+    mesh.recalcBoundingBox();
+    if (octreeDepth > 0){
+        mesh.recalcOctree(octreeDepth, &pool);
+    }
+    else{
+        mesh.recalcBVH(packets, &pool);
+    }
+    return mesh;
+}
+
+static bool containsVertices(const TriangleMesh& mesh){
+    for (const Vec3& v: mesh.vertices){
+        if (!(v >= mesh.boundingBox[0] && v <= mesh.boundingBox[1])) return false;
+    }
+    return true;
+}
+
+// a refit BVH answers like brute force on the moved vertices, and is built again once it got too costly
+static void testRefit(){
+    ThreadPool pool(4);
+    std::vector<Ray> rays = testRays(512);
+    for (bool packets: {false, true}){
+        // enough leaves for the refit to run on the pool
+        TriangleMesh mesh = soupMesh(20000, packets, 0, pool);
+        size_t nodes = mesh.bvh.nodes.size();
+        std::mt19937 rng(11);
+        std::uniform_real_distribution<float> unit(-1, 1);
+        // a small wobble keeps the tree about as good as a fresh one
+        for (Vec3& v: mesh.vertices){
+            v += Vec3(unit(rng), unit(rng), unit(rng)) * 0.05f;
+        }
+        CHECK(!mesh.refit(&pool));
+        CHECK(mesh.bvh.nodes.size() == nodes);
+        CHECK(containsVertices(mesh));
+        CHECK(mismatches(mesh.bvh, mesh.vertices, mesh.indices, rays) == 0);
+
+        // triangles jumping across the soup leave every box spanning most of it
+        for (size_t i = 0; i < mesh.vertices.size(); i += 3){
+            Vec3 jump = Vec3(unit(rng), unit(rng), unit(rng)) * 10 - mesh.vertices[i];
+            for (size_t k = i; k < i + 3; k++){
+                mesh.vertices[k] += jump;
+            }
+        }
+        // without a limit the refit tree is kept, slow but still right
+        CHECK(!mesh.refit(&pool, finf));
+        CHECK(mesh.bvh.nodes.size() == nodes);
+        CHECK(mismatches(mesh.bvh, mesh.vertices, mesh.indices, rays) == 0);
+        CHECK(mesh.bvh.refit(mesh.vertices, mesh.indices) > TriangleMesh::REFIT_LIMIT);
+        // with the default one it falls back to a fresh build with the same kind of leaves
+        CHECK(mesh.refit(&pool));
+        BVH fresh(mesh.vertices, mesh.indices, packets);
+        CHECK(mesh.bvh.nodes.size() == fresh.nodes.size());
+        CHECK(mesh.bvh.hasPackets() == packets);
+        CHECK(mesh.bvh.refit(mesh.vertices, mesh.indices) == 1);
+        CHECK(containsVertices(mesh));
+        CHECK(mismatches(mesh.bvh, mesh.vertices, mesh.indices, rays) == 0);
+    }
+    // an octree is always built again, at its depth
+    TriangleMesh mesh = soupMesh(3000, false, 5, pool);
+    for (Vec3& v: mesh.vertices){
+        v = v * 0.5f + Vec3(1, 0, 0);
+    }
+    CHECK(mesh.refit(&pool));
+    CHECK(mesh.bvh.empty() && mesh.tree.depth == 5);
+    CHECK(containsVertices(mesh));
+    CHECK(mismatches(mesh.tree, mesh.vertices, mesh.indices, rays) == 0);
+}
+
+
+// the transform steps applied one at a time straight to the vertices, bounds measured again before each
+// step that needs them, as the mesh did before its steps were made lazy
+static void eagerTransform(std::vector<Vec3>& vertices, std::vector<Vec3>& normals, const MeshTransform& transform){
+    auto apply = [&](const Mat4& matrix){
+        for (Vec3& v: vertices){
+            v = matrix.transformPoint(v);
+        }
+    };
+    // padded like the mesh's bounding box
+    auto box = [&](Vec3& lo, Vec3& hi){
+        lo = Vec3(finf);
+        hi = Vec3(-finf);
+        for (const Vec3& v: vertices){
+            lo = lo.min(v);
+            hi = hi.max(v);
+        }
+        Vec3 extend = (hi - lo) * 0.01;
+        lo -= extend;
+        hi += extend;
+    };
+    Vec3 lo, hi;
+    if (transform.rotation != Vec3(0)){
+        Mat4 rotation = Mat4::rotation(transform.rotation);
+        apply(rotation);
+        for (Vec3& n: normals){
+            n = rotation.transformPoint(n).normalise();
+        }
+    }
+    if (transform.scale != 1){
+        Vec3 centroid(0);
+        for (const Vec3& v: vertices){
+            centroid += v;
+        }
+        centroid = centroid / vertices.size();
+        apply(Mat4::translation(centroid) * Mat4::scaling(Vec3(transform.scale)) * Mat4::translation(-centroid));
+    }
+    if (transform.center){
+        box(lo, hi);
+        apply(Mat4::translation(-(lo + hi) * 0.5f));
+    }
+    if (transform.floor){
+        box(lo, hi);
+        apply(Mat4::translation(Vec3(0, -lo.y + transform.floorHeight, 0)));
+    }
+    if (transform.translation != Vec3(0)){
+        apply(Mat4::translation(transform.translation));
+    }
+}
+
+static bool nearly(const std::vector<Vec3>& a, const std::vector<Vec3>& b, float tolerance){
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++){
+        if ((a[i] - b[i]).length() > tolerance * (1 + b[i].length())) return false;
+    }
+    return true;
+}
+
+// pending transform steps leave the vertices alone until commit, which gives what applying them one
+// by one did, with the bounds from the same pass, on one thread as on a pool
+static void testTransform(){
+    ThreadPool pool(4);
+    std::vector<MeshTransform> transforms(4);
+    transforms[0].rotation = Vec3(0.4f, -1.1f, 2.3f);
+    // without a rotation the bounds stay known, rescale, center and floor move them instead of measuring again
+    transforms[1].scale = 0.3f;
+    transforms[1].center = true;
+    transforms[1].floor = true;
+    transforms[1].floorHeight = -2;
+    transforms[2].rotation = Vec3(0.3f, 0, 0.1f);
+    transforms[2].scale = 2.5f;
+    transforms[2].center = true;
+    transforms[2].floor = true;
+    transforms[2].translation = Vec3(1, 2, -3);
+    transforms[3].scale = 4;
+    transforms[3].floor = true;
+    transforms[3].floorHeight = 1;
+    transforms[3].translation = Vec3(-5, 0, 0);
+    for (const MeshTransform& transform: transforms){
+        // more vertices than one work item of commit
+        TriangleMesh serial(Vec3(255), nullptr);
+        triangleSoup(12000, false, serial.vertices, serial.indices);
+        serial.recalcNormals();
+        serial.recalcBoundingBox();
+        TriangleMesh parallel = serial;
+        std::vector<Vec3> vertices = serial.vertices;
+        std::vector<Vec3> normals = serial.normals;
+        eagerTransform(vertices, normals, transform);
+
+        std::vector<Vec3> before = serial.vertices;
+        if (transform.rotation != Vec3(0)){
+            serial.rotate(transform.rotation.x, transform.rotation.y, transform.rotation.z);
+        }
+        if (transform.scale != 1){
+            serial.rescale(transform.scale);
+        }
+        if (transform.center){
+            serial.center();
+        }
+        if (transform.floor){
+            serial.floor(transform.floorHeight);
+        }
+        if (transform.translation != Vec3(0)){
+            serial.translate(transform.translation);
+        }
+        CHECK(serial.vertices == before);
+        serial.commit();
+        parallel.applyTransform(transform, &pool);
+
+        CHECK(nearly(serial.vertices, vertices, 1e-5f));
+        CHECK(nearly(serial.normals, normals, 1e-5f));
+        CHECK(sameBytes(parallel.vertices, serial.vertices));
+        CHECK(sameBytes(parallel.normals, serial.normals));
+        // the bounds of the pass are the bounds of the vertices
+        Vec3 box[2] = {serial.boundingBox[0], serial.boundingBox[1]};
+        serial.recalcBoundingBox();
+        CHECK(box[0] == serial.boundingBox[0] && box[1] == serial.boundingBox[1]);
+        CHECK(parallel.boundingBox[0] == serial.boundingBox[0] && parallel.boundingBox[1] == serial.boundingBox[1]);
+    }
+}
+
+
+// reads back a QOI file following the specification, pixels as RGB bytes
+static bool decodeQOI(const std::vector<uint8_t>& file, int& width, int& height, std::vector<uint8_t>& rgb){
+    if (file.size() < 22 || get32(file.data()) != 0x716f6966) return false;
+    width = get32(file.data() + 4);
+    height = get32(file.data() + 8);
+    uint8_t lookup[64][4] = {};
+    uint8_t pixel[4] = {0, 0, 0, 255};
+    size_t p = 14;
+    size_t end = file.size() - 8;
+    rgb.clear();
+    while (rgb.size() < (size_t) width * height * 3 && p < end){
+        uint8_t op = file[p++];
+        int run = 1;
+        if (op == QOI_OP_RGB){
+            pixel[0] = file[p];
+            pixel[1] = file[p + 1];
+            pixel[2] = file[p + 2];
+            p += 3;
+        }
+        else if (op == QOI_OP_RGBA){
+            for (int c = 0; c < 4; c++) pixel[c] = file[p + c];
+            p += 4;
+        }
+        else if ((op & 0xc0) == QOI_OP_INDEX){
+            for (int c = 0; c < 4; c++) pixel[c] = lookup[op][c];
+        }
+        else if ((op & 0xc0) == QOI_OP_DIFF){
+            pixel[0] += ((op >> 4) & 3) - 2;
+            pixel[1] += ((op >> 2) & 3) - 2;
+            pixel[2] += (op & 3) - 2;
+        }
+        else if ((op & 0xc0) == QOI_OP_LUMA){
+            int dg = (op & 0x3f) - 32;
+            uint8_t next = file[p++];
+            pixel[0] += dg + ((next >> 4) & 0xf) - 8;
+            pixel[1] += dg;
+            pixel[2] += dg + (next & 0xf) - 8;
+        }
+        else{
+            run = (op & 0x3f) + 1;
+        }
+        int slot = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+        for (int c = 0; c < 4; c++) lookup[slot][c] = pixel[c];
+        for (int k = 0; k < run; k++){
+            rgb.insert(rgb.end(), pixel, pixel + 3);
+        }
+    }
+    return rgb.size() == (size_t) width * height * 3 && std::equal(file.end() - 8, file.end(), QOI_END_MARKER);
+}
+
+
+// reads a zlib stream, enough of RFC 1950 and 1951 for what any deflate encoder writes
+class Inflater{
+    public:
+        Inflater(const std::vector<uint8_t>& data_): data(data_){
+        }
+
+        bool inflate(std::vector<uint8_t>& out){
+            if (data.size() < 6 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[0] & 0xf) != 8) return false;
+            position = 16;
+            bool last = false;
+            while (!last){
+                last = bits(1);
+                int type = bits(2);
+                if (type == 0){
+                    position = (position + 7) & ~(size_t) 7;
+                    int length = bits(16);
+                    int complement = bits(16);
+                    if ((length ^ 0xffff) != complement) return false;
+                    for (int i = 0; i < length; i++) out.push_back(bits(8));
+                }
+                else if (type == 1){
+                    uint8_t lengths[288 + 32];
+                    for (int i = 0; i < 288; i++) lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+                    for (int i = 0; i < 32; i++) lengths[288 + i] = 5;
+                    Huffman literals(lengths, 288);
+                    Huffman distances(lengths + 288, 32);
+                    if (!block(literals, distances, out)) return false;
+                }
+                else if (type == 2){
+                    int literalCount = bits(5) + 257;
+                    int distanceCount = bits(5) + 1;
+                    int codeCount = bits(4) + 4;
+                    uint8_t codeLengths[19] = {};
+                    for (int i = 0; i < codeCount; i++) codeLengths[deflate::CODE_LENGTH_ORDER[i]] = bits(3);
+                    Huffman lengthCode(codeLengths, 19);
+                    uint8_t lengths[286 + 30] = {};
+                    for (int i = 0; i < literalCount + distanceCount;){
+                        int symbol = decode(lengthCode);
+                        if (symbol < 0) return false;
+                        if (symbol < 16){
+                            lengths[i++] = symbol;
+                            continue;
+                        }
+                        int repeat = symbol == 16 ? 3 + bits(2) : symbol == 17 ? 3 + bits(3) : 11 + bits(7);
+                        if (symbol == 16 && i == 0) return false;
+                        uint8_t value = symbol == 16 ? lengths[i - 1] : 0;
+                        if (i + repeat > literalCount + distanceCount) return false;
+                        while (repeat-- > 0) lengths[i++] = value;
+                    }
+                    Huffman literals(lengths, literalCount);
+                    Huffman distances(lengths + literalCount, distanceCount);
+                    if (!block(literals, distances, out)) return false;
+                }
+                else{
+                    return false;
+                }
+                if (position > data.size() * 8) return false;
+            }
+            position = (position + 7) & ~(size_t) 7;
+            if (position / 8 + 4 != data.size()) return false;
+            return get32(data.data() + position / 8) == deflate::adler32(out.data(), out.size());
+        }
+
+    private:
+        // canonical code as counts per length and the symbols in code order
+        struct Huffman{
+            int counts[16] = {};
+            std::vector<int> symbols;
+
+            Huffman(const uint8_t* lengths, int count){
+                for (int i = 0; i < count; i++) counts[lengths[i]]++;
+                counts[0] = 0;
+                for (int length = 1; length < 16; length++){
+                    for (int i = 0; i < count; i++){
+                        if (lengths[i] == length) symbols.push_back(i);
+                    }
+                }
+            }
+        };
+
+        int bits(int count){
+            int value = 0;
+            for (int i = 0; i < count; i++, position++){
+                if (position / 8 >= data.size()) return 0;
+                value |= ((data[position / 8] >> (position % 8)) & 1) << i;
+            }
+            return value;
+        }
+
+        int decode(const Huffman& code){
+            int value = 0, first = 0, index = 0;
+            for (int length = 1; length < 16; length++){
+                value |= bits(1);
+                int count = code.counts[length];
+                if (value - first < count) return code.symbols[index + value - first];
+                index += count;
+                first = (first + count) << 1;
+                value <<= 1;
+            }
+            return -1;
+        }
+
+        bool block(const Huffman& literals, const Huffman& distances, std::vector<uint8_t>& out){
+            while (true){
+                int symbol = decode(literals);
+                if (symbol < 0 || symbol > 285) return false;
+                if (symbol < 256){
+                    out.push_back(symbol);
+                    continue;
+                }
+                if (symbol == 256) return true;
+                symbol -= 257;
+                int length = deflate::LENGTH_BASE[symbol] + bits(deflate::LENGTH_EXTRA[symbol]);
+                int code = decode(distances);
+                if (code < 0 || code > 29) return false;
+                size_t distance = deflate::DISTANCE_BASE[code] + bits(deflate::DISTANCE_EXTRA[code]);
+                if (distance > out.size()) return false;
+                for (int i = 0; i < length; i++) out.push_back(out[out.size() - distance]);
+            }
+        }
+
+        const std::vector<uint8_t>& data;
+        size_t position = 0;
+};
+
+// reads back an 8 bit RGB PNG, checking every chunk's CRC on the way
+static bool decodePNG(const std::vector<uint8_t>& file, int& width, int& height, std::vector<uint8_t>& rgb){
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    if (file.size() < 8 || !std::equal(signature, signature + 8, file.begin())) return false;
+    std::vector<uint8_t> compressed;
+    bool ended = false;
+    for (size_t p = 8; p + 12 <= file.size() && !ended;){
+        uint32_t size = get32(file.data() + p);
+        if (p + 12 + size > file.size()) return false;
+        const uint8_t* type = file.data() + p + 4;
+        const uint8_t* body = type + 4;
+        if (get32(body + size) != deflate::crc32(body, size, deflate::crc32(type, 4))) return false;
+        std::string name((const char*) type, 4);
+        if (name == "IHDR"){
+            width = get32(body);
+            height = get32(body + 4);
+            if (body[8] != 8 || body[9] != 2 || body[12] != 0) return false;
+        }
+        else if (name == "IDAT"){
+            compressed.insert(compressed.end(), body, body + size);
+        }
+        ended = name == "IEND";
+        p += 12 + size;
+    }
+    std::vector<uint8_t> filtered;
+    if (!ended || !Inflater(compressed).inflate(filtered)) return false;
+    size_t rowSize = (size_t) width * 3;
+    if (filtered.size() != (rowSize + 1) * height) return false;
+    rgb.assign(rowSize * height, 0);
+    for (int y = 0; y < height; y++){
+        int type = filtered[y * (rowSize + 1)];
+        const uint8_t* in = filtered.data() + y * (rowSize + 1) + 1;
+        uint8_t* row = rgb.data() + y * rowSize;
+        const uint8_t* up = y > 0 ? row - rowSize : nullptr;
+        for (size_t i = 0; i < rowSize; i++){
+            int a = i >= 3 ? row[i - 3] : 0;
+            int b = up ? up[i] : 0;
+            int c = up && i >= 3 ? up[i - 3] : 0;
+            int p = a + b - c;
+            int paeth = std::abs(p - a) <= std::abs(p - b) && std::abs(p - a) <= std::abs(p - c) ? a : std::abs(p - b) <= std::abs(p - c) ? b : c;
+            int predicted = type == 1 ? a : type == 2 ? b : type == 3 ? (a + b) / 2 : type == 4 ? paeth : 0;
+            if (type > 4) return false;
+            row[i] = in[i] + predicted;
+        }
+    }
+    return true;
+}
+
+// smooth gradients, flat areas and noise, so every QOI op and PNG filter gets used
+static Framebuffer testImage(int width, int height){
+    Framebuffer image(width, height);
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> noise(0, 255);
+    for (int y = 0; y < height; y++){
+        for (int x = 0; x < width; x++){
+            Vec3 colour;
+            if (y < height / 3) colour = Vec3(x * 255.0f / width, y * 2.0f, 128);
+            else if (y < height * 2 / 3) colour = x < width / 2 ? Vec3(40, 80, 120) : Vec3(-5, 300, 255.9f);
+            else colour = Vec3(noise(rng), noise(rng), noise(rng));
+            image.at(x, y) = colour;
+        }
+    }
+    return image;
+}
+
+// both lossless formats read back to the bytes the encoder was given, written in one go and in bands
+static void testImageRoundTrip(){
+    // more rows than a PNG strip, so the checksums of several strips are combined, and more strips
+    // than the pool has threads, so they are compressed in several batches
+    Framebuffer image = testImage(97, 300);
+    std::vector<uint8_t> expected;
+    for (const Vec3& pixel: image.pixels){
+        expected.push_back(toByte(pixel.x));
+        expected.push_back(toByte(pixel.y));
+        expected.push_back(toByte(pixel.z));
+    }
+    ThreadPool pool(8);
+    for (const char* path: {"roundtrip.qoi", "roundtrip.png"}){
+        std::vector<uint8_t> serial;
+        for (unsigned threads: {1u, 3u}){
+            for (int bandRows: {0, 7}){
+                if (bandRows == 0){
+                    CHECK(writeImage(path, image, threads > 1 ? &pool : nullptr));
+                }
+                else{
+                    ImageEncoder encoder(2, threads);
+                    encoder.open(path, image.width, image.height);
+                    // bands in reverse order, the encoder must still write them top to bottom
+                    for (int y = (image.height - 1) / bandRows * bandRows; y >= 0; y -= bandRows){
+                        encoder.push(y, std::min(bandRows, image.height - y), &image.pixels[(size_t) y * image.width]);
+                    }
+                    CHECK(encoder.finish());
+                }
+                std::vector<uint8_t> file = readFile(path);
+                int width = 0, height = 0;
+                std::vector<uint8_t> rgb;
+                bool decoded = imageFormat(path) == ImageFormat::PNG ? decodePNG(file, width, height, rgb) : decodeQOI(file, width, height, rgb);
+                CHECK(decoded);
+                CHECK(width == image.width && height == image.height);
+                CHECK(rgb == expected);
+                // the strip layout does not depend on the threads compressing it
+                if (serial.empty()){
+                    serial = file;
+                }
+                CHECK(file == serial);
+                std::remove(path);
+            }
+        }
+    }
+}
+
+
+// IEEE half precision to float
+static float fromHalf(uint16_t half){
+    int exponent = (half >> 10) & 0x1f;
+    int mantissa = half & 0x3ff;
+    float value;
+    if (exponent == 0) value = std::ldexp((float) mantissa, -24);
+    else if (exponent == 31) value = mantissa ? std::nanf("") : finf;
+    else value = std::ldexp((float) (mantissa | 0x400), exponent - 25);
+    return half & 0x8000 ? -value : value;
+}
+
+// reads back the uncompressed half float B, G, R scanline EXR the encoder writes, pixels as RGB floats
+static bool decodeEXR(const std::vector<uint8_t>& file, int& width, int& height, std::vector<float>& rgb){
+    const uint8_t magic[8] = {0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0};
+    if (file.size() < 8 || !std::equal(magic, magic + 8, file.begin())) return false;
+    auto int32 = [&](size_t at){
+        int32_t value;
+        std::memcpy(&value, &file[at], 4);
+        return value;
+    };
+    size_t p = 8;
+    bool channels = false, uncompressed = false;
+    width = height = 0;
+    while (p < file.size() && file[p] != 0){
+        std::string name((const char*) &file[p]);
+        p += name.size() + 1;
+        std::string type((const char*) &file[p]);
+        p += type.size() + 1;
+        int32_t size = int32(p);
+        p += 4;
+        if (p + size > file.size()) return false;
+        if (name == "channels"){
+            // B, G and R, each half (1) and sampled every pixel
+            const char* names[3] = {"B", "G", "R"};
+            size_t q = p;
+            channels = true;
+            for (const char* expected: names){
+                channels = channels && std::string((const char*) &file[q]) == expected && int32(q + 2) == 1 && int32(q + 10) == 1 && int32(q + 14) == 1;
+                q += 18;
+            }
+            channels = channels && file[q] == 0;
+        }
+        else if (name == "compression"){
+            uncompressed = file[p] == 0;
+        }
+        else if (name == "dataWindow"){
+            width = int32(p + 8) - int32(p) + 1;
+            height = int32(p + 12) - int32(p + 4) + 1;
+        }
+        p += size;
+    }
+    if (!channels || !uncompressed || width <= 0 || height <= 0) return false;
+    size_t table = p + 1;
+    if (table + (size_t) height * 8 > file.size()) return false;
+    rgb.assign((size_t) width * height * 3, 0);
+    for (int y = 0; y < height; y++){
+        uint64_t offset;
+        std::memcpy(&offset, &file[table + (size_t) y * 8], 8);
+        if (offset + 8 + (uint64_t) width * 6 > file.size() || int32(offset) != y || int32(offset + 4) != width * 6) return false;
+        const uint8_t* line = &file[offset + 8];
+        for (int channel = 0; channel < 3; channel++){
+            for (int x = 0; x < width; x++){
+                uint16_t half;
+                std::memcpy(&half, line + ((size_t) channel * width + x) * 2, 2);
+                // B, G, R in the file
+                rgb[((size_t) y * width + x) * 3 + 2 - channel] = fromHalf(half);
+            }
+        }
+    }
+    return true;
+}
+
+// reads back a little endian PFM, stored bottom row first, pixels as RGB floats from the top row
+static bool decodePFM(const std::vector<uint8_t>& file, int& width, int& height, std::vector<float>& rgb){
+    size_t p = 0;
+    std::string fields[3];
+    for (std::string& field: fields){
+        while (p < file.size() && file[p] != '\n') field.push_back(file[p++]);
+        p++;
+    }
+    std::istringstream size(fields[1]);
+    float scale = 0;
+    if (fields[0] != "PF" || !(size >> width >> height) || !(std::istringstream(fields[2]) >> scale) || scale >= 0) return false;
+    size_t rowFloats = (size_t) width * 3;
+    if (p + rowFloats * height * 4 != file.size()) return false;
+    rgb.assign(rowFloats * height, 0);
+    for (int y = 0; y < height; y++){
+        std::memcpy(&rgb[(size_t) (height - 1 - y) * rowFloats], &file[p + (size_t) y * rowFloats * 4], rowFloats * 4);
+    }
+    return true;
+}
+
+// both float formats keep colours outside 0-255 and read back to what they were given over 255,
+// PFM exactly and EXR to half precision, written in one go and in bands arriving out of order
+static void testHDRImage(){
+    Framebuffer image = testImage(61, 150);
+    for (const char* path: {"roundtrip.exr", "roundtrip.pfm"}){
+        bool exr = imageFormat(path) == ImageFormat::EXR;
+        for (int bandRows: {0, 7}){
+            if (bandRows == 0){
+                CHECK(writeImage(path, image));
+            }
+            else{
+                ImageEncoder encoder;
+                encoder.open(path, image.width, image.height);
+                for (int y = (image.height - 1) / bandRows * bandRows; y >= 0; y -= bandRows){
+                    encoder.push(y, std::min(bandRows, image.height - y), &image.pixels[(size_t) y * image.width]);
+                }
+                CHECK(encoder.finish());
+            }
+            std::vector<uint8_t> file = readFile(path);
+            int width = 0, height = 0;
+            std::vector<float> rgb;
+            CHECK(exr ? decodeEXR(file, width, height, rgb) : decodePFM(file, width, height, rgb));
+            CHECK(width == image.width && height == image.height);
+            int wrong = 0;
+            for (size_t i = 0; i < image.pixels.size() && rgb.size() == image.pixels.size() * 3; i++){
+                const Vec3& pixel = image.pixels[i];
+                float expected[3] = {pixel.x / 255.0f, pixel.y / 255.0f, pixel.z / 255.0f};
+                for (int c = 0; c < 3; c++){
+                    // half of a half precision step, relative, or of the smallest denormal
+                    float tolerance = exr ? std::fabs(expected[c]) / 2048 + 3e-8f : 0;
+                    wrong += !(std::fabs(rgb[i * 3 + c] - expected[c]) <= tolerance);
+                }
+            }
+            CHECK(rgb.size() == image.pixels.size() * 3 && wrong == 0);
+            std::remove(path);
+        }
+    }
+}
+
+// a bumpy n by n grid with texture coordinates, 2 n^2 triangles
+static void writeGrid(const std::string& path, int n){
+    std::ofstream obj(path);
+    for (int z = 0; z <= n; z++){
+        for (int x = 0; x <= n; x++){
+            obj << "v " << x << " " << std::sin(x * 0.3f) * std::cos(z * 0.2f) << " " << z << "\n";
+            obj << "vt " << x / (float) n << " " << z / (float) n << "\n";
+        }
+    }
+    for (int z = 0; z < n; z++){
+        for (int x = 0; x < n; x++){
+            int a = z * (n + 1) + x + 1;
+            obj << "f " << a << "/" << a << " " << a + 1 << "/" << a + 1 << " " << a + n + 2 << "/" << a + n + 2 << "\n";
+            obj << "f " << a << "/" << a << " " << a + n + 2 << "/" << a + n + 2 << " " << a + n + 1 << "/" << a + n + 1 << "\n";
+        }
+    }
+}
+
+// polygons, normal indices and indices counted back from the end, read in chunks on a pool, where the
+// faces counting back sit a few chunks past their vertices, give the mesh one thread reads
+static void testOBJ(){
+    const std::string path = "objtest.obj";
+    {
+        std::ofstream obj(path);
+        obj << "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 0.5 1.5 0\nvn 0 0 1\nvn 0 0 -1\n";
+        // over 3MB of comments, so a pool of 4 reads the file in 3 chunks and the faces are in the last
+        std::string comment = "# " + std::string(77, '-') + "\n";
+        for (int i = 0; i < 40000; i++){
+            obj << comment;
+        }
+        // a pentagon, fanned into three triangles, with every vertex counted back from the end
+        obj << "f -5//-2 -4//-2 -3//-2 -2//-2 -1//-2\n";
+        // three of its corners with the other normal, which makes copies of them
+        obj << "f 1//2 3//2 2//2\n";
+        // past the last vertex, before the first one, the missing index 0 and too few corners
+        obj << "f 1 2 9\nf -9 1 2\nf 0 1 2\nf 1 2\n";
+    }
+    ThreadPool pool(4);
+    ObjData serial, parallel;
+    CHECK(loadOBJ(path, serial));
+    CHECK(loadOBJ(path, parallel, &pool));
+    const std::vector<uint32_t> expected = {0, 1, 2, 0, 2, 3, 0, 3, 4, 5, 6, 7};
+    CHECK(serial.indices == expected);
+    CHECK(serial.vertices.size() == 8 && serial.normals.size() == 8);
+    if (serial.vertices.size() == 8 && serial.normals.size() == 8){
+        CHECK(serial.vertices[5] == serial.vertices[0] && serial.vertices[6] == serial.vertices[2] && serial.vertices[7] == serial.vertices[1]);
+        CHECK(serial.vertices[4] == Vec3(0.5f, 1.5f, 0));
+        for (int i = 0; i < 8; i++){
+            CHECK(serial.normals[i] == (i < 5 ? Vec3(0, 0, 1) : Vec3(0, 0, -1)));
+        }
+    }
+    CHECK(sameBytes(parallel.vertices, serial.vertices));
+    CHECK(sameBytes(parallel.normals, serial.normals));
+    CHECK(parallel.indices == serial.indices);
+    std::remove(path.c_str());
+}
+
+// a mesh read from the cache is the mesh that was written, and a stale cache is never used
+static void testMeshCache(){
+    const std::string path = "cachetest.obj";
+    const std::string cachePath = path + ".cache";
+    writeGrid(path, 40);
+    std::remove(cachePath.c_str());
+    ThreadPool pool(2);
+    MeshTransform transform;
+    transform.rotation = Vec3(0.3f, 0, 0.1f);
+    transform.scale = 0.25f;
+    transform.center = true;
+    transform.translation = Vec3(1, 2, -3);
+
+    auto built = loadMesh(path, transform, Vec3(255), nullptr, &pool);
+    CHECK(built->triangleCount() == 40 * 40 * 2);
+    TriangleMesh cached(Vec3(255), nullptr);
+    CHECK(meshcache::read(cachePath, hashBytes(readFile(path).data(), readFile(path).size()), hashTransform(transform), cached));
+    CHECK(sameBytes(cached.vertices, built->vertices));
+    CHECK(sameBytes(cached.normals, built->normals));
+    CHECK(sameBytes(cached.texcoords, built->texcoords));
+    CHECK(sameBytes(cached.indices, built->indices));
+    CHECK(sameBytes(cached.bvh.nodes, built->bvh.nodes));
+    CHECK(sameBytes(cached.bvh.triIndices, built->bvh.triIndices));
+    CHECK(sameBytes(cached.bvh.packets, built->bvh.packets));
+    CHECK(cached.boundingBox[0] == built->boundingBox[0] && cached.boundingBox[1] == built->boundingBox[1]);
+
+    // a different transform misses the cache
+    MeshTransform moved = transform;
+    moved.translation.x += 1;
+    TriangleMesh stale(Vec3(255), nullptr);
+    CHECK(!meshcache::read(cachePath, hashBytes(readFile(path).data(), readFile(path).size()), hashTransform(moved), stale));
+
+    // an octree mesh is cached without a BVH, the next BVH load builds one and caches it
+    std::remove(cachePath.c_str());
+    auto octree = loadMesh(path, transform, Vec3(255), nullptr, &pool, 4);
+    CHECK(octree->bvh.empty() && !octree->tree.empty());
+    CHECK(sameBytes(octree->vertices, built->vertices));
+    auto again = loadMesh(path, transform, Vec3(255), nullptr, &pool);
+    CHECK(sameBytes(again->bvh.nodes, built->bvh.nodes));
+    TriangleMesh rewritten(Vec3(255), nullptr);
+    CHECK(meshcache::read(cachePath, hashBytes(readFile(path).data(), readFile(path).size()), hashTransform(transform), rewritten));
+    CHECK(sameBytes(rewritten.bvh.nodes, built->bvh.nodes));
+
+    std::remove(cachePath.c_str());
+    std::remove(path.c_str());
+}
+
+
+// settings from the file and the command line, the command line winning, objects with their options,
+// out of range values and unknown statements rejected, and camera keys filled in from the ones before
+static void testSceneFile(){
+    writeGrid("scenetest.obj", 4);
+    auto writeScene = [](const std::string& text){
+        std::ofstream scene("scenetest.scene");
+        scene << text;
+    };
+    writeScene("# a plane, a sphere and an octree mesh\n"
+               "resolution 320 180\nspp 4\ndepth 6\nfov 40\noctree-depth 6\noutput scenetest.png\n"
+               "camera 0 1 5\nlookat 0 1 0\nmaterial shiny phong\n"
+               "plane point 0 0 0 normal 0 1 0 colour 200 200 200 material lambertian checkered\n"
+               "sphere center 0 1 0 radius 1 colour 255 0 0 material shiny\n"
+               "mesh file scenetest.obj colour 100 200 100 material glass scale 0.1 octree\n");
+    ThreadPool pool(2);
+    MeshLibrary library(&pool);
+    SceneLoader loader(library);
+
+    RenderJob job;
+    CHECK(loader.load("scenetest.scene", {}, job));
+    CHECK(job.settings.width == 320 && job.settings.height == 180);
+    CHECK(job.settings.spp == 4 && job.settings.depth == 6);
+    CHECK(std::fabs(job.settings.fov - 40 * (float) M_PI / 180) < 1e-6f);
+    CHECK(job.output == "scenetest.png");
+    CHECK(job.scene.camera == Vec3(0, 1, 5) && job.scene.cameraDirection == Vec3(0, 0, -5));
+    CHECK(job.scene.objects.size() == 3);
+    if (job.scene.objects.size() == 3){
+        auto mesh = std::dynamic_pointer_cast<TriangleMesh>(job.scene.objects[2]);
+        CHECK(mesh && mesh->bvh.empty() && mesh->tree.depth == 6 && mesh->colour == Vec3(100, 200, 100));
+    }
+
+    CHECK(loader.load("scenetest.scene", {"spp 9", "resolution 64 32", "octree-depth 3", "adaptive"}, job));
+    CHECK(job.settings.width == 64 && job.settings.height == 32);
+    CHECK(job.settings.spp == 9 && job.settings.adaptive && job.settings.depth == 6);
+    if (job.scene.objects.size() == 3){
+        auto mesh = std::dynamic_pointer_cast<TriangleMesh>(job.scene.objects[2]);
+        CHECK(mesh && mesh->tree.depth == 3);
+    }
+
+    // values out of range, missing or extra values and settings that do not exist
+    for (const char* bad: {"spp 0", "min-spp 0", "max-spp -4", "depth -1", "octree-depth 0", "octree-depth 99",
+                           "frames 0", "refit-limit 0.5", "resolution 64", "spp 4 5", "spp four"}){
+        CHECK(!loader.load("scenetest.scene", {bad}, job));
+    }
+    CHECK(SceneLoader::settingArguments("resolution") == 2 && SceneLoader::settingArguments("adaptive") == 0);
+    CHECK(SceneLoader::settingArguments("mesh") < 0 && SceneLoader::settingArguments("bogus") < 0);
+    writeScene("resolution 64 32\nbogus 1 2 3\n");
+    CHECK(!loader.load("scenetest.scene", {}, job));
+    writeScene("resolution 64 32\nsphere center 0 0 0 radius 1 material unknown\n");
+    CHECK(!loader.load("scenetest.scene", {}, job));
+
+    // the second key keeps the first one's target and fov, the frame count runs to the last key,
+    // a single frame is a still from where the keys put the camera at frame 0
+    writeScene("resolution 64 32\nfov 30\ncamera 0 0 5\nlookat 0 0 0\n"
+               "keyframe 0 camera 0 0 5\nkeyframe 9 camera 5 0 5 fov 60\n");
+    CHECK(loader.load("scenetest.scene", {}, job));
+    CHECK(job.animation.frames == 10 && job.animation.cameraKeys.size() == 2);
+    if (job.animation.cameraKeys.size() == 2){
+        const CameraKey& last = job.animation.cameraKeys[1];
+        CHECK(last.position == Vec3(5, 0, 5) && last.target == Vec3(0) && std::fabs(last.fov - 60 * (float) M_PI / 180) < 1e-6f);
+    }
+    CHECK(loader.load("scenetest.scene", {"frames 1", "camera 1 2 3"}, job));
+    CHECK(job.animation.frames == 1 && !job.animation.animated());
+    CHECK(job.scene.camera == Vec3(0, 0, 5) && job.scene.cameraDirection == Vec3(0, 0, -5));
+
+    for (const char* path: {"scenetest.obj", "scenetest.obj.cache", "scenetest.scene"}){
+        std::remove(path);
+    }
+}
+
+
+/*
+   once one warm-up frame has grown the scratch arenas, tiles render without touching the heap,
+   counted by the allocation hook, which this target always has as it is built with RT_STATS
+   more render threads than most machines have cores, so some get few or no tiles in the warm-up and
+   their arenas have to be grown before they see a tile as large as the largest one of the warm-up
+*/
+static void testTileAllocations(){
+    writeGrid("tiles.obj", 30);
+    {
+        std::ofstream scene("tiles.scene");
+        scene << "resolution 160 90\nspp 2\ndepth 8\noutput tiles.qoi\ncamera 15 12 40\nlookat 15 0 15\nlight 15 20 30\n"
+              << "plane point 0 -2 0 normal 0 1 0 colour 255 255 255 material lambertian checkered\n"
+              << "sphere center 10 3 25 radius 3 colour 255 255 255 material glass\n"
+              << "mesh file tiles.obj colour 200 120 80 material phong\n";
+    }
+    ThreadPool pool(8);
+    ImageEncoder encoder;
+    MeshLibrary library(&pool);
+    SceneLoader loader(library);
+    for (const char* sampling: {"spp 2", "adaptive"}){
+        RenderJob job;
+        CHECK(loader.load("tiles.scene", {sampling}, job));
+        RenderScene compiled(job.scene);
+        Renderer renderer(compiled, job.settings, pool);
+        Framebuffer image(job.settings.width, job.settings.height);
+        uint64_t warm = 0;
+        for (int frame = 0; frame < 3; frame++){
+            if (frame == 1){
+                warm = stats::total(stats::TileAllocations);
+            }
+            encoder.open(job.output, job.settings.width, job.settings.height);
+            renderer.render(image, encoder);
+            CHECK(encoder.finish());
+        }
+        CHECK(stats::total(stats::TileAllocations) == warm);
+    }
+    for (const char* path: {"tiles.obj", "tiles.obj.cache", "tiles.scene", "tiles.qoi"}){
+        std::remove(path);
+    }
+}
+
+
+struct Test{
+    const char* name;
+    void (*run)();
+};
+
+const Test TESTS[] = {
+    {"bvh", testBVH},
+    {"octree", testOctree},
+    {"refit", testRefit},
+    {"transform", testTransform},
+    {"obj", testOBJ},
+    {"image", testImageRoundTrip},
+    {"hdrimage", testHDRImage},
+    {"meshcache", testMeshCache},
+    {"scenefile", testSceneFile},
+    {"tiles", testTileAllocations}
+};
+
+int main(int argc, char** argv){
+    std::vector<std::string> names(argv + 1, argv + argc);
+    bool known = true;
+    for (const std::string& name: names){
+        known = known && std::any_of(std::begin(TESTS), std::end(TESTS), [&](const Test& test){ return name == test.name; });
+    }
+    if (!known){
+        std::cerr << "usage: tests";
+        for (const Test& test: TESTS){
+            std::cerr << " [" << test.name << "]";
+        }
+        std::cerr << std::endl;
+        return 1;
+    }
+    for (const Test& test: TESTS){
+        if (!names.empty() && std::find(names.begin(), names.end(), test.name) == names.end()) continue;
+        int before = failures;
+        test.run();
+        std::cout << test.name << ": " << (failures == before ? "passed" : "FAILED") << std::endl;
+    }
+    return failures > 0 ? 1 : 0;
+}